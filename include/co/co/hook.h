@@ -59,6 +59,8 @@ typedef struct hostent* (*gethostbyaddr_fp_t)(const void*, socklen_t, int);
 
 #ifdef __linux__
 typedef int (*epoll_wait_fp_t)(int, struct epoll_event*, int, int);
+typedef int (*dup2_fp_t)(int, int);
+typedef int (*dup3_fp_t)(int, int, int);
 typedef int (*accept4_fp_t)(int, struct sockaddr*, socklen_t*, int);
 
 typedef struct hostent* (*gethostbyname2_fp_t)(const char*, int);
@@ -102,6 +104,8 @@ dec_raw_api(gethostbyaddr);
 
 #ifdef __linux__
 dec_raw_api(epoll_wait);
+dec_raw_api(dup2);
+dec_raw_api(dup3);
 dec_raw_api(accept4);
 dec_raw_api(gethostbyname2);
 dec_raw_api(gethostbyname_r);
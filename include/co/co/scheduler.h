@@ -36,7 +36,11 @@ namespace xx {
 
 class Coroutine;
 class Scheduler;
+class PollSet;
 extern __thread Scheduler* gSched;
+
+// free the watch set of co::poll() when its coroutine ends, see poll.cc
+void delete_poll_set(PollSet* s);
 typedef std::multimap<int64, Coroutine*>::iterator timer_id_t;
 
 /**
@@ -90,16 +94,21 @@ enum {
 class Coroutine {
   public:
     explicit Coroutine(int i)
-        : id(i), state(S_init), ctx(0), stack(), cb(0) {
+        : id(i), state(S_init), ctx(0), stack(), lctx(0), pset(0), cb(0) {
         set_null_timer_id(it);
     }
-    ~Coroutine() = default;
+    ~Coroutine() {
+        if (lctx) log::xx::delete_log_context(lctx);
+        if (pset) delete_poll_set(pset);
+    }
 
     int id;           // coroutine id
     int state;        // coroutine state
     tb_context_t ctx; // context, a pointer points to the stack bottom
     fastream stack;   // save stack data for this coroutine
     timer_id_t it;    // timer id
+    log::xx::LogContext* lctx; // log context, see log::set_context()
+    PollSet* pset;    // watch set of co::poll()
 
     // Once the coroutine starts, we no longer need the cb, and it can
     // be used to store the Scheduler pointer.
@@ -137,6 +146,8 @@ class Copool {
     }
 
     void push(Coroutine* co) {
+        if (co->lctx) log::xx::clear_log_context(co->lctx);
+        if (co->pset) { delete_poll_set(co->pset); co->pset = 0; }
         _ids.push_back(co->id);
     }
 
@@ -22,6 +22,19 @@ typedef SOCKET sock_t;
 #include <netinet/tcp.h> // for TCP_NODELAY...
 #include <arpa/inet.h>   // for inet_ntop...
 #include <netdb.h>       // getaddrinfo, gethostby...
+#ifdef __linux__
+#include <poll.h>        // for struct pollfd
+#include <netinet/udp.h> // for UDP_SEGMENT, UDP_GRO
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 
 typedef int sock_t;
 #endif
@@ -244,6 +257,72 @@ int send(sock_t fd, const void* buf, int n, int ms=-1);
  */
 int sendto(sock_t fd, const void* buf, int n, const void* dst_addr, int addrlen, int ms=-1);
 
+#ifdef __linux__
+/**
+ * recv multiple datagrams from a socket
+ *   - It MUST be called in a coroutine.
+ *   - It blocks until at least one datagram was recieved or timeout, or any error occured.
+ *     Then it fills as many messages as possible without waiting again.
+ *   - On return, msgs[i].msg_len contains the bytes recieved for the ith message.
+ *   - The errno will be set to ETIMEDOUT on timeout, call co::error() to get the errno,
+ *     or simply call co::timeout() to check whether it has timed out.
+ *
+ * @param fd    a non-blocking socket, usually an UDP socket.
+ * @param msgs  an array of struct mmsghdr, see details in man recvmmsg.
+ * @param n     number of elements in msgs.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      number of messages recieved (1 to n) on success, -1 on timeout or error.
+ */
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms=-1);
+
+/**
+ * send multiple datagrams on a socket
+ *   - It MUST be called in a coroutine.
+ *   - It blocks until all the n messages are sent or timeout, or any error occured.
+ *   - On return, msgs[i].msg_len contains the bytes sent for the ith message.
+ *   - The errno will be set to ETIMEDOUT on timeout, call co::error() to get the errno,
+ *     or simply call co::timeout() to check whether it has timed out.
+ *
+ * @param fd    a non-blocking socket, usually an UDP socket.
+ * @param msgs  an array of struct mmsghdr, see details in man sendmmsg.
+ * @param n     number of elements in msgs.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      n on success, -1 on timeout or error.
+ */
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms=-1);
+
+/**
+ * wait for IO events on a set of fds, the same as poll() but coroutine-aware
+ *   - It MUST be called in a coroutine.
+ *   - It blocks the coroutine, not the thread, until any fd is ready or timeout.
+ *   - The fds are kept in a watch set (an epoll) of the calling coroutine between 
+ *     calls, which is freed when the coroutine ends. A fd is registered again 
+ *     only when its events change, or it was closed by close(), dup2() or dup3() 
+ *     (hooked) or co::close(). A fd closed in other ways, e.g. by fclose(), may 
+ *     be missed if its number is reused. A single timer is used however many 
+ *     fds there are. 
+ *
+ * @param fds   an array of struct pollfd, negative fds are ignored.
+ * @param nfds  number of elements in fds.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      number of fds with non-zero revents, 0 on timeout, -1 on error.
+ */
+int poll(struct pollfd* fds, int nfds, int ms=-1);
+
+namespace xx {
+// remove fd from the watch sets of co::poll() in the current scheduler, and 
+// mark it changed for other threads. It is called before fd is closed, so a 
+// registration kept alive by a dup of fd is removed as well.
+void poll_del_fd(int fd);
+} // xx
+#endif
+
 #ifdef _WIN32
 /**
  * get options on a socket, man getsockopt for details.
@@ -283,6 +362,24 @@ inline void set_reuseaddr(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
 }
 
+/**
+ * set option SO_REUSEPORT on a socket 
+ *   - Multiple sockets may bind to the same address and port, and the kernel 
+ *     will distribute incoming connections or datagrams among them. 
+ *   - Load balancing among the sockets requires Linux 3.9+. 
+ * 
+ * @return  true on success, false if it is not supported.
+ */
+inline bool set_reuseport(sock_t fd) {
+  #ifdef SO_REUSEPORT
+    int v = 1;
+    return co::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v)) == 0;
+  #else
+    (void) fd;
+    return false;
+  #endif
+}
+
 /**
  * set send buffer size for a socket 
  *   - It MUST be called before the socket is connected. 
@@ -315,6 +412,54 @@ inline void set_tcp_keepalive(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &v, sizeof(v));
 }
 
+#ifdef __linux__
+/**
+ * set option UDP_SEGMENT (GSO) on an UDP socket 
+ *   - Linux 4.18+ required. 
+ *   - A datagram sent on this socket larger than n bytes will be split by the 
+ *     kernel (or the NIC) into segments of n bytes, so one co::sendto() or one 
+ *     message of co::sendmmsg() may carry up to 64 segments. 
+ * 
+ * @param n  size of a segment, 0 to disable GSO.
+ * 
+ * @return   true on success, false if it is not supported.
+ */
+inline bool set_udp_segment(sock_t fd, int n) {
+    return co::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &n, sizeof(n)) == 0;
+}
+
+/**
+ * set option UDP_GRO on an UDP socket 
+ *   - Linux 5.0+ required. 
+ *   - The kernel may coalesce datagrams from the same flow into one large buffer. 
+ *     Use co::udp_gro_size() on the recieved msghdr to get the segment size. 
+ * 
+ * @return  true on success, false if it is not supported.
+ */
+inline bool set_udp_gro(sock_t fd) {
+    int v = 1;
+    return co::setsockopt(fd, SOL_UDP, UDP_GRO, &v, sizeof(v)) == 0;
+}
+
+/**
+ * get segment size of a datagram recieved on a socket with UDP_GRO enabled 
+ *   - msg->msg_control MUST point to a buffer of at least CMSG_SPACE(sizeof(int)) 
+ *     bytes before the message was recieved. 
+ * 
+ * @return  size of the segments, or 0 if the datagram was not coalesced.
+ */
+inline int udp_gro_size(const struct msghdr* msg) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR((struct msghdr*)msg, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int n;
+            memcpy(&n, CMSG_DATA(c), sizeof(n));
+            return n;
+        }
+    }
+    return 0;
+}
+#endif
+
 /**
  * reset a TCP connection 
  *   - It MUST be called in the same thread that performed the IO operation. 
@@ -12,10 +12,15 @@
 
 namespace fast {
 
-// double to ascii string
-inline int dtoa(double v, char* buf) {
-    return milo::dtoa(v, buf);
-}
+// double to ascii string, the shortest that converts back to the same double
+//   - 1.0 -> "1.0", 0.1 -> "0.1", 1e30 -> "1e30", 1.5e-7 -> "1.5e-7"
+//   - At most 25 bytes are written, including the ending '\0'.
+int dtoa(double v, char* buf);
+
+// ascii string to double, the string is a decimal number like "-1.25e-3"
+//   - The result is rounded correctly, and it doesn't depend on the locale.
+//   - Return false if the string is not a number or the value overflows.
+bool atod(const char* s, size_t n, double& v);
 
 // integer to hex string  (255 -> "0xff". eg.)
 int u32toh(uint32 v, char* buf);
@@ -226,13 +231,13 @@ class stream {
     }
 
     stream& operator<<(float v) {
-        this->ensure(24);
+        this->ensure(25);
         _size += fast::dtoa(v, _p + _size);
         return *this;
     }
 
     stream& operator<<(double v) {
-        this->ensure(24);
+        this->ensure(25);
         _size += fast::dtoa(v, _p + _size);
         return *this;
     }
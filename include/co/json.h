@@ -1,8 +1,11 @@
 #pragma once
 
 #include "fastream.h"
+#include "atomic.h"
+#include <string>
 #include <vector>
 #include <unordered_map>
+#include <type_traits>
 #ifdef _MSC_VER
 #pragma warning (disable:4200)
 #endif
@@ -10,6 +13,14 @@
 namespace json {
 namespace xx {
 
+// A buffer outside of the JBlock, which strings of the Json may point to, 
+// e.g. a file mapped by Json::parse_file(). It is shared by copies of the 
+// Json, and released by the last one.
+struct Extern {
+    int refn;
+    void (*release)(Extern*);
+};
+
 // JBlock is an array of uint64.
 // json::Json will be parsed or constructed as a JBlock.
 class JBlock {
@@ -20,9 +31,12 @@ class JBlock {
         _h = (_Header*) malloc(sizeof(_Header) + cap * N);
         _h->cap = (uint32)cap;
         _h->size = 0;
+        _h->ext = 0;
+        _h->borrow = 0;
     }
 
     ~JBlock() {
+        this->release_ext();
         free(_h);
     }
 
@@ -41,9 +55,24 @@ class JBlock {
         return _h->p + index;
     }
 
-    void clear() { _h->size = 0; }
+    void clear() { this->release_ext(); _h->borrow = 0; _h->size = 0; }
+
+    void safe_clear() { this->release_ext(); _h->borrow = 0; memset(_h->p, 0, _h->size * N); _h->size = 0; }
+
+    // strings point to a buffer the JBlock does not own
+    void set_borrow() { _h->borrow = 1; }
+    bool borrow() const { return _h->borrow != 0; }
+
+    // the JBlock takes the reference of x
+    void set_ext(Extern* x) { this->release_ext(); _h->ext = x; }
 
-    void safe_clear() { memset(_h->p, 0, _h->size * N); _h->size = 0; }
+    void release_ext() {
+        Extern* x = _h->ext;
+        if (x) {
+            _h->ext = 0;
+            if (atomic_dec(&x->refn) == 0) x->release(x);
+        }
+    }
 
     void reserve(uint32 n) {
         if (_h->cap < n) {
@@ -57,6 +86,8 @@ class JBlock {
         this->reserve(m._h->size);
         memcpy(_h + 1, m._h + 1, m._h->size * N);
         _h->size = m._h->size;
+        if (m._h->ext) atomic_inc(&m._h->ext->refn);
+        this->set_ext(m._h->ext);
     }
 
     size_t memory_size() const {
@@ -68,6 +99,8 @@ class JBlock {
     struct _Header {
         uint32 cap;
         uint32 size;
+        Extern* ext;
+        uint64 borrow;
         uint64 p[];
     };
     _Header* _h;
@@ -134,6 +167,7 @@ class JAlloc {
             jb->clear();
             _jb.push_back(p);
         } else {
+            jb->release_ext();
             free(p);
         }
     }
@@ -173,6 +207,30 @@ struct Queue {
 
 } // xx
 
+// flags for Json::parse_from(char* s, size_t n, int flags)
+enum {
+    kInSitu = 1, // parse in place, strings of the Json point to the input
+};
+
+// A string in Json with its length, as a string may contain '\0'. It points
+// into the Json, or into the buffer a Json was parsed from in place, and is 
+// valid as long as the one it points to.
+struct StrView {
+    StrView(const char* s, size_t n) : p(s), n(n) {}
+
+    const char* data() const { return p; }
+    size_t size()      const { return n; }
+    bool empty()       const { return n == 0; }
+
+    bool operator==(const StrView& x) const { return n == x.n && memcmp(p, x.p, n) == 0; }
+    bool operator==(const char* s)    const { return *this == StrView(s, strlen(s)); }
+    bool operator!=(const StrView& x) const { return !(*this == x); }
+    bool operator!=(const char* s)    const { return !(*this == s); }
+
+    const char* p;
+    size_t n;
+};
+
 class Json {
   public:
     enum Type {
@@ -186,6 +244,8 @@ class Json {
     };
 
     friend class Parser;
+    friend class StreamParser;
+    friend class MsgpackParser;
     struct TypeArray {};
     struct TypeObject {};
     typedef const char* Key;
@@ -212,6 +272,7 @@ class Json {
         uint64 get_uint64() const { return (uint64)this->get_int64(); }
         double get_double() const { return _root->_get_double(_index); }
         S get_string()      const { return _root->_get_string(_index); }
+        StrView get_string_view() const { return _root->_get_string_view(_index); }
 
         void operator=(bool x)   { return _root->_set_bool(x, _index); }
         void operator=(int64 x)  { return _root->_set_int(x, _index); }
@@ -278,6 +339,9 @@ class Json {
         fastring dbg(uint32 cap=256)    const { fastring s(cap); this->dbg(*(fastream*)&s); return s; }
         fastring pretty(uint32 cap=256) const { fastring s(cap); this->pretty(*(fastream*)&s); return s; }
 
+        fastream& msgpack(fastream& fs)  const { return _root->_Json2msgpack(fs, _index); }
+        fastring msgpack(uint32 cap=256) const { fastream fs(cap); this->msgpack(fs); return fs.str(); }
+
         class iterator {
           public:
             iterator(Json* root, uint32 q, uint32 type)
@@ -326,9 +390,10 @@ class Json {
     Json(Json&& r) noexcept : _mem(r._mem) { r._mem = 0; }
     ~Json() { if (_mem) xx::jalloc()->dealloc_jblock(_mem); }
 
-    Json(const Json& r) : _mem(xx::jalloc()->alloc_jblock()) { _jb.copy_from(r._jb); }
+    // A copy of a Json parsed with kInSitu owns its strings.
+    Json(const Json& r) : _mem(xx::jalloc()->alloc_jblock()) { this->_copy_from(r); }
     Json& operator=(const Json& r) {
-        if (&r != this) { _jb.clear(); _jb.copy_from(r._jb); }
+        if (&r != this) { _jb.clear(); this->_copy_from(r); }
         return *this;
     }
 
@@ -391,6 +456,7 @@ class Json {
     uint64 get_uint64() const { return (uint64)this->get_int64(); }
     double get_double() const { return this->_get_double(0); }
     S get_string()      const { return this->_get_string(0); }
+    StrView get_string_view() const { return this->_get_string_view(0); }
 
     void set_null()   { _jb.clear(); _make_null(); }
     void set_array()  { _jb.clear(); _make_array(); }
@@ -399,6 +465,7 @@ class Json {
     void clear() { _jb.clear(); _make_null(); }
     void safe_clear() { _jb.safe_clear(); _make_null(); }
 
+    // operator[](Key) adds the key with a null value if it is not found.
     typedef Value::iterator iterator;
     iterator begin()           const { return this->_begin(0); }
     const iterator::End& end() const { return iterator::end(); }
@@ -432,13 +499,70 @@ class Json {
     bool parse_from(const fastring& s)    { return this->parse_from(s.data(), s.size()); }
     bool parse_from(const std::string& s) { return this->parse_from(s.data(), s.size()); }
 
+    // Parse Json with flags.
+    //   - kInSitu: strings are decoded in @s and terminated by '\0' in place 
+    //     of the closing quote, and the Json points to them instead of copying. 
+    //     The Json does not own @s, which must not be changed or freed while 
+    //     the Json is alive. Copies of the Json own their strings, and the Json
+    //     stops pointing to @s when it is cleared or parsed again.
+    bool parse_from(char* s, size_t n, int flags);
+    bool parse_from(fastring& s, int flags) { return this->parse_from((char*)s.data(), s.size(), flags); }
+
+    // Parse Json from a file, which is mapped into memory and parsed in place.
+    //   - Strings of the Json point to the mapped pages instead of being 
+    //     copied, the mapping is released with the last copy of the Json, or
+    //     when the Json is cleared or parsed again.
+    //   - The mapping is private, and the file is never modified. Do not 
+    //     truncate the file while the Json is alive.
+    bool parse_file(const char* path);
+    bool parse_file(const fastring& path)    { return this->parse_file(path.c_str()); }
+    bool parse_file(const std::string& path) { return this->parse_file(path.c_str()); }
+
+    // MessagePack, a binary encoding of Json which is smaller than the json
+    // text, and faster to encode and decode, as strings are not escaped and
+    // numbers are not converted to or from text.
+    //   - msgpack() appends the encoded Json to the fastream. Integers use the
+    //     smallest format that holds the value, and doubles are float 64.
+    //   - parse_msgpack() decodes MessagePack, inverse to msgpack(). The bin
+    //     types are decoded as strings, float 32 as double, and keys must be 
+    //     strings. Extension types are not supported.
+    fastream& msgpack(fastream& fs)  const { return this->_Json2msgpack(fs, 0); }
+    fastring msgpack(uint32 cap=256) const { fastream fs(cap); this->msgpack(fs); return fs.str(); }
+
+    bool parse_msgpack(const char* s, size_t n);
+    bool parse_msgpack(const fastring& s) { return this->parse_msgpack(s.data(), s.size()); }
+
   private:
     fastream& _Json2str(fastream& fs, bool debug, uint32 index) const;
+    fastream& _Json2msgpack(fastream& fs, uint32 index) const;
+
+    void _copy_from(const Json& r) {
+        _jb.copy_from(r._jb);
+        if (r._jb.borrow()) this->_own_strings(0);
+    }
+
+    // copy strings pointing to a borrowed buffer into the JBlock
+    void _own_strings(uint32 index);
     fastream& _Json2pretty(fastream& fs, int indent, int n, uint32 index) const;
 
     Value _at(uint32 i, uint32 index) const;
     Value _at(Key key, uint32 index) const;
     bool _has_member(Key key, uint32 index) const;
+
+    // Members of an object are found by a linear scan. Once the object has 
+    // kHashThreshold members, a hash index is built in the JBlock, by the 
+    // parsers when the object is done, or by _add_member(), and it is updated 
+    // as members are added. A lookup never writes the JBlock.
+    //   - _find_member() returns index of the value, or 0 if not found.
+    //   - _index_object() is for parsers, @n is size of the object's queue.
+    enum { kHashThreshold = 16 };
+    uint32 _find_member(Key key, uint32 index) const;
+    void _build_hash_index(uint32 index);
+    void _index_object(uint32 index, uint32 n) {
+        if (n >= kHashThreshold * 2 && _is_object(index)) this->_build_hash_index(index);
+    }
+    void _hash_member(uint32 key, uint32 val, uint32 index);
+    void _hash_insert(void* t, uint32 key, uint32 val);
     uint32 _size(uint32 index) const;
     uint32 _array_size(uint32 index) const;
     uint32 _object_size(uint32 index) const;
@@ -487,6 +611,16 @@ class Json {
         return head;
     }
 
+    // a string parsed in place, x[n] is '\0'
+    uint32 _make_ext_string(const char* x, size_t n) {
+        const uint32 head = _alloc_header();
+        _Header* h = new (_p8(head)) _Header(kString);
+        h->ext = 1;
+        h->size = (uint32)n;
+        h->s = x;
+        return head;
+    }
+
     uint32 _make_key(const char* x, size_t n) {
         return _make_raw_string(x, n);
     }
@@ -523,7 +657,15 @@ class Json {
     bool _get_bool(uint32 i)     const { _Header* h = (_Header*)_p8(i); return (h->type == kBool) ? h->b : false; }
     int64 _get_int64(uint32 i)   const { _Header* h = (_Header*)_p8(i); return (h->type == kInt) ? h->i : 0; }
     double _get_double(uint32 i) const { _Header* h = (_Header*)_p8(i); return (h->type == kDouble) ? h->d : 0.0; }
-    S _get_string(uint32 i)      const { _Header* h = (_Header*)_p8(i); return (h->type == kString) ? (S)_p8(h->index) : ""; }
+    S _get_string(uint32 i)      const { _Header* h = (_Header*)_p8(i); return (h->type == kString) ? _body(h) : ""; }
+
+    StrView _get_string_view(uint32 i) const {
+        _Header* h = (_Header*)_p8(i);
+        return (h->type == kString) ? StrView(_body(h), h->size) : StrView("", 0);
+    }
+
+    // body of a string, in the JBlock, or in the buffer parsed in place
+    S _body(const void* p) const { const _Header* h = (const _Header*)p; return h->ext ? h->s : (S)_p8(h->index); }
 
     void _set_bool(bool x, uint32 i)     { (new (_p8(i)) _Header(kBool))->b = x; }
     void _set_int(int64 x, uint32 i)     { (new (_p8(i)) _Header(kInt))->i = x; }
@@ -593,14 +735,19 @@ class Json {
 
   private:
     struct _Header {
-        _Header(Type t) : type(t) {}
-        uint32 type;
-        uint32 size;      // for string
+        _Header(Type t) : type((uint16)t), ext(0), size(0) {}
+        uint16 type;
+        uint16 ext;       // for string, 1 if the body is outside of the JBlock
+        union {
+            uint32 size;  // for string
+            uint32 hash;  // for object, index of the hash index, 0 if not built
+        };
         union {
             bool b;       // for bool
             int64 i;      // for int
             double d;     // for double
             uint32 index; // for string, array, object
+            const char* s; // for string outside of the JBlock
         };
     }; // 16 bytes
 
@@ -617,6 +764,57 @@ typedef Json::Value Value;
 inline Json array()  { return Json(Json::TypeArray()); }
 inline Json object() { return Json(Json::TypeObject()); }
 
+// Incremental json parser, the document can be fed in chunks as they arrive,
+// e.g. from tcp::Connection::recv(), and the same Json as json::parse() is 
+// built, without a contiguous buffer for the whole document. It accepts what 
+// json::parse() accepts, a trailing comma in an array or object included.
+//   - feed() returns 1 if the document is complete, 0 if more data is needed, 
+//     or -1 on any error. White spaces may follow the document, anything else 
+//     is an error, as json::parse() does. Keep feeding the rest of the data 
+//     after 1 is returned, to find anything but white spaces after it.
+//   - finish() tells the parser that no more data will come, and returns true 
+//     if the document is complete. It is needed when the document is a single 
+//     number, as "12" may be followed by "3".
+//   - result() is the Json parsed, it can be moved away. Call reset() before 
+//     parsing another document.
+//
+//   json::StreamParser p;
+//   while ((n = conn.recv(buf, sizeof(buf))) > 0 && p.feed(buf, n) == 0);
+//   if (p.finish()) Json v = std::move(p.result());
+class StreamParser {
+  public:
+    StreamParser() { this->reset(); }
+    ~StreamParser() = default;
+
+    StreamParser(const StreamParser&) = delete;
+    void operator=(const StreamParser&) = delete;
+
+    int feed(const char* s, size_t n);
+    bool finish();
+    void reset();
+
+    Json& result() { return _root; }
+
+  private:
+    const char* _start_token(uint32 type, const char* b, const char* e);
+    const char* _continue_token(const char* b, const char* e);
+    bool _on_token(const char* b, const char* e, uint32 type);
+    void _on_value(uint32 val);
+    void _open(bool object);
+    void _close();
+
+  private:
+    Json _root;
+    xx::Stack _s;
+    fastream _tok;    // a token splitted by chunks
+    uint32 _state;    // '{' or '[' for the current container, 0 for the top level
+    uint32 _size;
+    uint32 _expect;
+    uint32 _tok_type; // type of the token in _tok, 0 for none
+    bool _esc;        // the last chunk ended with a backslash in a string
+    bool _err;
+};
+
 inline Json parse(const char* s, size_t n) {
     void* p = 0;
     Json& r = *(Json*) &p;
@@ -629,9 +827,415 @@ inline Json parse(const char* s)        { return parse(s, strlen(s)); }
 inline Json parse(const fastring& s)    { return parse(s.data(), s.size()); }
 inline Json parse(const std::string& s) { return parse(s.data(), s.size()); }
 
+// parse a json file in place, a null Json is returned on any error
+inline Json parse_file(const char* path) {
+    void* p = 0;
+    Json& r = *(Json*) &p;
+    if (r.parse_file(path)) return std::move(r);
+    r.set_null();
+    return std::move(r);
+}
+
+inline Json parse_file(const fastring& path)    { return parse_file(path.c_str()); }
+inline Json parse_file(const std::string& path) { return parse_file(path.c_str()); }
+
+// parse with flags, see Json::parse_from(char* s, size_t n, int flags)
+inline Json parse(char* s, size_t n, int flags) {
+    void* p = 0;
+    Json& r = *(Json*) &p;
+    if (r.parse_from(s, n, flags)) return std::move(r);
+    r.set_null();
+    return std::move(r);
+}
+
+// decode MessagePack, a null Json is returned on any error
+inline Json parse_msgpack(const char* s, size_t n) {
+    void* p = 0;
+    Json& r = *(Json*) &p;
+    if (r.parse_msgpack(s, n)) return std::move(r);
+    r.set_null();
+    return std::move(r);
+}
+
+inline Json parse_msgpack(const fastring& s) { return parse_msgpack(s.data(), s.size()); }
+
+// SAX style handler for json::parse(s, n, handler), the document is parsed 
+// without building a Json. The same input as json::parse() is accepted, a 
+// trailing comma in an array or object included.
+//   - Each callback returns kGoOn to go on parsing, or kStop to stop it.
+//   - start_object(), start_array() and key() may return kSkip to skip the 
+//     object, the array, or the value of the key, nothing in it is reported, 
+//     and end_object() or end_array() is not called for a skipped one.
+//   - Strings and keys are not null-terminated. They may point to a buffer 
+//     reused by the parser, and are valid only during the call. Escapes in
+//     keys are not decoded, as json::parse() does.
+class Handler {
+  public:
+    enum { kGoOn = 0, kSkip = 1, kStop = 2 };
+
+    Handler() = default;
+    virtual ~Handler() = default;
+
+    virtual int start_object() { return kGoOn; }
+    virtual int end_object()   { return kGoOn; }
+    virtual int start_array()  { return kGoOn; }
+    virtual int end_array()    { return kGoOn; }
+    virtual int key(const char* s, size_t n) { return kGoOn; }
+
+    virtual int null_value()           { return kGoOn; }
+    virtual int bool_value(bool v)     { return kGoOn; }
+    virtual int int_value(int64 v)     { return kGoOn; }
+    virtual int double_value(double v) { return kGoOn; }
+    virtual int string_value(const char* s, size_t n) { return kGoOn; }
+};
+
+// parse json and report it to the handler, return false on any error.
+//   - Stopped by the handler is not an error, true is returned then.
+//   - A skipped object or array is only checked for balanced brackets and 
+//     quotes, not for syntax of the content.
+bool parse(const char* s, size_t n, Handler& h);
+inline bool parse(const fastring& s, Handler& h) { return parse(s.data(), s.size(), h); }
+
+// On-demand json document, as simdjson's on-demand API. parse_from() only 
+// indexes positions of brackets out of strings, 64 bytes at a time, and
+// strings and numbers are not scanned until they are read. It is much faster
+// than Json when a few fields are needed from a large document.
+//   - The text is referenced, not copied, it must not be changed or freed 
+//     while the document is in use.
+//   - parse_from() checks only quotes and brackets, other errors are found 
+//     when values are read, a malformed value is read as null.
+//   - A Value is a position in the document, operator[] on it scans the 
+//     members or elements, nested objects and arrays are skipped at once.
+//   - Values not found are null. get_xxx() returns 0, false or an empty 
+//     string if the type does not match, as Json does.
+//   - Escapes in strings are decoded by get_string() each time it is called.
+//
+//   json::Lazy doc;
+//   if (doc.parse_from(s, n)) int x = doc["a"]["b"].get_int();
+class Lazy {
+  public:
+    typedef const char* Key;
+
+    class Value {
+      public:
+        ~Value() = default;
+
+        bool is_null()   const { return _doc->_type(_pos) == 'n'; }
+        bool is_bool()   const { return _doc->_type(_pos) == 't'; }
+        bool is_int()    const { return _doc->_type(_pos) == 'i'; }
+        bool is_double() const { return _doc->_type(_pos) == 'd'; }
+        bool is_string() const { return _doc->_type(_pos) == '"'; }
+        bool is_array()  const { return _doc->_type(_pos) == '['; }
+        bool is_object() const { return _doc->_type(_pos) == '{'; }
+
+        bool get_bool()     const { return _doc->_get_bool(_pos); }
+        int64 get_int64()   const { return _doc->_get_int64(_pos); }
+        int get_int()       const { return (int)   this->get_int64(); }
+        int32 get_int32()   const { return (int32) this->get_int64(); }
+        uint32 get_uint32() const { return (uint32)this->get_int64(); }
+        uint64 get_uint64() const { return (uint64)this->get_int64(); }
+        double get_double() const { return _doc->_get_double(_pos); }
+        fastring get_string() const { return _doc->_get_string(_pos); }
+
+        Value operator[](uint32 i) const { return _doc->_at(i, _pos, _k); }
+        Value operator[](int i)    const { return this->operator[]((uint32)i); }
+        Value operator[](Key key)  const { return _doc->_at(key, _pos, _k); }
+        bool has_member(Key key)   const { return _doc->_at(key, _pos, _k)._pos != kNone; }
+        uint32 size()              const { return _doc->_size(_pos, _k); }
+
+        // text of the value in the document
+        fastring str() const { return _doc->_str(_pos, _k); }
+
+      private:
+        friend class Lazy;
+        Value(const Lazy* doc, uint32 pos, uint32 k) : _doc(doc), _pos(pos), _k(k) {}
+
+        const Lazy* _doc;
+        uint32 _pos; // position of the value in the text
+        uint32 _k;   // index of the first bracket at or after _pos
+    };
+
+    Lazy() : _s(0), _n(0), _root(kNone) {}
+    ~Lazy() = default;
+
+    // parse json text, return false on any error
+    bool parse_from(const char* s, size_t n);
+    bool parse_from(const fastring& s) { return this->parse_from(s.data(), s.size()); }
+
+    Value root() const { return Value(this, _root, 0); }
+
+    Value operator[](uint32 i) const { return this->root()[i]; }
+    Value operator[](int i)    const { return this->root()[i]; }
+    Value operator[](Key key)  const { return this->root()[key]; }
+    bool has_member(Key key)   const { return this->root().has_member(key); }
+    uint32 size()              const { return this->root().size(); }
+
+  private:
+    static const uint32 kNone = (uint32)-1;
+
+    // pos:   position of a bracket in the text
+    // match: index of the matching bracket
+    struct Bracket {
+        uint32 pos;
+        uint32 match;
+    };
+
+    char _type(uint32 pos) const;
+    bool _get_bool(uint32 pos) const;
+    int64 _get_int64(uint32 pos) const;
+    double _get_double(uint32 pos) const;
+    fastring _get_string(uint32 pos) const;
+    Value _at(uint32 i, uint32 pos, uint32 k) const;
+    Value _at(Key key, uint32 pos, uint32 k) const;
+    uint32 _size(uint32 pos, uint32 k) const;
+    fastring _str(uint32 pos, uint32 k) const;
+    const char* _skip(const char* p, uint32& k) const;
+
+  private:
+    const char* _s;
+    uint32 _n;
+    uint32 _root;
+    std::vector<Bracket> _idx;
+};
+
+// Reader of json text for structs bound by CO_JSON_FIELDS, values are read 
+// in place without building a Json.
+class Reader {
+  public:
+    Reader(const char* s, size_t n) : _b(s), _e(s + n), _first(false) {}
+    ~Reader() = default;
+
+    // read a value of the type, return false on any error
+    bool read(bool& v);
+    bool read(int64& v);
+    bool read(double& v);
+    bool read(fastring& v);
+    bool read(std::string& v);
+
+    // read null if the next value is null
+    bool null();
+
+    // skip the next value
+    bool skip();
+
+    // begin an object or array, return false if it is not the next value
+    bool begin_object() { return this->_begin('{'); }
+    bool begin_array()  { return this->_begin('['); }
+
+    // next key of the object, return 1 with the key, 0 at the end of the 
+    // object, or -1 on any error
+    int next_key(const char*& key, size_t& n);
+
+    // return 1 if an element follows, 0 at the end of the array, or -1 on
+    // any error
+    int next_element();
+
+    // return true if only white spaces are left
+    bool end();
+
+  private:
+    bool _begin(char c);
+
+  private:
+    const char* _b;
+    const char* _e;
+    bool _first; // at the first member or element
+};
+
+namespace xx {
+
+// write a json string with escapes
+void write_string(fastream& fs, const char* s, size_t n);
+
+inline void write(fastream& fs, bool v)               { fs << (v ? "true" : "false"); }
+inline void write(fastream& fs, double v)             { fs << v; }
+inline void write(fastream& fs, float v)              { fs << (double)v; }
+inline void write(fastream& fs, const fastring& v)    { write_string(fs, v.data(), v.size()); }
+inline void write(fastream& fs, const std::string& v) { write_string(fs, v.data(), v.size()); }
+
+// integers are widened, so that char and uint8 are written as numbers
+template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+inline void write(fastream& fs, T v) { fs << (int64)v; }
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+inline void write(fastream& fs, T v) { fs << (uint64)v; }
+
+template<typename T, typename std::enable_if<std::is_class<T>::value, int>::type = 0>
+inline void write(fastream& fs, const T& v) { co_json_write(fs, v); }
+
+template<typename T>
+inline void write(fastream& fs, const std::vector<T>& v) {
+    fs << '[';
+    for (size_t i = 0; i < v.size(); ++i) {
+        write(fs, v[i]);
+        fs << ',';
+    }
+    if (fs.back() == ',') fs.back() = ']';
+    else fs << ']';
+}
+
+inline bool read(Reader& r, bool& v)        { return r.read(v); }
+inline bool read(Reader& r, fastring& v)    { return r.read(v); }
+inline bool read(Reader& r, std::string& v) { return r.read(v); }
+
+inline bool read(Reader& r, double& v) { return r.read(v); }
+inline bool read(Reader& r, float& v)  { double d; if (!r.read(d)) return false; v = (float)d; return true; }
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+inline bool read(Reader& r, T& v) {
+    int64 x;
+    if (!r.read(x)) return false;
+    v = (T)x;
+    return true;
+}
+
+template<typename T, typename std::enable_if<std::is_class<T>::value, int>::type = 0>
+inline bool read(Reader& r, T& v) {
+    if (!r.begin_object()) return false;
+    const char* key;
+    size_t n;
+    int x;
+    while ((x = r.next_key(key, n)) > 0) {
+        if (!co_json_read_field(r, v, key, n)) return false;
+    }
+    return x == 0;
+}
+
+// elements are read in place, memory of them is reused
+template<typename T>
+inline bool read(Reader& r, std::vector<T>& v) {
+    if (!r.begin_array()) return false;
+    size_t n = 0;
+    int x;
+    while ((x = r.next_element()) > 0) {
+        if (n == v.size()) v.resize(n + 1);
+        if (!read(r, v[n++])) return false;
+    }
+    v.resize(n);
+    return x == 0;
+}
+
+// elements of std::vector<bool> are bits, they can't be read in place
+inline bool read(Reader& r, std::vector<bool>& v) {
+    if (!r.begin_array()) return false;
+    size_t n = 0;
+    int x;
+    bool b;
+    while ((x = r.next_element()) > 0) {
+        if (!r.read(b)) return false;
+        if (n == v.size()) v.push_back(b);
+        else v[n] = b;
+        ++n;
+    }
+    v.resize(n);
+    return x == 0;
+}
+
+} // xx
+
+// Serialize a struct bound by CO_JSON_FIELDS, or a vector of them, to json.
+template<typename T>
+inline fastream& to_str(fastream& fs, const T& v) {
+    xx::write(fs, v);
+    return fs;
+}
+
+template<typename T>
+inline fastring to_str(const T& v) {
+    fastream fs(256);
+    xx::write(fs, v);
+    return fastring(fs.data(), fs.size());
+}
+
+// Parse json into a struct bound by CO_JSON_FIELDS, or a vector of them.
+//   - Members not in the struct are skipped, fields not in the json are 
+//     left unchanged, so are fields with a null value.
+//   - A trailing comma in an array or object is allowed, as json::parse() does.
+//   - Return false on any error, and the struct may be partially filled.
+template<typename T>
+inline bool from_str(const char* s, size_t n, T& v) {
+    Reader r(s, n);
+    return xx::read(r, v) && r.end();
+}
+
+template<typename T>
+inline bool from_str(const fastring& s, T& v) {
+    return from_str(s.data(), s.size(), v);
+}
+
 } // json
 
 typedef json::Json Json;
 
 inline fastream& operator<<(fastream& fs, const json::Json& x)  { return x.dbg(fs); }
 inline fastream& operator<<(fastream& fs, const json::Value& x) { return x.dbg(fs); }
+
+// Bind public fields of a struct to json, the code to write and read the 
+// fields is generated at compile time, without a Json in between. Use it in
+// the namespace of the struct, after the struct is defined.
+// Fields may be bool, integers, float, double, fastring, std::string, 
+// structs bound by CO_JSON_FIELDS, or std::vector of them, up to 32 fields.
+// Integers are written as numbers, char and uint8 included.
+//
+//   struct User { int id; fastring name; std::vector<fastring> tags; };
+//   CO_JSON_FIELDS(User, id, name, tags)
+//
+//   fastring s = json::to_str(user);
+//   bool ok = json::from_str(s, user);
+#define CO_JSON_FIELDS(S, ...) \
+    inline void co_json_write(fastream& fs, const S& x) { \
+        fs << '{'; \
+        _CO_JSON_FOR_EACH(_CO_JSON_WRITE_FIELD, __VA_ARGS__) \
+        fs.back() = '}'; \
+    } \
+    inline bool co_json_read_field(json::Reader& r, S& x, const char* key, size_t n) { \
+        _CO_JSON_FOR_EACH(_CO_JSON_READ_FIELD, __VA_ARGS__) \
+        return r.skip(); \
+    }
+
+#define _CO_JSON_WRITE_FIELD(f) \
+    fs.append("\"" #f "\":", sizeof(#f) + 2); \
+    json::xx::write(fs, x.f); \
+    fs << ',';
+
+#define _CO_JSON_READ_FIELD(f) \
+    if (n == sizeof(#f) - 1 && memcmp(key, #f, n) == 0) return r.null() || json::xx::read(r, x.f);
+
+#define _CO_JSON_EXPAND(x) x
+#define _CO_JSON_CAT_(a, b) a##b
+#define _CO_JSON_CAT(a, b) _CO_JSON_CAT_(a, b)
+#define _CO_JSON_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, n, ...) n
+#define _CO_JSON_NARGS(...) _CO_JSON_EXPAND(_CO_JSON_NARGS_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define _CO_JSON_FOR_EACH(m, ...) _CO_JSON_EXPAND(_CO_JSON_CAT(_CO_JSON_FE_, _CO_JSON_NARGS(__VA_ARGS__))(m, __VA_ARGS__))
+#define _CO_JSON_FE_1(m, x) m(x)
+#define _CO_JSON_FE_2(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_1(m, __VA_ARGS__))
+#define _CO_JSON_FE_3(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_2(m, __VA_ARGS__))
+#define _CO_JSON_FE_4(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_3(m, __VA_ARGS__))
+#define _CO_JSON_FE_5(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_4(m, __VA_ARGS__))
+#define _CO_JSON_FE_6(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_5(m, __VA_ARGS__))
+#define _CO_JSON_FE_7(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_6(m, __VA_ARGS__))
+#define _CO_JSON_FE_8(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_7(m, __VA_ARGS__))
+#define _CO_JSON_FE_9(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_8(m, __VA_ARGS__))
+#define _CO_JSON_FE_10(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_9(m, __VA_ARGS__))
+#define _CO_JSON_FE_11(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_10(m, __VA_ARGS__))
+#define _CO_JSON_FE_12(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_11(m, __VA_ARGS__))
+#define _CO_JSON_FE_13(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_12(m, __VA_ARGS__))
+#define _CO_JSON_FE_14(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_13(m, __VA_ARGS__))
+#define _CO_JSON_FE_15(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_14(m, __VA_ARGS__))
+#define _CO_JSON_FE_16(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_15(m, __VA_ARGS__))
+#define _CO_JSON_FE_17(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_16(m, __VA_ARGS__))
+#define _CO_JSON_FE_18(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_17(m, __VA_ARGS__))
+#define _CO_JSON_FE_19(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_18(m, __VA_ARGS__))
+#define _CO_JSON_FE_20(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_19(m, __VA_ARGS__))
+#define _CO_JSON_FE_21(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_20(m, __VA_ARGS__))
+#define _CO_JSON_FE_22(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_21(m, __VA_ARGS__))
+#define _CO_JSON_FE_23(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_22(m, __VA_ARGS__))
+#define _CO_JSON_FE_24(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_23(m, __VA_ARGS__))
+#define _CO_JSON_FE_25(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_24(m, __VA_ARGS__))
+#define _CO_JSON_FE_26(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_25(m, __VA_ARGS__))
+#define _CO_JSON_FE_27(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_26(m, __VA_ARGS__))
+#define _CO_JSON_FE_28(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_27(m, __VA_ARGS__))
+#define _CO_JSON_FE_29(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_28(m, __VA_ARGS__))
+#define _CO_JSON_FE_30(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_29(m, __VA_ARGS__))
+#define _CO_JSON_FE_31(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_30(m, __VA_ARGS__))
+#define _CO_JSON_FE_32(m, x, ...) m(x) _CO_JSON_EXPAND(_CO_JSON_FE_31(m, __VA_ARGS__))
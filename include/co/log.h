@@ -11,6 +11,7 @@
 
 DEC_bool(cout);
 DEC_int32(min_log_level);
+DEC_bool(log_co_id);
 
 namespace ___ {
 namespace log {
@@ -29,13 +30,235 @@ void init();
  */
 void close();
 
+/**
+ * get number of logs dropped as the log buffer was full 
+ *   - The policy for a full log buffer is set by the flag log_overflow. 
+ *   - A warning with the number of dropped logs is also written to the log file. 
+ */
+uint64 dropped_logs();
+
+/**
+ * get number of bytes of the logs dropped as the log buffer was full
+ */
+uint64 dropped_bytes();
+
+/**
+ * statistics of writes to the log file by the logging thread 
+ *   - A write is a batch of logs, the time includes fsync if it is done. 
+ */
+struct WriteStats {
+    uint64 writes;   // number of writes
+    uint64 bytes;    // bytes written
+    uint64 total_us; // total time of writes in microseconds
+    uint64 max_us;   // max time of a single write in microseconds
+};
+
+WriteStats write_stats();
+
+/**
+ * decode binary logs to text 
+ *   - Binary logs (LOG_BIN) are written to xx.bin as they are, if log_bin_file 
+ *     is true. The text is the same as they would be in the log file. 
+ *   - Arguments are saved in native byte order, decode the file on a machine 
+ *     of the same kind. 
+ *
+ * @param s    content of a binary log file.
+ * @param n    size of s.
+ * @param out  the text is appended to it.
+ *
+ * @return     false if s is not a binary log file, or it is broken, logs before 
+ *             the broken part are still decoded.
+ */
+bool decode_bin_logs(const char* s, size_t n, fastream& out);
+
+/**
+ * destination of logs 
+ *   - Logs are written to the log file, and then to all sinks added by 
+ *     log::add_sink(), by the logging thread. 
+ *   - write() is called with the same batch of formatted logs for all sinks, 
+ *     each log starts with the level char (DIWEF) followed by the time, and ends 
+ *     with a '\n'. A log may have more than one line. 
+ *   - The batch is only valid in write(), a sink must not keep the pointer. 
+ *   - Methods of a sink are called only by the logging thread. 
+ */
+class Sink {
+  public:
+    Sink() = default;
+    virtual ~Sink() = default;
+
+    virtual void write(const char* s, size_t n) = 0;
+
+    // called when the logging thread stops, or on fatal errors
+    virtual void flush() {}
+};
+
+/**
+ * add a sink to the log library 
+ *   - The log library takes the ownership of the sink, and deletes it on exit. 
+ *   - It is safe to call this function at any time, in any thread. 
+ */
+void add_sink(Sink* s);
+
+/**
+ * create a sink that writes logs at or above a level to a file 
+ *   - The file is rotated like the log file, by max_log_file_size, and the 
+ *     rotated files are named xx_n.log, or xx_n.log.gz if log_compress is true. 
+ *   - The flag log_level_files creates these sinks for the log file, e.g. 
+ *     logs/xx.warning.log. 
+ *
+ * @param path   path of the file, ".log" is appended if it does not end with it.
+ * @param level  0-4 for debug, info, warning, error, fatal.
+ */
+Sink* new_file_sink(const char* path, int level=0);
+
+/**
+ * create a sink that sends logs to a syslog server by UDP 
+ *   - Each log is sent in a datagram in the format of RFC 5424, with the 
+ *     facility user, and the severity mapped from the log level. 
+ *   - Datagrams are dropped if the network is busy, as UDP does. 
+ *   - The flag log_syslog creates this sink, e.g. -log_syslog=127.0.0.1:514. 
+ *
+ * @param ip     ipv4 address of the server.
+ * @param port   port of the server, 514 by default.
+ * @param level  send logs at or above this level.
+ */
+Sink* new_udp_sink(const char* ip, int port=514, int level=0);
+
+/**
+ * an in-memory ring that keeps the latest logs, e.g. for crash dumps 
+ *   - Logs are kept in a ring buffer of @cap bytes, older logs are overwritten. 
+ *   - On fatal errors, logs in the ring are written to the .fatal file before 
+ *     the stack trace, if dump_on_fatal is true. 
+ */
+class MemorySink : public Sink {
+  public:
+    explicit MemorySink(size_t cap=(1 << 20), bool dump_on_fatal=true);
+    virtual ~MemorySink();
+
+    virtual void write(const char* s, size_t n);
+
+    // get the logs in the ring, the oldest one may be incomplete
+    fastring dump() const;
+
+    // call f(const char* s, size_t n) for the logs in the ring without any 
+    // allocation, for fatal errors. Return false if the ring is in use.
+    template<typename F>
+    bool dump(F&& f) const {
+        if (!_mtx.try_lock()) return false;
+        if (_full) f(_buf + _pos, _cap - _pos);
+        f(_buf, _pos);
+        _mtx.unlock();
+        return true;
+    }
+
+    bool dump_on_fatal() const { return _dump_on_fatal; }
+
+  private:
+    mutable Mutex _mtx;
+    char* _buf;
+    size_t _cap;
+    size_t _pos;   // next position to write
+    bool _full;    // the ring has wrapped around
+    bool _dump_on_fatal;
+};
+
+/**
+ * set a key/value pair in the log context 
+ *   - The log context is local to the coroutine, or the thread if it is not 
+ *     called in a coroutine. Key/value pairs in it are appended to every log 
+ *     written by the coroutine, like "... hello {req=7, peer=127.0.0.1:80}". 
+ *   - The context is formatted when it is changed, not in every log. 
+ *   - The context of a coroutine is cleared when the coroutine ends. 
+ */
+void set_context(const char* key, const char* value, size_t n);
+
+inline void set_context(const char* key, const char* value) {
+    set_context(key, value, strlen(value));
+}
+
+inline void set_context(const char* key, const fastring& value) {
+    set_context(key, value.data(), value.size());
+}
+
+template<typename V>
+inline void set_context(const char* key, const V& value) {
+    fastream s(32);
+    s << value;
+    set_context(key, s.data(), s.size());
+}
+
+/**
+ * remove a key from the log context
+ */
+void del_context(const char* key);
+
+/**
+ * remove all key/value pairs from the log context
+ */
+void clear_context();
+
+/**
+ * set log level for source files matching a glob pattern at runtime 
+ *   - '*' matches any characters and '?' matches a single character. A pattern 
+ *     matches a file if it matches __FILE__ or any part of it after a '/', 
+ *     e.g. "tcp.cc", "so/tcp*", "*json*".
+ *   - DLOG, LOG, WLOG and ELOG in matched files are written if their level is 
+ *     at or above @level, instead of min_log_level. 
+ *   - If more than one pattern matches a file, the last one set wins. 
+ *   - Patterns can also be set by the flag log_levels before log::init(). 
+ *
+ * @param pattern  a glob pattern.
+ * @param level    0-4 for debug, info, warning, error, fatal, or -1 to remove 
+ *                 the pattern.
+ */
+void set_log_level(const char* pattern, int level);
+
+/**
+ * set min_log_level at runtime 
+ *   - Levels are cached at each call site, assigning FLG_min_log_level directly 
+ *     after logs were written may not take effect, call this function instead. 
+ */
+void set_min_log_level(int level);
+
 namespace xx {
 
 void push_fatal_log(fastream* fs);
 void push_level_log(char* s, size_t n);
+void push_bin_log(char* s, size_t n);
+
+// extra fields in logs, kCoId if log_co_id is true, kContext once a log 
+// context was set in any thread.
+enum { kCoId = 1, kContext = 2 };
+extern uint32 gLogExtra;
+
+// append " S<scheduler id>.C<coroutine id>" if in a coroutine
+void append_co_id(fastream& fs);
+
+// the formatted log context of the current coroutine or thread, NULL if empty
+const fastream* current_log_context();
+
+struct LogContext;
+void clear_log_context(LogContext* c);
+void delete_log_context(LogContext* c);
 
 extern __thread fastream* xxLog;
 
+// call site of DLOG, LOG, WLOG or ELOG, the min log level for its source file 
+// is evaluated and cached on the first call, and updated by set_log_level().
+struct LogSite {
+    int32 level; // -1 if not evaluated yet
+    const char* file;
+    LogSite* next;
+};
+
+bool init_log_site(LogSite* s, int level, const char* file);
+
+// a single branch for disabled logs once the site was evaluated
+inline bool log_on(LogSite& s, int level, const char* file) {
+    const int32 x = *(volatile int32*)&s.level;
+    return x <= level && (x >= 0 || init_log_site(&s, level, file));
+}
+
 enum LogLevel {
     debug = 0,
     info = 1,
@@ -67,6 +290,40 @@ struct log_time_t {
     }
 };
 
+/**
+ * bookkeeping of a rate-limited call site, lock-free 
+ *   - log_every_ms() allows a log every @ms milliseconds. 
+ *   - log_rate() is a token bucket, it allows @n logs per second on average, 
+ *     in bursts of up to @n logs. 
+ *   - Both return 0 if the log is suppressed, or 1 + the number of logs 
+ *     suppressed since the last one written. 
+ *   - A site with suppressed logs is linked to the logging thread, which 
+ *     writes "suppressed N logs" for it about once a second, if no later log 
+ *     from the site reported them. 
+ */
+struct LogLimiter {
+    int64 t;           // time (us) after which the next log is allowed
+    uint32 suppressed; // logs suppressed since the last one written
+    int32 level;
+    const char* file;
+    uint32 line;
+    uint32 linked;
+    LogLimiter* next;
+};
+
+uint32 log_every_ms(LogLimiter* l, int64 ms);
+uint32 log_rate(LogLimiter* l, uint32 n);
+
+// "[suppressed N] " at the beginning of a rate-limited log
+struct LogSuppressed {
+    uint32 n;
+};
+
+inline fastream& operator<<(fastream& fs, const LogSuppressed& x) {
+    if (x.n > 0) fs << "[suppressed " << x.n << "] ";
+    return fs;
+}
+
 class LevelLogSaver {
   public:
     LevelLogSaver(const char* file, unsigned line, int level) {
@@ -74,10 +331,16 @@ class LevelLogSaver {
         _n = xxLog->size();
         xxLog->resize(log_time_t::total_size + 1 + _n); // make room for time
         (*xxLog)[_n] = "DIWEF"[level];
-        (*xxLog) << ' ' << current_thread_id() << ' ' << file << ':' << line << ']' << ' ';
+        (*xxLog) << ' ' << current_thread_id();
+        if (unlikely(gLogExtra & kCoId)) append_co_id(*xxLog);
+        (*xxLog) << ' ' << file << ':' << line << ']' << ' ';
     }
 
     ~LevelLogSaver() {
+        if (unlikely(gLogExtra & kContext)) {
+            const fastream* c = current_log_context();
+            if (c) xxLog->append(c->data(), c->size());
+        }
         (*xxLog) << '\n';
         push_level_log((char*)xxLog->data() + _n, xxLog->size() - _n);
         xxLog->resize(_n);
@@ -91,13 +354,147 @@ class LevelLogSaver {
     size_t _n;
 };
 
+/**
+ * binary log 
+ *   - A call site is identified by the address of its static BinLogSite, the 
+ *     file, line and level are not copied into the log. 
+ *   - Arguments are written in binary straight into the ring of the thread, 
+ *     with a type tag, and formatted by the logging thread, or written to 
+ *     xx.bin as they are and decoded offline, see decode_bin_logs(): 
+ *       b|c  bool or char, 1 byte 
+ *       i|u  int32 or uint32, 4 bytes 
+ *       I|U  int64 or uint64, 8 bytes 
+ *       d    double, 8 bytes 
+ *       p    pointer, 8 bytes 
+ *       s    string, 4-byte length followed by the bytes 
+ *   - Other types are formatted with fastream at once, and saved as a string. 
+ *   - A log is truncated at max_log_size. 
+ *   - If the ring is not available, or a binary log is written while another 
+ *     one is in progress in the thread, e.g. by a function in its arguments, 
+ *     the log is encoded in xxLog and formatted at once. 
+ */
+struct BinLogSite {
+    const char* file;
+    uint32 line;
+    int32 level;
+};
+
+// begin a binary log in the ring of the current thread, return where its 
+// arguments are written, up to *e. Or return NULL if the log is encoded in 
+// xxLog from position *n.
+char* begin_bin_log(const BinLogSite* site, char** e, size_t* n);
+
+// end the binary log in the ring, p is the end of its arguments
+void end_bin_log(char* p);
+
+class BinLogSaver {
+  public:
+    explicit BinLogSaver(const BinLogSite* site) {
+        _p = begin_bin_log(site, &_e, &_n);
+    }
+
+    ~BinLogSaver() {
+        if (unlikely(gLogExtra & kContext)) {
+            const fastream* c = current_log_context();
+            if (c) this->put(c->data(), c->size());
+        }
+        if (_p != 0) {
+            end_bin_log(_p);
+        } else {
+            push_bin_log((char*)xxLog->data() + _n, xxLog->size() - _n);
+            xxLog->resize(_n);
+        }
+    }
+
+    BinLogSaver& fs() { return *this; }
+
+    BinLogSaver& operator<<(bool v)               { return this->put('b', (char)v); }
+    BinLogSaver& operator<<(char v)               { return this->put('c', v); }
+    BinLogSaver& operator<<(unsigned char v)      { return this->put('c', (char)v); }
+    BinLogSaver& operator<<(short v)              { return this->put('i', (int32)v); }
+    BinLogSaver& operator<<(unsigned short v)     { return this->put('u', (uint32)v); }
+    BinLogSaver& operator<<(int v)                { return this->put('i', (int32)v); }
+    BinLogSaver& operator<<(unsigned int v)       { return this->put('u', (uint32)v); }
+    BinLogSaver& operator<<(long v)               { return this->put('I', (int64)v); }
+    BinLogSaver& operator<<(unsigned long v)      { return this->put('U', (uint64)v); }
+    BinLogSaver& operator<<(long long v)          { return this->put('I', (int64)v); }
+    BinLogSaver& operator<<(unsigned long long v) { return this->put('U', (uint64)v); }
+    BinLogSaver& operator<<(float v)              { return this->put('d', (double)v); }
+    BinLogSaver& operator<<(double v)             { return this->put('d', v); }
+    BinLogSaver& operator<<(const void* v)        { return this->put('p', (uint64)v); }
+    BinLogSaver& operator<<(const char* v)        { return this->put(v, strlen(v)); }
+    BinLogSaver& operator<<(const fastring& v)    { return this->put(v.data(), v.size()); }
+    BinLogSaver& operator<<(const std::string& v) { return this->put(v.data(), v.size()); }
+    BinLogSaver& operator<<(const fastream& v)    { return this->put(v.data(), v.size()); }
+
+    template<typename T>
+    BinLogSaver& operator<<(const T& v) {
+        if (unlikely(xxLog == 0)) xxLog = new fastream(128);
+        if (_p != 0) {
+            const size_t n = xxLog->size();
+            (*xxLog) << v;
+            this->put(xxLog->data() + n, xxLog->size() - n);
+            xxLog->resize(n);
+        } else {
+            xxLog->append('s');
+            const size_t n = xxLog->size();
+            xxLog->append((uint32)0);
+            (*xxLog) << v;
+            const uint32 len = (uint32)(xxLog->size() - n - 4);
+            memcpy((char*)xxLog->data() + n, &len, 4);
+        }
+        return *this;
+    }
+
+  private:
+    template<typename T>
+    BinLogSaver& put(char c, T v) {
+        if (_p != 0) {
+            if (_e - _p > (ptrdiff_t)sizeof(T)) {
+                *_p = c;
+                memcpy(_p + 1, &v, sizeof(T));
+                _p += sizeof(T) + 1;
+            }
+        } else {
+            xxLog->append(c);
+            xxLog->append(&v, sizeof(T));
+        }
+        return *this;
+    }
+
+    // a string is cut if there is no enough space for it
+    BinLogSaver& put(const char* s, size_t n) {
+        if (_p != 0) {
+            if (_e - _p >= 5) {
+                const uint32 m = (uint32)((size_t)(_e - _p - 5) < n ? (size_t)(_e - _p - 5) : n);
+                *_p = 's';
+                memcpy(_p + 1, &m, 4);
+                memcpy(_p + 5, s, m);
+                _p += m + 5;
+            }
+        } else {
+            xxLog->append('s');
+            xxLog->append((uint32)n);
+            xxLog->append(s, n);
+        }
+        return *this;
+    }
+
+  private:
+    char* _p;
+    char* _e;
+    size_t _n;
+};
+
 class FatalLogSaver {
   public:
     FatalLogSaver(const char* file, unsigned int line) {
         if (unlikely(xxLog == 0)) xxLog = new fastream(128);
         xxLog->resize(log_time_t::total_size + 1);
         xxLog->front() = 'F';
-        (*xxLog) << ' ' << current_thread_id() << ' ' << file << ':' << line << ']' << ' ';
+        (*xxLog) << ' ' << current_thread_id();
+        if (gLogExtra & kCoId) append_co_id(*xxLog);
+        (*xxLog) << ' ' << file << ':' << line << ']' << ' ';
     }
 
     ~FatalLogSaver() {
@@ -149,17 +546,52 @@ using namespace ___;
 //
 // LOG << "hello world " << 23;
 // WLOG_IF(1 + 1 == 2) << "xx";
+// a static LogSite for each call site
+#define _CO_LOG_SITE \
+    ([]() -> log::xx::LogSite& { static log::xx::LogSite s = { -1, 0, 0 }; return s; }())
+#define _CO_LOG_ON(level) log::xx::log_on(_CO_LOG_SITE, level, __FILE__)
+
 #define _DLOG_STREAM  log::xx::LevelLogSaver(__FILE__, __LINE__, log::xx::debug).fs()
 #define _LOG_STREAM   log::xx::LevelLogSaver(__FILE__, __LINE__, log::xx::info).fs()
 #define _WLOG_STREAM  log::xx::LevelLogSaver(__FILE__, __LINE__, log::xx::warning).fs()
 #define _ELOG_STREAM  log::xx::LevelLogSaver(__FILE__, __LINE__, log::xx::error).fs()
 #define _FLOG_STREAM  log::xx::FatalLogSaver(__FILE__, __LINE__).fs()
-#define DLOG  if (FLG_min_log_level <= log::xx::debug)   _DLOG_STREAM
-#define LOG   if (FLG_min_log_level <= log::xx::info)     _LOG_STREAM
-#define WLOG  if (FLG_min_log_level <= log::xx::warning) _WLOG_STREAM
-#define ELOG  if (FLG_min_log_level <= log::xx::error)   _ELOG_STREAM
+#define DLOG  if (_CO_LOG_ON(log::xx::debug))   _DLOG_STREAM
+#define LOG   if (_CO_LOG_ON(log::xx::info))    _LOG_STREAM
+#define WLOG  if (_CO_LOG_ON(log::xx::warning)) _WLOG_STREAM
+#define ELOG  if (_CO_LOG_ON(log::xx::error))   _ELOG_STREAM
 #define FLOG  _FLOG_STREAM << "fatal error! "
 
+// binary logs, see BinLogSaver for details. If CO_BINARY_LOG is defined before 
+// including this file, DLOG, LOG, WLOG and ELOG in the source file will also 
+// be binary logs.
+//
+// LOG_BIN << "hello world " << 23;
+#define _CO_BIN_LOG_SITE(level) \
+    ([]() -> const log::xx::BinLogSite* { \
+        static const log::xx::BinLogSite s = { __FILE__, __LINE__, level }; return &s; \
+    }())
+
+#define _DLOG_BIN_STREAM  log::xx::BinLogSaver(_CO_BIN_LOG_SITE(log::xx::debug)).fs()
+#define _LOG_BIN_STREAM   log::xx::BinLogSaver(_CO_BIN_LOG_SITE(log::xx::info)).fs()
+#define _WLOG_BIN_STREAM  log::xx::BinLogSaver(_CO_BIN_LOG_SITE(log::xx::warning)).fs()
+#define _ELOG_BIN_STREAM  log::xx::BinLogSaver(_CO_BIN_LOG_SITE(log::xx::error)).fs()
+#define DLOG_BIN  if (_CO_LOG_ON(log::xx::debug))   _DLOG_BIN_STREAM
+#define LOG_BIN   if (_CO_LOG_ON(log::xx::info))    _LOG_BIN_STREAM
+#define WLOG_BIN  if (_CO_LOG_ON(log::xx::warning)) _WLOG_BIN_STREAM
+#define ELOG_BIN  if (_CO_LOG_ON(log::xx::error))   _ELOG_BIN_STREAM
+
+#ifdef CO_BINARY_LOG
+#undef DLOG
+#undef LOG
+#undef WLOG
+#undef ELOG
+#define DLOG  DLOG_BIN
+#define LOG   LOG_BIN
+#define WLOG  WLOG_BIN
+#define ELOG  ELOG_BIN
+#endif
+
 // conditional log
 #define DLOG_IF(cond) if (cond) DLOG
 #define  LOG_IF(cond) if (cond) LOG
@@ -207,3 +639,24 @@ using namespace ___;
 #define  LOG_FIRST_N(n) _LOG_FIRST_N(n, LOG)
 #define WLOG_FIRST_N(n) _LOG_FIRST_N(n, WLOG)
 #define ELOG_FIRST_N(n) _LOG_FIRST_N(n, ELOG)
+
+// rate-limited log, see LogLimiter for details. 
+// The first log after some were suppressed starts with "[suppressed N] ".
+//
+// ELOG_EVERY_MS(1000) << "recv error";  // at most one log per second
+// ELOG_RATE_LIMIT(10) << "recv error";  // 10 logs per second, bursts of 10
+#define _LOG_LIMITED(f, x, level, what) \
+    static log::xx::LogLimiter CO_LOG_COUNTER = { 0, 0, level, __FILE__, __LINE__, 0, 0 }; \
+    if (_CO_LOG_ON(level)) \
+        if (const uint32 _co_log_n_ = log::xx::f(&CO_LOG_COUNTER, x)) \
+            what << log::xx::LogSuppressed{ _co_log_n_ - 1 }
+
+#define DLOG_EVERY_MS(ms) _LOG_LIMITED(log_every_ms, ms, log::xx::debug, DLOG)
+#define  LOG_EVERY_MS(ms) _LOG_LIMITED(log_every_ms, ms, log::xx::info, LOG)
+#define WLOG_EVERY_MS(ms) _LOG_LIMITED(log_every_ms, ms, log::xx::warning, WLOG)
+#define ELOG_EVERY_MS(ms) _LOG_LIMITED(log_every_ms, ms, log::xx::error, ELOG)
+
+#define DLOG_RATE_LIMIT(n) _LOG_LIMITED(log_rate, n, log::xx::debug, DLOG)
+#define  LOG_RATE_LIMIT(n) _LOG_LIMITED(log_rate, n, log::xx::info, LOG)
+#define WLOG_RATE_LIMIT(n) _LOG_LIMITED(log_rate, n, log::xx::warning, WLOG)
+#define ELOG_RATE_LIMIT(n) _LOG_LIMITED(log_rate, n, log::xx::error, ELOG)
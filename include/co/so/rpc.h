@@ -13,6 +13,12 @@ class Service {
 
     virtual const char* name() const = 0;
 
+    /**
+     * process a rpc request 
+     *   - Strings in req may point to the buffer the request was received in,
+     *     they are valid until process() returns. Copy the Json or the strings 
+     *     if they are needed later. 
+     */
     virtual void process(const Json& req, Json& res) = 0;
 };
 
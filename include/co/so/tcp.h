@@ -7,8 +7,10 @@
 
 namespace tcp {
 
+struct ServerParam;
+
 struct Connection {
-    Connection(int sockfd) : _fd(sockfd) {}
+    Connection(int sockfd) : _fd(sockfd), _sid(-1), _sp(0) {}
     virtual ~Connection() { this->close(); }
 
     /**
@@ -61,8 +63,32 @@ struct Connection {
         return _fd;
     }
 
+  private:
+    void untrack();
+
   private:
     int _fd;
+    int _sid; // id of the scheduler this connection was counted in, -1 if not counted
+    ServerParam* _sp; // the server that accepted this connection, NULL if not tracked
+    friend struct ServerParam;
+};
+
+/**
+ * get number of live connections of tcp::Server in a scheduler 
+ *   - A connection is counted from the time it was accepted, until it was closed 
+ *     or reset. 
+ * 
+ * @param sched_id  id of the scheduler, from 0 to co::scheduler_num() - 1.
+ */
+int conn_num(int sched_id);
+
+/**
+ * connection statistics of a tcp::Server, see Server::stats()
+ */
+struct ServerStats {
+    uint64 accepted; // connections accepted
+    uint64 rejected; // failed accepts, e.g. too many open files
+    uint64 inflight; // connections accepted but not closed yet
 };
 
 /**
@@ -73,11 +99,22 @@ struct Connection {
  */
 class Server {
   public:
-    Server() = default; // { _on_connection = NULL; }
+    Server() : _reuse_port(false), _sched_policy(-1), _max_conn(0), _p(0) {}
     virtual ~Server() = default; //{ if (_on_connection) delete _on_connection; }
 
     typedef std::function<void(Connection*)> conn_cb;
 
+    // return id of the scheduler to handle a connection from the peer address.
+    typedef std::function<int(const void* addr, int addrlen)> sched_cb;
+
+    // policies for choosing a scheduler to handle a new connection
+    enum {
+        kRoundRobin = 0,  // co::next_scheduler()
+        kLeastConn = 1,   // the scheduler with the least live connections, see tcp::conn_num()
+        kPeerHash = 2,    // hash of the peer ip, connections from a host go to the same scheduler
+        kAcceptLocal = 3, // the scheduler that accepted the connection
+    };
+
     /**
      * set a callback for handling a connection 
      *   - The user MUST delete the Connection pointer when the connection was closed.
@@ -105,6 +142,60 @@ class Server {
         _on_connection.reset(new conn_cb(std::bind(f, o, std::placeholders::_1)));
     }
 
+    /**
+     * accept connections in every scheduler with SO_REUSEPORT 
+     *   - It MUST be called before start(). 
+     *   - A listening socket will be created in each scheduler, the kernel balances 
+     *     new connections among them, and by default a connection will be handled 
+     *     in the same scheduler that accepted it (see set_sched_policy()). 
+     *   - It is supported on Linux only, a single listener will be used on other 
+     *     platforms. It can also be enabled by the flag tcp_reuse_port. 
+     */
+    void reuse_port(bool x=true) {
+        _reuse_port = x;
+    }
+
+    /**
+     * set the policy for choosing a scheduler to handle a new connection 
+     *   - It MUST be called before start(). 
+     *   - The default is kAcceptLocal if reuse_port() is enabled, otherwise kRoundRobin. 
+     * 
+     * @param x  kRoundRobin, kLeastConn, kPeerHash or kAcceptLocal.
+     */
+    void set_sched_policy(int x) {
+        _sched_policy = x;
+    }
+
+    /**
+     * set a user-defined policy for choosing a scheduler 
+     *   - It MUST be called before start(). 
+     *   - f is called in the server loop for each accepted connection, and should 
+     *     return an id from 0 to co::scheduler_num() - 1. 
+     * 
+     * @param f  int f(const void* addr, int addrlen), addr points to the peer address.
+     */
+    void set_sched_policy(sched_cb&& f) {
+        _sched_cb.reset(new sched_cb(std::move(f)));
+    }
+
+    /**
+     * set max number of live connections 
+     *   - It MUST be called before start(). 
+     *   - When the limit is reached, the server stops accepting, new connections 
+     *     wait in the listen backlog, and accepting resumes when a connection 
+     *     was closed. 
+     *   - The default is 0, no limit. It can also be set by the flag tcp_max_conn. 
+     */
+    void set_max_conn(uint32 n) {
+        _max_conn = n;
+    }
+
+    /**
+     * get connection statistics of this server 
+     *   - All zero if the server was not started. 
+     */
+    ServerStats stats() const;
+
     /**
      * start the server
      *   - The server will loop in a coroutine, and it will not block the calling thread.
@@ -122,6 +213,11 @@ class Server {
 
   private:
     std::shared_ptr<conn_cb> _on_connection;
+    std::shared_ptr<sched_cb> _sched_cb;
+    bool _reuse_port;
+    int _sched_policy;
+    uint32 _max_conn;
+    ServerParam* _p;
 
     DISALLOW_COPY_AND_ASSIGN(Server);
 };
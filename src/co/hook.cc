@@ -177,6 +177,8 @@ def_raw_api(gethostbyaddr);
 
 #ifdef __linux__
 def_raw_api(epoll_wait);
+def_raw_api(dup2);
+def_raw_api(dup3);
 def_raw_api(accept4);
 def_raw_api(gethostbyname2);
 def_raw_api(gethostbyname_r);
@@ -214,6 +216,9 @@ int shutdown(int fd, int how) {
 
 int close(int fd) {
     init_hook(close);
+  #ifdef __linux__
+    co::xx::poll_del_fd(fd);
+  #endif
     if (!co::scheduler()) return raw_api(close)(fd);
 
     auto hi = gHook().on_close(fd);
@@ -405,6 +410,9 @@ int poll(struct pollfd* fds, nfds_t nfds, int ms) {
         }
     } while (0);
 
+  #ifdef __linux__
+    return co::poll(fds, (int)nfds, ms);
+  #else
     // it's boring to hook poll when nfds > 1, just check poll every 16 ms
     do {
         int r = raw_api(poll)(fds, nfds, 0);
@@ -412,6 +420,7 @@ int poll(struct pollfd* fds, nfds_t nfds, int ms) {
         co::sleep(16);
         if (ms > 0 && (ms -= 16) < 0) return 0;
     } while (true);
+  #endif
 }
 
 int __poll(struct pollfd* fds, nfds_t nfds, int ms) {
@@ -431,6 +440,39 @@ int select(int nfds, fd_set* r, fd_set* w, fd_set* e, struct timeval* tv) {
         return 0;
     }
 
+  #ifdef __linux__
+    // convert to struct pollfd and wait with co::poll()
+    std::vector<struct pollfd> fds;
+    for (int fd = 0; fd < nfds; ++fd) {
+        short ev = 0;
+        if (r && FD_ISSET(fd, r)) ev |= POLLIN;
+        if (w && FD_ISSET(fd, w)) ev |= POLLOUT;
+        if (e && FD_ISSET(fd, e)) ev |= POLLPRI;
+        if (ev) fds.push_back({ fd, ev, 0 });
+    }
+
+    // the sets are cleared on timeout too, as select() does
+    int x = co::poll(fds.data(), (int)fds.size(), ms);
+    if (x < 0) return x;
+    if (r) FD_ZERO(r);
+    if (w) FD_ZERO(w);
+    if (e) FD_ZERO(e);
+    if (x == 0) return 0;
+
+    x = 0;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        const int fd = fds[i].fd;
+        const short rev = fds[i].revents;
+        if (rev & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+        if ((fds[i].events & POLLIN) && (rev & (POLLIN | POLLHUP | POLLERR))) { FD_SET(fd, r); ++x; }
+        if ((fds[i].events & POLLOUT) && (rev & (POLLOUT | POLLERR))) { FD_SET(fd, w); ++x; }
+        if ((fds[i].events & POLLPRI) && (rev & POLLPRI)) { FD_SET(fd, e); ++x; }
+    }
+    return x;
+  #else
     // it's boring to hook select, just check select every 16 ms
     struct timeval o = { 0, 0 };
     do {
@@ -439,6 +481,7 @@ int select(int nfds, fd_set* r, fd_set* w, fd_set* e, struct timeval* tv) {
         co::sleep(16);
         if (ms > 0 && (ms -= 16) < 0) return 0;
     } while (true);
+  #endif
 }
 
 unsigned int sleep(unsigned int n) {
@@ -476,6 +519,19 @@ int epoll_wait(int epfd, struct epoll_event* events, int n, int ms) {
     return raw_api(epoll_wait)(epfd, events, n, 0);
 }
 
+// newfd is closed silently by dup2() and dup3(), remove it from co::poll()
+int dup2(int oldfd, int newfd) {
+    init_hook(dup2);
+    if (oldfd != newfd) co::xx::poll_del_fd(newfd);
+    return raw_api(dup2)(oldfd, newfd);
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    init_hook(dup3);
+    if (oldfd != newfd) co::xx::poll_del_fd(newfd);
+    return raw_api(dup3)(oldfd, newfd, flags);
+}
+
 int accept4(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags) {
     init_hook(accept4);
     if (!co::scheduler()) return raw_api(accept4)(fd, addr, addrlen, flags);
@@ -626,6 +682,8 @@ static bool init_hooks() {
 
   #ifdef __linux__
     init_hook(epoll_wait);
+    init_hook(dup2);
+    init_hook(dup3);
     init_hook(accept4);
     init_hook(gethostbyname2);
     init_hook(gethostbyname_r);
@@ -0,0 +1,338 @@
+#ifdef __linux__
+
+#include "co/co/sock.h"
+#include "co/co/scheduler.h"
+#include "co/co/io_event.h"
+#include "co/time.h"
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace co {
+namespace xx {
+
+class Poller;
+
+// generation of fds, bumped by poll_del_fd() when a fd is closed or replaced by
+// dup2()/dup3(). fds equal modulo the table size share a slot, which costs only
+// a needless registration.
+static uint32 g_fd_gen[1 << 16];
+
+inline uint32* fd_gen(int fd) {
+    return &g_fd_gen[fd & ((1 << 16) - 1)];
+}
+
+/**
+ * watch set of co::poll() for a coroutine
+ *   - fds are kept in a level-triggered epoll between calls, and a fd is not 
+ *     touched again until its events or generation change, so a call with the 
+ *     same fds makes no epoll_ctl at all.
+ *   - The generation is stored in the epoll data of a fd. Events of an older 
+ *     generation come from a registration left by a dup of a closed fd, which 
+ *     can't be removed by the fd, so the epoll is built again.
+ *   - Regular files can't be added to epoll, they are always ready as poll() does.
+ *   - It is owned by the coroutine, and freed when the coroutine ends.
+ */
+class PollSet {
+  public:
+    PollSet(Poller* p) : _p(p), _epfd(-1), _mark(0) {}
+    ~PollSet();
+
+    // the Poller is destroyed before the set
+    void detach() { _p = 0; }
+
+    int fd() const { return _epfd; }
+
+    // update the watch set with fds, return number of fds ready without waiting
+    // (regular files or invalid fds), or -1 on error.
+    int update(struct pollfd* fds, int nfds);
+
+    // check the watch set without waiting and fill revents of fds, return
+    // number of fds with non-zero revents, or -1 on error.
+    int check(struct pollfd* fds, int nfds);
+
+    void del(int fd);
+
+  private:
+    enum { kEpoll = 0, kAlways = 1, kInvalid = 2 };
+
+    struct Entry {
+        uint32 events;  // events registered, -1 if not registered by this set
+        uint32 want;    // events wanted in the current call
+        uint32 revents; // events returned by epoll_wait
+        uint32 mark;
+        uint32 gen;     // generation of the fd when it was registered
+        int state;
+    };
+
+    // register fd with events it wants, return -1 on error.
+    int add(int fd, Entry& e);
+
+    // create a new epoll and register all fds again, return -1 on error.
+    int rebuild();
+
+    Poller* _p;
+    int _epfd;
+    uint32 _mark;
+    std::unordered_map<int, Entry> _fds;
+    std::vector<epoll_event> _ev;
+};
+
+// co::poll() in a scheduler, one watch set per coroutine.
+class Poller {
+  public:
+    Poller() = default;
+    ~Poller() {
+        for (auto it = _sets.begin(); it != _sets.end(); ++it) (*it)->detach();
+    }
+
+    PollSet& get(Coroutine* co) {
+        if (co->pset == 0) {
+            co->pset = new PollSet(this);
+            _sets.insert(co->pset);
+        }
+        return *co->pset;
+    }
+
+    void remove(PollSet* s) { _sets.erase(s); }
+
+    void ref(int fd) { ++_refs[fd]; }
+
+    void unref(int fd) {
+        auto it = _refs.find(fd);
+        if (it != _refs.end() && --it->second == 0) _refs.erase(it);
+    }
+
+    void del(int fd) {
+        if (_refs.empty() || _refs.find(fd) == _refs.end()) return;
+        for (auto it = _sets.begin(); it != _sets.end(); ++it) (*it)->del(fd);
+    }
+
+  private:
+    std::unordered_set<PollSet*> _sets;       // watch sets of coroutines alive
+    std::unordered_map<int, int> _refs;       // fd -> number of watch sets containing it
+};
+
+PollSet::~PollSet() {
+    if (_epfd != -1) raw_api(close)(_epfd);
+    if (_p) {
+        for (auto it = _fds.begin(); it != _fds.end(); ++it) _p->unref(it->first);
+        _p->remove(this);
+    }
+}
+
+void delete_poll_set(PollSet* s) {
+    delete s;
+}
+
+inline Poller& poller() {
+    static std::vector<Poller> v(scheduler_num());
+    return v[scheduler()->id()];
+}
+
+int PollSet::add(int fd, Entry& e) {
+    // ADD again on ENOENT, or MOD on EEXIST, as the set may be stale when the 
+    // fd was closed, or replaced by a dup of the same file.
+    epoll_event ev;
+    ev.events = e.want;
+    ev.data.u64 = ((uint64)e.gen << 32) | (uint32)fd;
+    int op = (e.events == (uint32)-1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    int r = epoll_ctl(_epfd, op, fd, &ev);
+    if (r != 0 && (errno == ENOENT || errno == EEXIST)) {
+        op = (errno == ENOENT) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        r = epoll_ctl(_epfd, op, fd, &ev);
+    }
+    if (r == 0) {
+        e.events = e.want;
+        return 0;
+    }
+
+    e.events = (uint32)-1;
+    if (errno == EPERM) {
+        e.state = kAlways;
+    } else if (errno == EBADF) {
+        e.state = kInvalid;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int PollSet::update(struct pollfd* fds, int nfds) {
+    if (_epfd == -1) {
+        _epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epfd == -1) return -1;
+    }
+
+    const uint32 mark = ++_mark;
+    for (int i = 0; i < nfds; ++i) {
+        if (fds[i].fd < 0) continue;
+        auto r = _fds.insert(std::make_pair(fds[i].fd, Entry()));
+        Entry& e = r.first->second;
+        if (r.second) {
+            _p->ref(fds[i].fd);
+            e.events = (uint32)-1;
+            e.gen = atomic_get(fd_gen(fds[i].fd));
+            e.state = kEpoll;
+        }
+        const uint32 x = (uint16)fds[i].events;
+        e.want = (e.mark == mark) ? (e.want | x) : x; // the same fd may appear more than once
+        e.mark = mark;
+        e.revents = 0;
+    }
+
+    int n = 0;
+    for (auto it = _fds.begin(); it != _fds.end();) {
+        const int fd = it->first;
+        Entry& e = it->second;
+        const uint32 gen = atomic_get(fd_gen(fd));
+        if (e.mark != mark) {
+            if (e.state == kEpoll && e.events != (uint32)-1 && e.gen == gen) {
+                epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, (epoll_event*)8);
+            }
+            _p->unref(fd);
+            it = _fds.erase(it);
+            continue;
+        }
+
+        if (e.gen != gen) {
+            // the fd was closed or replaced, it may refer to another file now
+            e.gen = gen;
+            e.events = (uint32)-1;
+            e.state = kEpoll;
+        } else if (e.state == kInvalid) {
+            e.state = kEpoll; // the fd may have been created since the last call
+        }
+
+        if (e.state == kEpoll && e.events != e.want) {
+            if (this->add(fd, e) != 0) return -1;
+        }
+        if (e.state != kEpoll) ++n;
+        ++it;
+    }
+
+    if (_ev.size() < _fds.size()) _ev.resize(_fds.size());
+    return n;
+}
+
+int PollSet::rebuild() {
+    const int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd == -1) return -1;
+    raw_api(close)(_epfd);
+    _epfd = fd;
+
+    for (auto it = _fds.begin(); it != _fds.end(); ++it) {
+        Entry& e = it->second;
+        e.revents = 0;
+        if (e.state != kEpoll) continue;
+        e.events = (uint32)-1;
+        if (this->add(it->first, e) != 0) return -1;
+    }
+    return 0;
+}
+
+int PollSet::check(struct pollfd* fds, int nfds) {
+    int r = 0;
+    bool rebuilt = false;
+    while (!_ev.empty()) {
+        r = raw_api(epoll_wait)(_epfd, _ev.data(), (int)_ev.size(), 0);
+        if (r < 0) return errno == EINTR ? 0 : -1;
+
+        bool stale = false;
+        for (int i = 0; i < r; ++i) {
+            auto it = _fds.find((int)(uint32)_ev[i].data.u64);
+            if (it != _fds.end() && it->second.gen == (uint32)(_ev[i].data.u64 >> 32)) {
+                it->second.revents = _ev[i].events;
+            } else {
+                stale = true;
+            }
+        }
+
+        // build the epoll once at most, events left by another thread closing 
+        // fds at the same time are just ignored.
+        if (!stale || rebuilt) break;
+        if (this->rebuild() != 0) return -1;
+        rebuilt = true;
+    }
+
+    int n = 0;
+    for (int i = 0; i < nfds; ++i) {
+        fds[i].revents = 0;
+        if (fds[i].fd < 0) continue;
+        const Entry& e = _fds[fds[i].fd];
+        if (e.state == kEpoll) {
+            if (r > 0) {
+                const uint32 x = e.revents & ((uint16)fds[i].events | POLLERR | POLLHUP);
+                fds[i].revents = (short)x;
+            }
+        } else if (e.state == kAlways) {
+            fds[i].revents = fds[i].events & (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM);
+        } else {
+            fds[i].revents = POLLNVAL;
+        }
+        if (fds[i].revents) ++n;
+    }
+
+    for (int i = 0; i < r; ++i) {
+        auto it = _fds.find((int)(uint32)_ev[i].data.u64);
+        if (it != _fds.end()) it->second.revents = 0;
+    }
+    return n;
+}
+
+void PollSet::del(int fd) {
+    auto it = _fds.find(fd);
+    if (it == _fds.end()) return;
+    const Entry& e = it->second;
+    if (e.state == kEpoll && e.events != (uint32)-1 && e.gen == atomic_get(fd_gen(fd))) {
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, (epoll_event*)8);
+    }
+    _fds.erase(it);
+    _p->unref(fd);
+}
+
+void poll_del_fd(int fd) {
+    if (fd < 0) return;
+    if (scheduler()) poller().del(fd);
+    atomic_inc(fd_gen(fd));
+}
+
+} // xx
+
+int poll(struct pollfd* fds, int nfds, int ms) {
+    CHECK(xx::scheduler()) << "must be called in coroutine..";
+    xx::PollSet& s = xx::poller().get(xx::scheduler()->running());
+    if (s.update(fds, nfds) < 0) return -1;
+
+    const int64 deadline = ms > 0 ? now::ms() + ms : 0;
+    do {
+        const int r = s.check(fds, nfds);
+        if (r != 0) return r;
+        if (ms == 0) return 0;
+
+        int t = -1;
+        if (ms > 0) {
+            t = (int)(deadline - now::ms());
+            if (t <= 0) return 0;
+        }
+        // the epoll of the watch set is added to the scheduler only while we 
+        // are waiting, check() may build it again.
+        IoEvent ev(s.fd(), EV_read);
+        if (!ev.wait(t)) return (errno == ETIMEDOUT) ? 0 : -1;
+    } while (true);
+}
+
+} // co
+
+#else
+
+namespace co {
+namespace xx {
+
+class PollSet;
+void delete_poll_set(PollSet*) {}
+
+} // xx
+} // co
+
+#endif
@@ -25,6 +25,9 @@ sock_t socket(int domain, int type, int protocol) {
 int close(sock_t fd, int ms) {
     CHECK(xx::scheduler()) << "must be called in coroutine..";
     xx::scheduler()->del_io_event(fd);
+  #ifdef __linux__
+    xx::poll_del_fd(fd);
+  #endif
     if (ms > 0) xx::scheduler()->sleep(ms);
     int r;
     while ((r = raw_api(close)(fd)) != 0 && errno == EINTR);
@@ -201,6 +204,45 @@ int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int
     } while (true);
 }
 
+#ifdef __linux__
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(xx::scheduler()) << "must be called in coroutine..";
+    IoEvent ev(fd, EV_read);
+    do {
+        int r = ::recvmmsg(fd, msgs, (unsigned int)n, MSG_DONTWAIT, 0);
+        if (r != -1) return r;
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (true);
+}
+
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(xx::scheduler()) << "must be called in coroutine..";
+    int remain = n;
+    IoEvent ev(fd, EV_write);
+
+    do {
+        int r = ::sendmmsg(fd, msgs, (unsigned int)remain, MSG_DONTWAIT);
+        if (r == remain) return n;
+
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) return -1;
+            } else if (errno != EINTR) {
+                return -1;
+            }
+        } else {
+            remain -= r;
+            msgs += r;
+        }
+    } while (true);
+}
+#endif
+
 namespace xx {
 
 class Error {
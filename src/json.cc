@@ -1,19 +1,41 @@
 #include "co/json.h"
 
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_SSE2 1
+#define JSON_AVX2 1 // avx2 is enabled at runtime if supported by the cpu
+#include <immintrin.h>
+#define JSON_AVX2_FN __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JSON_SSE2 1
+#include <emmintrin.h>
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include "co/fs.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace json {
 
 // json parser
 //   @b: beginning of the string
 //   @e: end of the string
 // return the current position, or NULL on any error
+//
+// With @insitu, strings are decoded in the input and terminated by '\0' in 
+// place of the closing quote, and the Json points to them instead of copying.
 class Parser {
   public:
-    Parser(Json* root) : _root(root) {}
+    Parser(Json* root, bool insitu=false) : _root(root), _insitu(insitu) {}
     ~Parser() = default;
 
     bool parse(const char* b, const char* e);
     const char* parse_string(const char* b, const char* e, uint32& index);
-    const char* parse_unicode(const char* b, const char* e, fastream& s);
     const char* parse_number(const char* b, const char* e, uint32& index);
     const char* parse_key(const char* b, const char* e, uint32& index);
     const char* parse_false(const char* b, const char* e, uint32& index);
@@ -22,14 +44,9 @@ class Parser {
 
   private:
     Json* _root;
+    bool _insitu;
 };
 
-inline const char* Parser::parse_key(const char* b, const char* e, uint32& index) {
-    if (*b++ != '"') return 0;
-    const char* p = (const char*) memchr(b, '"', e - b);
-    if (p) index = _root->_make_key(b, p - b);
-    return p;
-}
 
 inline const char* Parser::parse_false(const char* b, const char* e, uint32& index) {
     if (e - b >= 5 && b[1] == 'a' && b[2] == 'l' && b[3] == 's' && b[4] == 'e') {
@@ -59,47 +76,249 @@ inline bool is_white_space(char c) {
     return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
 }
 
-#if 1
-#define skip_white_space(b, e) \
-    if (++b < e && is_white_space(*b)) { \
-        for (++b;;) { \
-            if (b + 8 <= e) { \
-                if (!is_white_space(b[0])) break; \
-                if (!is_white_space(b[1])) { b += 1; break; } \
-                if (!is_white_space(b[2])) { b += 2; break; } \
-                if (!is_white_space(b[3])) { b += 3; break; } \
-                if (!is_white_space(b[4])) { b += 4; break; } \
-                if (!is_white_space(b[5])) { b += 5; break; } \
-                if (!is_white_space(b[6])) { b += 6; break; } \
-                if (!is_white_space(b[7])) { b += 7; break; } \
-                b += 8; \
-            } else { \
-                if (b + 4 <= e) {\
-                    if (!is_white_space(b[0])) break; \
-                    if (!is_white_space(b[1])) { b += 1; break; } \
-                    if (!is_white_space(b[2])) { b += 2; break; } \
-                    if (!is_white_space(b[3])) { b += 3; break; } \
-                    b += 4; \
-                } \
-                if (b == e || !is_white_space(b[0])) break; \
-                if (b + 1 == e || !is_white_space(b[1])) { b += 1; break; } \
-                if (b + 2 == e || !is_white_space(b[2])) { b += 2; break; } \
-                b = e; break; \
-            } \
-        } \
+// Structural scanning.
+//   - Bytes are classified 16 (SSE2) or 64 (AVX2) at a time into a bit mask, 
+//     the first set bit is where the state machine goes on.
+//   - find_quote()               first '"' in [b, e)
+//   - find_quote_or_backslash()  first '"' or '\\' in [b, e)
+//   - find_non_white_space()     first byte not in " \r\n\t" in [b, e)
+//   - find_escape_candidate()    first control char, '"' or '\\' in [b, e)
+//   - find_bracket()             first '"', '[', ']', '{' or '}' in [b, e)
+//   All of them return e if not found.
+#ifdef JSON_SSE2
+#ifdef _MSC_VER
+inline int ctz32(uint32 x) { unsigned long i; _BitScanForward(&i, x); return (int)i; }
+#else
+inline int ctz32(uint32 x) { return __builtin_ctz(x); }
+inline int ctz64(uint64 x) { return __builtin_ctzll(x); }
+#endif
+
+struct Quote {
+    static bool match(char c) { return c == '"'; }
+    static uint32 sse2(const char* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+    }
+  #ifdef JSON_AVX2
+    JSON_AVX2_FN static uint32 avx2(const char* b) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        return (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+    }
+  #endif
+};
+
+struct QuoteOrBackslash {
+    static bool match(char c) { return c == '"' || c == '\\'; }
+    static uint32 sse2(const char* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        return (uint32)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))
+        ));
+    }
+  #ifdef JSON_AVX2
+    JSON_AVX2_FN static uint32 avx2(const char* b) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        return (uint32)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))
+        ));
+    }
+  #endif
+};
+
+struct NonWhiteSpace {
+    static bool match(char c) { return !is_white_space(c); }
+    static uint32 sse2(const char* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const __m128i a = _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))
+        );
+        const __m128i c = _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))
+        );
+        return (uint32)_mm_movemask_epi8(_mm_or_si128(a, c)) ^ 0xffff;
+    }
+  #ifdef JSON_AVX2
+    JSON_AVX2_FN static uint32 avx2(const char* b) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const __m256i a = _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))
+        );
+        const __m256i c = _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))
+        );
+        return ~(uint32)_mm256_movemask_epi8(_mm256_or_si256(a, c));
+    }
+  #endif
+};
+
+// bytes <= 0x1f are found by min(x, 0x1f) == x, as there is no unsigned compare
+struct EscapeCandidate {
+    static bool match(char c) { return (uint8)c < 0x20 || c == '"' || c == '\\'; }
+    static uint32 sse2(const char* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const __m128i a = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1f)), x);
+        return (uint32)_mm_movemask_epi8(_mm_or_si128(a, _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))
+        )));
+    }
+  #ifdef JSON_AVX2
+    JSON_AVX2_FN static uint32 avx2(const char* b) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const __m256i a = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(0x1f)), x);
+        return (uint32)_mm256_movemask_epi8(_mm256_or_si256(a, _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))
+        )));
+    }
+  #endif
+};
+
+// '[' | 0x20 is '{', and ']' | 0x20 is '}'
+struct Bracket {
+    static bool match(char c) { return c == '"' || (c | 0x20) == '{' || (c | 0x20) == '}'; }
+    static uint32 sse2(const char* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)b);
+        const __m128i y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        return (uint32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_or_si128(
+            _mm_cmpeq_epi8(y, _mm_set1_epi8('{')), _mm_cmpeq_epi8(y, _mm_set1_epi8('}'))
+        )));
+    }
+  #ifdef JSON_AVX2
+    JSON_AVX2_FN static uint32 avx2(const char* b) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)b);
+        const __m256i y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        return (uint32)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), _mm256_or_si256(
+            _mm256_cmpeq_epi8(y, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(y, _mm256_set1_epi8('}'))
+        )));
     }
+  #endif
+};
+
+template <typename M>
+inline const char* sse2_find(const char* b, const char* e) {
+    for (; b + 16 <= e; b += 16) {
+        const uint32 m = M::sse2(b);
+        if (m) return b + ctz32(m);
+    }
+    for (; b < e; ++b) {
+        if (M::match(*b)) return b;
+    }
+    return e;
+}
+
+#ifdef JSON_AVX2
+template <typename M>
+JSON_AVX2_FN inline const char* avx2_find(const char* b, const char* e) {
+    for (; b + 64 <= e; b += 64) {
+        const uint64 m = M::avx2(b) | ((uint64)M::avx2(b + 32) << 32);
+        if (m) return b + ctz64(m);
+    }
+    if (b + 32 <= e) {
+        const uint32 m = M::avx2(b);
+        if (m) return b + ctz32(m);
+        b += 32;
+    }
+    return sse2_find<M>(b, e);
+}
+
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+// It is false before initialization, and sse2 will be used then.
+static const bool g_avx2 = cpu_has_avx2();
+
+template <typename M>
+inline const char* simd_find(const char* b, const char* e) {
+    return g_avx2 ? avx2_find<M>(b, e) : sse2_find<M>(b, e);
+}
 #else
-#define skip_white_space(b, e) \
-    while (++b < e && is_white_space(*b));
+template <typename M>
+inline const char* simd_find(const char* b, const char* e) {
+    return sse2_find<M>(b, e);
+}
+#endif
+
+inline const char* find_quote(const char* b, const char* e) {
+    return simd_find<Quote>(b, e);
+}
+
+inline const char* find_quote_or_backslash(const char* b, const char* e) {
+    return simd_find<QuoteOrBackslash>(b, e);
+}
+
+inline const char* find_non_white_space(const char* b, const char* e) {
+    return simd_find<NonWhiteSpace>(b, e);
+}
+
+inline const char* find_escape_candidate(const char* b, const char* e) {
+    return simd_find<EscapeCandidate>(b, e);
+}
+
+inline const char* find_bracket(const char* b, const char* e) {
+    return simd_find<Bracket>(b, e);
+}
+
+#else
+inline const char* find_quote(const char* b, const char* e) {
+    const char* p = (const char*) memchr(b, '"', e - b);
+    return p ? p : e;
+}
+
+inline const char* find_quote_or_backslash(const char* b, const char* e) {
+    const char* p = find_quote(b, e);
+    const char* q = (const char*) memchr(b, '\\', p - b);
+    return q ? q : p;
+}
+
+inline const char* find_non_white_space(const char* b, const char* e) {
+    for (; b + 4 <= e; b += 4) {
+        if (!is_white_space(b[0])) return b;
+        if (!is_white_space(b[1])) return b + 1;
+        if (!is_white_space(b[2])) return b + 2;
+        if (!is_white_space(b[3])) return b + 3;
+    }
+    for (; b < e; ++b) {
+        if (!is_white_space(*b)) return b;
+    }
+    return e;
+}
+
+inline const char* find_escape_candidate(const char* b, const char* e) {
+    for (; b < e; ++b) {
+        if ((uint8)*b < 0x20 || *b == '"' || *b == '\\') return b;
+    }
+    return e;
+}
+
+inline const char* find_bracket(const char* b, const char* e) {
+    for (; b < e; ++b) {
+        if (*b == '"' || (*b | 0x20) == '{' || (*b | 0x20) == '}') return b;
+    }
+    return e;
+}
 #endif
 
+// Most white spaces in json are a single space or none, check the first 
+// byte before scanning.
+#define skip_white_space(b, e) \
+    if (++b < e && is_white_space(*b)) b = find_non_white_space(b + 1, e)
+
+inline const char* Parser::parse_key(const char* b, const char* e, uint32& index) {
+    if (*b++ != '"') return 0;
+    const char* p = find_quote(b, e);
+    if (p == e) return 0;
+    index = _root->_make_key(b, p - b);
+    return p;
+}
+
 // This is a non-recursive implement of json parser.
 // stack: |prev size|prev state|index|....
 bool Parser::parse(const char* b, const char* e) {
     uint32 state = 0, key, val, index, size = 0;
     xx::Stack& s = xx::jalloc()->alloc_stack();
 
-    while (b < e && is_white_space(*b)) ++b;
+    b = find_non_white_space(b, e);
     if (b == e) return false;
     if (*b == '{') goto obj_beg;
     if (*b == '[') goto arr_beg;
@@ -121,10 +340,10 @@ bool Parser::parse(const char* b, const char* e) {
     if (b == 0) goto err;
     s.push(key);
 
-    while (++b < e && is_white_space(*b));
+    skip_white_space(b, e);
     if (b == e || *b != ':') goto err;
 
-    while (++b < e && is_white_space(*b));
+    skip_white_space(b, e);
     if (b == e) goto err;
 
     if (*b == '"') {
@@ -192,10 +411,12 @@ bool Parser::parse(const char* b, const char* e) {
   arr_end:
   obj_end:
     if (s.size > size) {
-        index = _root->_alloc_queue((char*)(s.p + size), (s.size - size) << 2);
+        const uint32 n = s.size - size;
+        index = _root->_alloc_queue((char*)(s.p + size), n << 2);
         s.size = size;
         val = s.pop();
         ((Json::_Header*)_root->_p8(val))->index = index;
+        _root->_index_object(val, n);
     } else {
         val = s.pop();
     }
@@ -221,7 +442,7 @@ bool Parser::parse(const char* b, const char* e) {
 
   end:
     s.reset();
-    while (++b < e && is_white_space(*b));
+    skip_white_space(b, e);
     return b == e;
   err:
     s.reset();
@@ -242,49 +463,65 @@ static inline const char* init_s2e_table() {
     return tb;
 }
 
-inline const char* find_quote    (const char* b, const char* e) { return (const char*) memchr(b, '"', e - b); }
-inline const char* find_backslash(const char* b, const char* e) { return (const char*) memchr(b, '\\', e - b); }
-
-const char* Parser::parse_string(const char* b, const char* e, uint32& index) {
-    const char *p, *q;
-    if ((p = find_quote(++b, e)) == 0) return 0;
-    q = find_backslash(b, p);
-    if (q == 0) {
-        index = _root->_make_string(b, p - b);
+static const char* parse_unicode(const char* b, const char* e, fastream& s);
+
+// scan a string beginning with '"' at b, escapes are decoded if any, 
+// @s and @n are set to the content, which is either in [b, e), or in the 
+// thread-local stream of jalloc(). 
+// return position of the closing quote, or NULL on any error
+inline const char* scan_string(const char* b, const char* e, const char*& s, size_t& n) {
+    const char* p = find_quote_or_backslash(++b, e);
+    if (p == e) return 0;
+    if (*p == '"') {
+        s = b;
+        n = p - b;
         return p;
     }
 
-    fastream& s = xx::jalloc()->alloc_stream();
+    fastream& fs = xx::jalloc()->alloc_stream();
     do {
-        s.append(b, q - b);
-        if (++q == e) return 0;
+        fs.append(b, p - b);
+        if (++p == e) return 0;
 
         static const char* tb = init_s2e_table();
-        char c = tb[(uint8)*q];
+        char c = tb[(uint8)*p];
         if (c == 0) return 0; // invalid escape
 
-        if (*q != 'u') {
-            s.append(c);
+        if (*p != 'u') {
+            fs.append(c);
         } else {
-            q = parse_unicode(q + 1, e, s);
-            if (q == 0) return 0;
-        }
-
-        b = q + 1;
-        if (b > p) {
-            p = find_quote(b, e);
+            p = parse_unicode(p + 1, e, fs);
             if (p == 0) return 0;
         }
-        
-        q = find_backslash(b, p);
-        if (q == 0) {
-            s.append(b, p - b);
-            index = _root->_make_string(s.data(), s.size());
+
+        b = p + 1;
+        p = find_quote_or_backslash(b, e);
+        if (p == e) return 0;
+        if (*p == '"') {
+            fs.append(b, p - b);
+            s = fs.data();
+            n = fs.size();
             return p;
         }
     } while (true);
 }
 
+const char* Parser::parse_string(const char* b, const char* e, uint32& index) {
+    const char* s;
+    size_t n;
+    const char* p = scan_string(b, e, s, n);
+    if (p == 0) return 0;
+    if (!_insitu) {
+        index = _root->_make_string(s, n);
+    } else {
+        // a decoded string is never longer than the escaped one
+        if (s != b + 1) memcpy((char*)b + 1, s, n);
+        ((char*)b)[n + 1] = '\0';
+        index = _root->_make_ext_string(b + 1, n);
+    }
+    return p;
+}
+
 inline const char* init_hex_table() {
     static char tb[256];
     memset(tb, 16, 256);
@@ -319,7 +556,7 @@ inline const char* parse_hex(const char* b, const char* e, uint32& u) {
 // \uXXXX\uYYYY
 //   D800 <= XXXX <= DBFF
 //   DC00 <= XXXX <= DFFF
-const char* Parser::parse_unicode(const char* b, const char* e, fastream& s) {
+static const char* parse_unicode(const char* b, const char* e, fastream& s) {
     uint32 u = 0;
     b = parse_hex(b, e, u);
     if (b == 0) return 0;
@@ -362,20 +599,17 @@ inline int64 str2int(const char* b, const char* e) {
     const char* p = b;
     if (*p == '-') ++p;
     for (; p < e; ++p) v = v * 10 + *p - '0';
-    return *b != '-' ? v : -(int64)v;
-}
-
-inline bool str2double(const char* b, double& d) {
-    errno = 0;
-    d = strtod(b, 0);
-    return !(errno == ERANGE && (d == HUGE_VAL || d == -HUGE_VAL));
+    return *b != '-' ? (int64)v : (int64)(0 - v); // no overflow for MIN_INT64
 }
 
 inline bool is_digit(char c) {
     return '0' <= c && c <= '9';
 }
 
-const char* Parser::parse_number(const char* b, const char* e, uint32& index) {
+// check syntax of a number beginning at b, @dbl is set to true if it is a 
+// double, or an integer out of range of int64 and uint64.
+// return end of the number, or NULL on any error
+inline const char* check_number(const char* b, const char* e, bool& dbl) {
     bool is_double = false;
     const char* p = b;
 
@@ -408,35 +642,36 @@ const char* Parser::parse_number(const char* b, const char* e, uint32& index) {
     {
         size_t n = p - b;
         if (n == 0) return 0;
-        if (is_double || n > 20) goto to_dbl;
-        if (n < 20) goto to_int;
-    }
-    {
-        // compare with MAX_UINT64, MIN_INT64
-        // if value > MAX_UINT64 or value < MIN_INT64, we parse it as a double
-        int m = memcmp(b, (*b != '-' ? "18446744073709551615" : "-9223372036854775808"), 20);
-        if (m < 0) goto to_int;
-        if (m > 0) goto to_dbl;
-        index = _root->_make_int(*b != '-' ? MAX_UINT64 : MIN_INT64);
-        return p - 1;
+        if (is_double || n > 20) { dbl = true; return p; }
+        if (n < 20) { dbl = false; return p; }
     }
 
-  to_int:
-    index = _root->_make_int(str2int(b, p));
-    return p - 1;
+    // compare with MAX_UINT64, MIN_INT64
+    // if value > MAX_UINT64 or value < MIN_INT64, we parse it as a double
+    dbl = memcmp(b, (*b != '-' ? "18446744073709551615" : "-9223372036854775808"), 20) > 0;
+    return p;
+}
 
-  to_dbl:
-    double d;
-    if (p == e && *p != '\0') {
-        fastream& fs = xx::jalloc()->alloc_stream();
-        fs.append(b, p - b);
-        b = fs.c_str();
-    }
-    if (str2double(b, d)) {
-        index = _root->_make_double(d);
+// scan a number beginning at b, @dbl is set to true if it is a double, and 
+// the value is set to @d, otherwise it is set to @i.
+// return position of the last digit, or NULL on any error
+inline const char* scan_number(const char* b, const char* e, int64& i, double& d, bool& dbl) {
+    const char* p = check_number(b, e, dbl);
+    if (p == 0) return 0;
+    if (!dbl) {
+        i = str2int(b, p);
         return p - 1;
     }
-    return 0;
+    return fast::atod(b, p - b, d) ? p - 1 : 0;
+}
+
+const char* Parser::parse_number(const char* b, const char* e, uint32& index) {
+    int64 i;
+    double d;
+    bool dbl;
+    b = scan_number(b, e, i, d, dbl);
+    if (b) index = dbl ? _root->_make_double(d) : _root->_make_int(i);
+    return b;
 }
 
 bool Json::parse_from(const char* s, size_t n) {
@@ -450,175 +685,1455 @@ bool Json::parse_from(const char* s, size_t n) {
     return parser.parse(s, s + n);
 }
 
-static inline const char* init_e2s_table() {
-    static char tb[256] = { 0 };
-    tb['\r'] = 'r';
-    tb['\n'] = 'n';
-    tb['\t'] = 't';
-    tb['\b'] = 'b';
-    tb['\f'] = 'f';
-    tb['\"'] = '"';
-    tb['\\'] = '\\';
-    return tb;
+bool Json::parse_from(char* s, size_t n, int flags) {
+    if (!(flags & kInSitu)) return this->parse_from((const char*)s, n);
+    if (_mem == 0) {
+        _mem = xx::jalloc()->alloc_jblock(_b8(n));
+    } else {
+        _jb.clear();
+        _jb.reserve(_b8(n));
+    }
+    _jb.set_borrow();
+    Parser parser(this, true);
+    return parser.parse(s, s + n);
 }
 
-inline const char* find_escapse(const char* b, const char* e, char& c) {
-    static const char* tb = init_e2s_table();
-#if 1
-    char c0, c1, c2, c3, c4, c5, c6, c7;
-    for (;;) {
-        if (b + 8 <= e) {
-            if ((c0 = tb[(uint8)b[0]])) { c = c0; return b; }
-            if ((c1 = tb[(uint8)b[1]])) { c = c1; return b + 1; }
-            if ((c2 = tb[(uint8)b[2]])) { c = c2; return b + 2; }
-            if ((c3 = tb[(uint8)b[3]])) { c = c3; return b + 3; }
-            if ((c4 = tb[(uint8)b[4]])) { c = c4; return b + 4; }
-            if ((c5 = tb[(uint8)b[5]])) { c = c5; return b + 5; }
-            if ((c6 = tb[(uint8)b[6]])) { c = c6; return b + 6; }
-            if ((c7 = tb[(uint8)b[7]])) { c = c7; return b + 7; }
-            b += 8;
-        } else {
-            if (b + 4 <= e) {
-                if ((c0 = tb[(uint8)b[0]])) { c = c0; return b; }
-                if ((c1 = tb[(uint8)b[1]])) { c = c1; return b + 1; }
-                if ((c2 = tb[(uint8)b[2]])) { c = c2; return b + 2; }
-                if ((c3 = tb[(uint8)b[3]])) { c = c3; return b + 3; }
-                b += 4;
-            }
-            for (; b < e; ++b) {
-                if ((c = tb[(uint8)*b])) return b;
+void Json::_own_strings(uint32 index) {
+    _Header* h = (_Header*) _p8(index);
+    if (h->type == kString) {
+        if (h->ext) {
+            const uint32 n = h->size;
+            const uint32 body = _make_raw_string(h->s, n); // h may be moved
+            h = (_Header*) _p8(index);
+            h->ext = 0;
+            h->index = body;
+        }
+    } else if (h->type & (kObject | kArray)) {
+        const uint32 step = (h->type == kObject ? 2 : 1);
+        for (uint32 k = h->index; k != 0;) {
+            const uint32 size = ((xx::Queue*) _p8(k))->size;
+            for (uint32 i = step - 1; i < size; i += step) {
+                _own_strings(((xx::Queue*) _p8(k))->p[i]);
             }
-            return e;
+            k = ((xx::Queue*) _p8(k))->next;
         }
     }
-#else
-    for (const char* p = b; p < e; ++p) {
-        if ((c = tb[(uint8)*p])) return p;
-    }
-    return e;
-#endif
 }
 
-fastream& Json::_Json2str(fastream& fs, bool debug, uint32 index) const {
-    _Header* h = (_Header*) _p8(index);
-    if (h->type == kString) {
-        fs << '"';
-        const uint32 len = h->size;
-        const bool trunc = debug && len > 512;
-        const char* s = (const char*) _p8(h->index);
-        const char* e = trunc ? s + 32 : s + len;
+// The file is mapped privately, strings are terminated in the mapped pages, 
+// which are copied on write, and the file is not modified. 
+namespace xx {
 
-        char c;
-        for (const char* p; (p = find_escapse(s, e, c)) < e;) {
-            fs.append(s, p - s).append('\\').append(c);
-            s = p + 1;
-        }
+struct File : Extern {
+    char* p;
+    size_t n;
+};
 
-        if (s != e) fs.append(s, e - s);
-        if (trunc) fs.append(3, '.');
-        fs << '"';
+static void release_file(Extern* x) {
+    File* f = (File*)x;
+  #ifdef _WIN32
+    free(f->p);
+  #else
+    ::munmap(f->p, f->n);
+  #endif
+    delete f;
+}
 
-    } else if (h->type == kObject) {
-        fs << '{';
-        for (uint32 k = h->index; k != 0;) {
-            xx::Queue* a = (xx::Queue*) _p8(k);
-            for (uint32 i = 0; i < a->size; i += 2) {
-                fs << '"' << (const char*)_p8(a->p[i]) << '"' << ':'; // key
-                _Json2str(fs, debug, a->p[i + 1]) << ',';             // value
-            }
-            k = a->next;
-        }
-        if (fs.back() == ',') fs.back() = '}';
-        else fs << '}';
+static File* map_file(const char* path) {
+  #ifdef _WIN32
+    fs::file f;
+    if (!f.open(path, 'r')) return 0;
+    const size_t n = (size_t) f.size();
+    if (n == 0) return 0;
+    char* p = (char*) malloc(n);
+    if (f.read(p, n) != n) { free(p); return 0; }
+  #else
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) { ::close(fd); return 0; }
+    const size_t n = (size_t) st.st_size;
+    void* m = ::mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return 0;
+    char* p = (char*) m;
+  #endif
+    File* f = new File;
+    f->refn = 1;
+    f->release = release_file;
+    f->p = p;
+    f->n = n;
+    return f;
+}
 
-    } else if (h->type == kArray) {
-        fs << '[';
-        for (uint32 k = h->index; k != 0;) {
-            xx::Queue* a = (xx::Queue*) _p8(k);
-            for (uint32 i = 0; i < a->size; ++i) {
-                _Json2str(fs, debug, a->p[i]) << ',';
-            }
-            k = a->next;
-        }
-        if (fs.back() == ',') fs.back() = ']';
-        else fs << ']';
+} // xx
 
+bool Json::parse_file(const char* path) {
+    xx::File* f = xx::map_file(path);
+    const size_t n = f ? f->n : 0;
+    if (_mem == 0) {
+        _mem = xx::jalloc()->alloc_jblock(_b8(n >> 1));
     } else {
-        if (h->type == kInt) {
-            fs << h->i;
-        } else if (h->type == kBool) {
-            fs << h->b;
-        } else if (h->type == kDouble) {
-            fs << h->d;
-        } else {
-            assert(h->type == kNull);
-            fs << "null";
-        }
+        _jb.clear();
+        _jb.reserve(_b8(n >> 1));
     }
-    return fs;
+    if (f == 0) return false;
+
+    _jb.set_ext(f);
+    Parser parser(this, true);
+    return parser.parse(f->p, f->p + n);
 }
 
-// @indent:  4 spaces by default
-// @n:       number of spaces to insert at the beginning for the current line
-fastream& Json::_Json2pretty(fastream& fs, int indent, int n, uint32 index) const {
-    _Header* h = (_Header*) _p8(index);
-    if (h->type == kObject) {
-        fs << '{';
-        for (uint32 k = h->index; k != 0;) {
-            xx::Queue* a = (xx::Queue*) _p8(k);
-            for (uint32 i = 0; i < a->size; i += 2) {
-                fs.append('\n').append(n, ' ');
-                fs << '"' << (const char*)_p8(a->p[i]) << '"' << ": ";    // key
-                _Json2pretty(fs, indent, n + indent, a->p[i + 1]) << ','; // value
-            }
-            k = a->next;
-        }
-        if (fs.back() == ',') fs.back() = '\n';
-        if (n > indent) fs.append(n - indent, ' ');
-        fs << '}';
+// MessagePack decoder
+//   @b: beginning of the data
+//   @e: end of the data
+class MsgpackParser {
+  public:
+    MsgpackParser(Json* root) : _root(root) {}
+    ~MsgpackParser() = default;
 
-    } else if (h->type == kArray) {
-        fs << '[';
-        for (uint32 k = h->index; k != 0;) {
-            xx::Queue* a = (xx::Queue*) _p8(k);
-            for (uint32 i = 0; i < a->size; ++i) {
-                fs.append('\n').append(n, ' ');
-                _Json2pretty(fs, indent, n + indent, a->p[i]) << ',';
-            }
-            k = a->next;
+    bool parse(const uint8* b, const uint8* e);
+
+  private:
+    Json* _root;
+};
+
+// read a big endian unsigned integer of n bytes
+inline uint64 load_be(const uint8* p, int n) {
+    uint64 v = 0;
+    for (int i = 0; i < n; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+// This is also a non-recursive implement. A container is closed when all its
+// elements are decoded, as the number of elements is known at the beginning.
+// stack: |prev size|prev remain|prev state|index|....
+bool MsgpackParser::parse(const uint8* b, const uint8* e) {
+    uint32 state = 0, remain = 0, size = 0, val, index;
+    uint64 n;
+    int64 i;
+    uint8 c;
+    xx::Stack& s = xx::jalloc()->alloc_stack();
+
+  val_beg:
+    if (b == e) goto err;
+    c = *b++;
+    if (state == '{' && !(remain & 1)) goto key_beg;
+
+    if (c <= 0x7f) { val = _root->_make_int(c); goto val_end; }
+    if (c >= 0xe0) { val = _root->_make_int((int8)c); goto val_end; }
+    if ((c & 0xe0) == 0xa0) { n = c & 0x1f; goto str_beg; }
+    if ((c & 0xf0) == 0x90) { n = c & 0x0f; goto arr_beg; }
+    if ((c & 0xf0) == 0x80) { n = c & 0x0f; goto obj_beg; }
+
+    switch (c) {
+      case 0xc0:
+        val = _root->_make_null();
+        goto val_end;
+      case 0xc2:
+      case 0xc3:
+        val = _root->_make_bool(c == 0xc3);
+        goto val_end;
+      case 0xcc: case 0xcd: case 0xce: case 0xcf: // uint 8/16/32/64
+        n = (size_t)1 << (c - 0xcc);
+        if ((size_t)(e - b) < n) goto err;
+        val = _root->_make_int((int64)load_be(b, (int)n));
+        b += n;
+        goto val_end;
+      case 0xd0: case 0xd1: case 0xd2: case 0xd3: // int 8/16/32/64
+        n = (size_t)1 << (c - 0xd0);
+        if ((size_t)(e - b) < n) goto err;
+        i = (int64)load_be(b, (int)n);
+        if (n < 8) i = (i ^ ((int64)1 << (n * 8 - 1))) - ((int64)1 << (n * 8 - 1)); // sign extend
+        val = _root->_make_int(i);
+        b += n;
+        goto val_end;
+      case 0xca: // float 32
+        {
+            if (e - b < 4) goto err;
+            uint32 u = (uint32)load_be(b, 4);
+            float f;
+            memcpy(&f, &u, 4);
+            val = _root->_make_double(f);
+            b += 4;
         }
-        if (fs.back() == ',') fs.back() = '\n';
-        if (n > indent) fs.append(n - indent, ' ');
-        fs << ']';
+        goto val_end;
+      case 0xcb: // float 64
+        {
+            if (e - b < 8) goto err;
+            uint64 u = load_be(b, 8);
+            double d;
+            memcpy(&d, &u, 8);
+            val = _root->_make_double(d);
+            b += 8;
+        }
+        goto val_end;
+      case 0xd9: case 0xda: case 0xdb: // str 8/16/32
+        c -= 0xd9;
+        goto str_len;
+      case 0xc4: case 0xc5: case 0xc6: // bin 8/16/32
+        c -= 0xc4;
+        goto str_len;
+      case 0xdc: case 0xdd: // array 16/32
+        if (e - b < (c == 0xdc ? 2 : 4)) goto err;
+        n = load_be(b, c == 0xdc ? 2 : 4);
+        b += (c == 0xdc ? 2 : 4);
+        goto arr_beg;
+      case 0xde: case 0xdf: // map 16/32
+        if (e - b < (c == 0xde ? 2 : 4)) goto err;
+        n = load_be(b, c == 0xde ? 2 : 4);
+        b += (c == 0xde ? 2 : 4);
+        goto obj_beg;
+      default:
+        goto err;
+    }
 
+  key_beg:
+    if ((c & 0xe0) == 0xa0) {
+        n = c & 0x1f;
+    } else if (c >= 0xd9 && c <= 0xdb) {
+        c -= 0xd9;
+        if (e - b < (1 << c)) goto err;
+        n = load_be(b, 1 << c);
+        b += (1 << c);
     } else {
-        _Json2str(fs, false, index);
+        goto err;
     }
-    return fs;
-}
+    if ((uint64)(e - b) < n) goto err;
+    val = _root->_make_key((const char*)b, (size_t)n);
+    b += n;
+    goto val_end;
+
+  str_len: // c is 0, 1, 2 for the length in 1, 2, 4 bytes
+    if (e - b < (1 << c)) goto err;
+    n = load_be(b, 1 << c);
+    b += (1 << c);
+
+  str_beg:
+    if ((uint64)(e - b) < n) goto err;
+    val = _root->_make_string((const char*)b, (size_t)n);
+    b += n;
+    goto val_end;
 
-void Json::_add_member(uint32 key, uint32 val, uint32 index) {
-    _Header* h = (_Header*)_p8(index);
-    if (h->type != kNull) {
-        assert(h->type == kObject);
-        if (h->index == 0) goto empty;
+  arr_beg:
+    if (n == 0) { val = _root->_make_array(); goto val_end; }
+    if ((uint64)(e - b) < n) goto err; // an element takes at least 1 byte
+    s.push(size);
+    s.push(remain);
+    s.push(state);
+    s.push(_root->_make_array());
+    size = s.size;
+    remain = (uint32)n;
+    state = '[';
+    goto val_beg;
 
-        for (uint32 q = h->index;;) {
-            xx::Queue* a = (xx::Queue*) _p8(q);
-            if (!a->next) {
-                if (!a->full()) {
-                    a->push(key, val);
+  obj_beg:
+    if (n == 0) { val = _root->_make_object(); goto val_end; }
+    if ((uint64)(e - b) < n * 2) goto err;
+    s.push(size);
+    s.push(remain);
+    s.push(state);
+    s.push(_root->_make_object());
+    size = s.size;
+    remain = (uint32)(n * 2);
+    state = '{';
+    goto val_beg;
+
+  val_end:
+    if (state == 0) goto end;
+    s.push(val);
+    if (--remain != 0) goto val_beg;
+
+    {
+        const uint32 n = s.size - size;
+        index = _root->_alloc_queue((char*)(s.p + size), n << 2);
+        s.size = size;
+        val = s.pop();
+        ((Json::_Header*)_root->_p8(val))->index = index;
+        _root->_index_object(val, n);
+    }
+    state = s.pop();
+    remain = s.pop();
+    size = s.pop();
+    goto val_end;
+
+  end:
+    s.reset();
+    return b == e;
+  err:
+    s.reset();
+    return false;
+}
+
+bool Json::parse_msgpack(const char* s, size_t n) {
+    if (_mem == 0) {
+        _mem = xx::jalloc()->alloc_jblock(_b8(n * 2));
+    } else {
+        _jb.clear();
+        _jb.reserve(_b8(n * 2));
+    }
+    MsgpackParser parser(this);
+    return parser.parse((const uint8*)s, (const uint8*)s + n);
+}
+
+inline bool is_literal(const char* b, const char* e, const char* x, size_t n) {
+    return (size_t)(e - b) >= n && memcmp(b, x, n) == 0;
+}
+
+// skip a value beginning at b without parsing it, return position of the 
+// last char of the value, or NULL on any error. Objects and arrays are only 
+// checked for balanced brackets and quotes.
+static const char* skip_value(const char* b, const char* e) {
+    int64 i;
+    double d;
+    bool dbl;
+    switch (*b) {
+      case '"':
+      case '{':
+      case '[':
+        break;
+      case 't':
+        return is_literal(b, e, "true", 4) ? b + 3 : 0;
+      case 'f':
+        return is_literal(b, e, "false", 5) ? b + 4 : 0;
+      case 'n':
+        return is_literal(b, e, "null", 4) ? b + 3 : 0;
+      default:
+        return scan_number(b, e, i, d, dbl);
+    }
+
+    int depth = 0;
+    const char* p = b;
+    do {
+        if (*p == '"') {
+            do {
+                p = find_quote_or_backslash(p + 1, e);
+                if (p == e) return 0;
+                if (*p == '"') break;
+                if (++p == e) return 0; // skip the escaped char
+            } while (true);
+            if (depth == 0) return p;
+        } else if (*p == '{' || *p == '[') {
+            ++depth;
+        } else if (--depth == 0) {
+            return p;
+        }
+        p = find_bracket(p + 1, e);
+    } while (p != e);
+    return 0;
+}
+
+// SAX parser, it walks the document as Parser::parse() does, but reports 
+// the values to the handler instead of building a Json.
+// stack: |prev state|....
+bool parse(const char* s, size_t n, Handler& h) {
+    const char* b = s;
+    const char* const e = s + n;
+    const char* x;
+    size_t len;
+    int64 i;
+    double d;
+    bool dbl;
+    int r;
+    uint32 state = 0;
+    xx::Stack st(16);
+
+    b = find_non_white_space(b, e);
+    if (b == e) return false;
+
+  val_beg: // b is at the first char of a value
+    if (*b == '{') {
+        r = h.start_object();
+        if (r != Handler::kGoOn) goto skip;
+        st.push(state);
+        state = '{';
+        skip_white_space(b, e);
+        if (b == e) goto err;
+        if (*b == '}') goto obj_end;
+        goto key_beg;
+    }
+
+    if (*b == '[') {
+        r = h.start_array();
+        if (r != Handler::kGoOn) goto skip;
+        st.push(state);
+        state = '[';
+        skip_white_space(b, e);
+        if (b == e) goto err;
+        if (*b == ']') goto arr_end;
+        goto val_beg;
+    }
+
+    if (*b == '"') {
+        b = scan_string(b, e, x, len);
+        if (b == 0) goto err;
+        r = h.string_value(x, len);
+    } else if (*b == 't') {
+        if (!is_literal(b, e, "true", 4)) goto err;
+        b += 3;
+        r = h.bool_value(true);
+    } else if (*b == 'f') {
+        if (!is_literal(b, e, "false", 5)) goto err;
+        b += 4;
+        r = h.bool_value(false);
+    } else if (*b == 'n') {
+        if (!is_literal(b, e, "null", 4)) goto err;
+        b += 3;
+        r = h.null_value();
+    } else {
+        b = scan_number(b, e, i, d, dbl);
+        if (b == 0) goto err;
+        r = dbl ? h.double_value(d) : h.int_value(i);
+    }
+    if (r == Handler::kStop) return true;
+
+  val_end: // b is at the last char of a value
+    if (state == 0) goto end;
+    skip_white_space(b, e);
+    if (b == e) goto err;
+    if (*b == ',') { // a trailing comma is allowed, as Parser does
+        skip_white_space(b, e);
+        if (b == e) goto err;
+        if (state == '[') {
+            if (*b == ']') goto arr_end;
+            goto val_beg;
+        }
+        if (*b == '}') goto obj_end;
+        goto key_beg;
+    }
+    if (state == '{' && *b == '}') goto obj_end;
+    if (state == '[' && *b == ']') goto arr_end;
+    goto err;
+
+  key_beg: // b is at the first char of a key
+    if (*b != '"') goto err;
+    x = b + 1;
+    b = find_quote(x, e);
+    if (b == e) goto err;
+    r = h.key(x, b - x);
+    if (r == Handler::kStop) return true;
+
+    skip_white_space(b, e);
+    if (b == e || *b != ':') goto err;
+    skip_white_space(b, e);
+    if (b == e) goto err;
+    if (r == Handler::kGoOn) goto val_beg;
+    b = skip_value(b, e);
+    if (b == 0) goto err;
+    goto val_end;
+
+  skip: // r is the result of start_object() or start_array()
+    if (r == Handler::kStop) return true;
+    b = skip_value(b, e);
+    if (b == 0) goto err;
+    goto val_end;
+
+  obj_end:
+    r = h.end_object();
+    goto close;
+
+  arr_end:
+    r = h.end_array();
+
+  close:
+    if (r == Handler::kStop) return true;
+    state = st.pop(); // prev state
+    goto val_end;
+
+  end:
+    skip_white_space(b, e);
+    return b == e;
+
+  err:
+    return false;
+}
+
+// find the closing quote of a string beginning at b, escapes are checked
+// but not decoded, return NULL on any error
+inline const char* skip_string(const char* b, const char* e) {
+    static const char* tb = init_s2e_table();
+    do {
+        b = find_quote_or_backslash(b + 1, e);
+        if (b == e) return 0;
+        if (*b == '"') return b;
+        if (++b == e || tb[(uint8)*b] == 0) return 0;
+    } while (true);
+}
+
+inline bool is_value_end(const char* p, const char* e) {
+    return p == e || *p == ',' || *p == ']' || *p == '}' || is_white_space(*p);
+}
+
+// Bit masks of a 64-byte block for the structural index of Lazy, bit i is 
+// for the i-th byte: 
+//   bs:  '\\'
+//   q:   '"'
+//   op:  '{' or '['
+//   cl:  '}' or ']'
+struct Masks {
+    uint64 bs, q, op, cl;
+};
+
+#ifdef JSON_SSE2
+inline void sse2_masks(const char* b, Masks& m) {
+    m.bs = m.q = m.op = m.cl = 0;
+    for (int i = 0; i < 4; ++i) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(b + 16 * i));
+        const __m128i y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        m.bs |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))) << (16 * i);
+        m.q  |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"'))) << (16 * i);
+        m.op |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(y, _mm_set1_epi8('{'))) << (16 * i);
+        m.cl |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(y, _mm_set1_epi8('}'))) << (16 * i);
+    }
+}
+
+#ifdef JSON_AVX2
+JSON_AVX2_FN inline void avx2_masks(const char* b, Masks& m) {
+    m.bs = m.q = m.op = m.cl = 0;
+    for (int i = 0; i < 2; ++i) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(b + 32 * i));
+        const __m256i y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        m.bs |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))) << (32 * i);
+        m.q  |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"'))) << (32 * i);
+        m.op |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(y, _mm256_set1_epi8('{'))) << (32 * i);
+        m.cl |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(y, _mm256_set1_epi8('}'))) << (32 * i);
+    }
+}
+
+inline void get_masks(const char* b, Masks& m) {
+    g_avx2 ? avx2_masks(b, m) : sse2_masks(b, m);
+}
+#else
+inline void get_masks(const char* b, Masks& m) {
+    sse2_masks(b, m);
+}
+#endif
+
+#else
+inline void get_masks(const char* b, Masks& m) {
+    m.bs = m.q = m.op = m.cl = 0;
+    for (int i = 0; i < 64; ++i) {
+        const uint64 x = (uint64)1 << i;
+        const char c = b[i];
+        if (c == '\\') m.bs |= x;
+        else if (c == '"') m.q |= x;
+        else if ((c | 0x20) == '{') m.op |= x;
+        else if ((c | 0x20) == '}') m.cl |= x;
+    }
+}
+#endif
+
+inline int ctz(uint64 x) {
+  #ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+  #else
+    return __builtin_ctzll(x);
+  #endif
+}
+
+// chars escaped by an odd number of backslashes before them, @prev is 1 if 
+// the previous block ended with an odd number of backslashes
+inline uint64 find_escaped(uint64 bs, uint64& prev) {
+    const uint64 even = 0x5555555555555555ULL;
+    const uint64 starts = bs & ~(bs << 1);
+    const uint64 even_start_mask = even ^ prev;
+    const uint64 even_starts = starts & even_start_mask;
+    const uint64 odd_starts = starts & ~even_start_mask;
+    const uint64 even_carries = bs + even_starts;
+    uint64 odd_carries = bs + odd_starts;
+    const uint64 ends_odd = odd_carries < bs; // carry out of bit 63
+    odd_carries |= prev;
+    prev = ends_odd;
+    return ((even_carries & ~bs) & ~even) | ((odd_carries & ~bs) & even);
+}
+
+// bit i is set if there are odd number of bits set in [0, i] of x
+inline uint64 prefix_xor(uint64 x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Brackets out of strings are indexed 64 bytes at a time:
+//   - quotes escaped are removed by find_escaped(),
+//   - bytes in strings are marked by prefix_xor() of the quotes,
+//   - brackets not in strings are matched by a stack.
+bool Lazy::parse_from(const char* s, size_t n) {
+    const char* const e = s + n;
+    uint64 prev_esc = 0, prev_in_str = 0;
+    Masks m;
+    char buf[64];
+    xx::Stack st(16);
+
+    _s = s;
+    _n = (uint32)n;
+    _root = kNone;
+    _idx.clear();
+    if (n >= (size_t)kNone) return false;
+
+    for (size_t base = 0; base < n; base += 64) {
+        const char* b = s + base;
+        if (base + 64 > n) {
+            memset(buf, ' ', 64);
+            memcpy(buf, b, n - base);
+            b = buf;
+        }
+        get_masks(b, m);
+
+        const uint64 q = m.q & ~find_escaped(m.bs, prev_esc);
+        const uint64 in_str = prefix_xor(q) ^ prev_in_str;
+        prev_in_str = (uint64)((int64)in_str >> 63);
+
+        for (uint64 x = (m.op | m.cl) & ~in_str; x; x &= x - 1) {
+            const uint64 bit = x & (0 - x);
+            const uint32 cur = (uint32)_idx.size();
+            const uint32 pos = (uint32)(base + ctz(x));
+            if (m.op & bit) {
+                st.push(cur);
+                _idx.push_back(Bracket{ pos, 0 });
+            } else {
+                if (st.size == 0) return false;
+                const uint32 o = st.pop();
+                if (s[pos] != s[_idx[o].pos] + 2) return false; // '[' + 2 is ']', '{' + 2 is '}'
+                _idx[o].match = cur;
+                _idx.push_back(Bracket{ pos, o });
+            }
+        }
+    }
+    if (prev_in_str || st.size != 0) return false;
+
+    // the root value must be followed only by white spaces
+    const char* p = find_non_white_space(s, e);
+    if (p == e) return false;
+    if (*p == '{' || *p == '[') {
+        if (_idx[0].pos != (uint32)(p - s) || _idx[0].match + 1 != _idx.size()) return false;
+        p = s + _idx.back().pos + 1;
+    } else {
+        if (!_idx.empty()) return false;
+        p = skip_value(p, e);
+        if (p == 0) return false;
+        ++p;
+    }
+    if (find_non_white_space(p, e) != e) return false;
+    _root = (uint32)(find_non_white_space(s, e) - s);
+    return true;
+}
+
+// skip the value at p, @k is the index of the first bracket at or after p,
+// return position after the value, or NULL on any error. @k is updated.
+//   - A malformed scalar is skipped to the first char that may end it, and 
+//     never past a bracket or a quote, so @k stays in step with p. The caller 
+//     rejects the value if it is not followed by ',' or the closing bracket.
+const char* Lazy::_skip(const char* p, uint32& k) const {
+    const char* const e = _s + _n;
+    if (*p == '{' || *p == '[') {
+        if (k >= _idx.size() || _idx[k].pos != (uint32)(p - _s)) return 0;
+        const uint32 m = _idx[k].match;
+        k = m + 1;
+        return _s + _idx[m].pos + 1;
+    }
+    if (*p == '"') {
+        p = skip_string(p, e);
+        return p ? p + 1 : 0;
+    }
+    while (!is_value_end(p, e) && *p != '{' && *p != '[' && *p != '"') ++p;
+    return p;
+}
+
+char Lazy::_type(uint32 pos) const {
+    if (pos == kNone) return 'n';
+    const char* b = _s + pos;
+    const char* const e = _s + _n;
+    switch (*b) {
+      case '{':
+      case '[':
+      case '"':
+        return *b;
+      case 't':
+        return is_literal(b, e, "true", 4) && is_value_end(b + 4, e) ? 't' : 'n';
+      case 'f':
+        return is_literal(b, e, "false", 5) && is_value_end(b + 5, e) ? 't' : 'n';
+      default:
+        bool dbl;
+        const char* p = check_number(b, e, dbl);
+        if (p == 0 || !is_value_end(p, e)) return 'n';
+        return dbl ? 'd' : 'i';
+    }
+}
+
+bool Lazy::_get_bool(uint32 pos) const {
+    return this->_type(pos) == 't' && _s[pos] == 't';
+}
+
+int64 Lazy::_get_int64(uint32 pos) const {
+    if (this->_type(pos) != 'i') return 0;
+    int64 i = 0;
+    double d;
+    bool dbl;
+    scan_number(_s + pos, _s + _n, i, d, dbl);
+    return i;
+}
+
+double Lazy::_get_double(uint32 pos) const {
+    if (this->_type(pos) != 'd') return 0.0;
+    int64 i;
+    double d;
+    bool dbl;
+    if (scan_number(_s + pos, _s + _n, i, d, dbl) == 0) return 0.0;
+    return d;
+}
+
+fastring Lazy::_get_string(uint32 pos) const {
+    if (pos == kNone || _s[pos] != '"') return fastring();
+    const char* x;
+    size_t n;
+    if (scan_string(_s + pos, _s + _n, x, n) == 0) return fastring();
+    return fastring(x, n);
+}
+
+Lazy::Value Lazy::_at(uint32 i, uint32 pos, uint32 k) const {
+    if (pos == kNone || _s[pos] != '[') return Value(this, kNone, 0);
+    const char* const e = _s + _n;
+    const char* p = find_non_white_space(_s + pos + 1, e);
+    if (*p == ']') return Value(this, kNone, 0);
+    ++k;
+
+    do {
+        if (i-- == 0) return Value(this, (uint32)(p - _s), k);
+        p = this->_skip(p, k);
+        if (p == 0) break;
+        p = find_non_white_space(p, e);
+        if (p == e || *p != ',') break;
+        p = find_non_white_space(p + 1, e);
+        if (p == e) break;
+    } while (true);
+    return Value(this, kNone, 0);
+}
+
+// keys are compared in the text, escapes are not decoded, as Json does
+Lazy::Value Lazy::_at(Key key, uint32 pos, uint32 k) const {
+    if (pos == kNone || _s[pos] != '{') return Value(this, kNone, 0);
+    const char* const e = _s + _n;
+    const size_t n = strlen(key);
+    const char* p = find_non_white_space(_s + pos + 1, e);
+    ++k;
+
+    while (*p == '"') {
+        const char* q = skip_string(p, e);
+        if (q == 0) break;
+        const bool hit = (size_t)(q - p - 1) == n && memcmp(p + 1, key, n) == 0;
+        p = find_non_white_space(q + 1, e);
+        if (p == e || *p != ':') break;
+        p = find_non_white_space(p + 1, e);
+        if (p == e) break;
+        if (hit) return Value(this, (uint32)(p - _s), k);
+
+        p = this->_skip(p, k);
+        if (p == 0) break;
+        p = find_non_white_space(p, e);
+        if (p == e || *p != ',') break;
+        p = find_non_white_space(p + 1, e);
+        if (p == e) break;
+    }
+    return Value(this, kNone, 0);
+}
+
+uint32 Lazy::_size(uint32 pos, uint32 k) const {
+    if (pos == kNone) return 0;
+    const char c = _s[pos];
+    if (c == '"') return (uint32)this->_get_string(pos).size();
+    if (c != '{' && c != '[') return 0;
+
+    const char* const e = _s + _n;
+    const char* p = find_non_white_space(_s + pos + 1, e);
+    uint32 n = 0;
+    ++k;
+    while (*p != c + 2) {
+        if (c == '{') { // skip the key
+            if (*p != '"' || (p = skip_string(p, e)) == 0) return 0;
+            p = find_non_white_space(p + 1, e);
+            if (p == e || *p != ':') return 0;
+            p = find_non_white_space(p + 1, e);
+            if (p == e) return 0;
+        }
+        p = this->_skip(p, k);
+        if (p == 0) return 0;
+        ++n;
+        p = find_non_white_space(p, e);
+        if (p == e) return 0;
+        if (*p == ',') {
+            p = find_non_white_space(p + 1, e);
+        } else if (*p != c + 2) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+fastring Lazy::_str(uint32 pos, uint32 k) const {
+    if (pos == kNone) return fastring("null");
+    const char* b = _s + pos;
+    const char* p = this->_skip(b, k);
+    return p ? fastring(b, p - b) : fastring("null");
+}
+
+namespace {
+enum {
+    kValue,        // a value
+    kValueOrEnd,   // a value or ']'
+    kKey,          // a key
+    kKeyOrEnd,     // a key or '}'
+    kColon,        // ':'
+    kCommaOrEnd,   // ',' or end of the current array or object
+    kDone,         // the document is complete
+};
+
+enum {
+    kTokString = 1,
+    kTokKey = 2,
+    kTokNumber = 3,
+    kTokLiteral = 4, // true, false, null
+};
+
+inline bool is_number_char(char c) {
+    return ('0' <= c && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+inline bool is_literal_char(char c) {
+    return 'a' <= c && c <= 'z';
+}
+
+// find the closing quote of a string, @esc is true if the last byte scanned 
+// is a backslash, return e if not found
+inline const char* find_string_end(const char* b, const char* e, bool& esc) {
+    if (esc) {
+        if (b == e) return e;
+        ++b;
+        esc = false;
+    }
+    for (;;) {
+        const char* p = find_quote_or_backslash(b, e);
+        if (p == e || *p == '"') return p;
+        if (p + 1 == e) { esc = true; return e; }
+        b = p + 2;
+    }
+}
+} // namespace
+
+void StreamParser::reset() {
+    if (_root._mem == 0) {
+        _root._mem = xx::jalloc()->alloc_jblock();
+    } else {
+        _root._jb.clear();
+    }
+    _s.reset();
+    _tok.clear();
+    _state = 0;
+    _size = 0;
+    _expect = kValue;
+    _tok_type = 0;
+    _esc = false;
+    _err = false;
+}
+
+int StreamParser::feed(const char* s, size_t n) {
+    if (_err) return -1;
+    const char* b = s;
+    const char* const e = s + n;
+
+    if (_tok_type) {
+        b = this->_continue_token(b, e);
+        if (b == 0) goto err;
+        if (_tok_type) return 0;
+    }
+
+    for (;;) {
+        b = find_non_white_space(b, e);
+        if (b == e) return _expect == kDone ? 1 : 0;
+
+        const char c = *b;
+        switch (_expect) {
+          case kCommaOrEnd:
+            if (c == ',') { // a trailing comma is allowed, as Parser does
+                _expect = (_state == '{' ? kKeyOrEnd : kValueOrEnd);
+                ++b;
+                continue;
+            }
+            if (c != (_state == '{' ? '}' : ']')) goto err;
+            this->_close();
+            ++b;
+            continue;
+
+          case kColon:
+            if (c != ':') goto err;
+            _expect = kValue;
+            ++b;
+            continue;
+
+          case kKeyOrEnd:
+            if (c == '}') { this->_close(); ++b; continue; }
+            // fall through
+          case kKey:
+            if (c != '"') goto err;
+            b = this->_start_token(kTokKey, b, e);
+            break;
+
+          case kValueOrEnd:
+            if (c == ']') { this->_close(); ++b; continue; }
+            // fall through
+          case kValue:
+            if (c == '{' || c == '[') {
+                this->_open(c == '{');
+                ++b;
+                continue;
+            }
+            if (c == '"') {
+                b = this->_start_token(kTokString, b, e);
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                b = this->_start_token(kTokLiteral, b, e);
+            } else {
+                b = this->_start_token(kTokNumber, b, e);
+            }
+            break;
+
+          default: // kDone
+            goto err;
+        }
+
+        if (b == 0) goto err;
+        if (_tok_type) return 0; // the token is not complete
+    }
+
+  err:
+    _err = true;
+    return -1;
+}
+
+bool StreamParser::finish() {
+    if (_err) return false;
+    if (_tok_type == kTokNumber || _tok_type == kTokLiteral) {
+        const uint32 type = _tok_type;
+        _tok_type = 0;
+        if (!this->_on_token(_tok.data(), _tok.data() + _tok.size(), type)) {
+            _err = true;
+            return false;
+        }
+    }
+    return _tok_type == 0 && _expect == kDone;
+}
+
+// Parse the token directly if it is complete in [b, e), or save it to _tok.
+// Return the position after the token, or NULL on error.
+const char* StreamParser::_start_token(uint32 type, const char* b, const char* e) {
+    const char* p;
+    if (type == kTokString || type == kTokKey) {
+        _esc = false;
+        p = find_string_end(b + 1, e, _esc);
+        if (p != e) return this->_on_token(b, p + 1, type) ? p + 1 : 0;
+    } else {
+        p = b;
+        if (type == kTokNumber) {
+            while (p < e && is_number_char(*p)) ++p;
+        } else {
+            while (p < e && is_literal_char(*p)) ++p;
+        }
+        if (p == b) return 0;
+        if (p != e) return this->_on_token(b, p, type) ? p : 0;
+    }
+
+    _tok.clear();
+    _tok.append(b, e - b);
+    _tok_type = type;
+    return e;
+}
+
+const char* StreamParser::_continue_token(const char* b, const char* e) {
+    const char* p;
+    if (_tok_type == kTokString || _tok_type == kTokKey) {
+        p = find_string_end(b, e, _esc);
+        if (p == e) { _tok.append(b, e - b); return e; }
+        _tok.append(b, p + 1 - b);
+        ++p;
+    } else {
+        p = b;
+        if (_tok_type == kTokNumber) {
+            while (p < e && is_number_char(*p)) ++p;
+        } else {
+            while (p < e && is_literal_char(*p)) ++p;
+        }
+        _tok.append(b, p - b);
+        if (p == e) return e;
+    }
+
+    const uint32 type = _tok_type;
+    _tok_type = 0;
+    return this->_on_token(_tok.data(), _tok.data() + _tok.size(), type) ? p : 0;
+}
+
+// [b, e) is a complete token
+bool StreamParser::_on_token(const char* b, const char* e, uint32 type) {
+    Parser parser(&_root);
+    uint32 val;
+    const char* p;
+
+    switch (type) {
+      case kTokKey:
+        p = parser.parse_key(b, e, val);
+        if (p != e - 1) return false;
+        _s.push(val);
+        _expect = kColon;
+        return true;
+      case kTokString:
+        p = parser.parse_string(b, e, val);
+        break;
+      case kTokNumber:
+        p = parser.parse_number(b, e, val);
+        break;
+      default:
+        if (*b == 't') {
+            p = parser.parse_true(b, e, val);
+        } else if (*b == 'f') {
+            p = parser.parse_false(b, e, val);
+        } else {
+            p = parser.parse_null(b, e, val);
+        }
+    }
+
+    if (p != e - 1) return false;
+    this->_on_value(val);
+    return true;
+}
+
+void StreamParser::_on_value(uint32 val) {
+    if (_state != 0) {
+        _s.push(val);
+        _expect = kCommaOrEnd;
+    } else {
+        _expect = kDone;
+    }
+}
+
+// stack: |prev size|prev state|index|...., the same as Parser::parse()
+void StreamParser::_open(bool object) {
+    _s.push(_size);
+    _s.push(_state);
+    _s.push(object ? _root._make_object() : _root._make_array());
+    _size = _s.size;
+    _state = object ? '{' : '[';
+    _expect = object ? kKeyOrEnd : kValueOrEnd;
+}
+
+void StreamParser::_close() {
+    uint32 val;
+    if (_s.size > _size) {
+        const uint32 n = _s.size - _size;
+        const uint32 index = _root._alloc_queue((char*)(_s.p + _size), n << 2);
+        _s.size = _size;
+        val = _s.pop();
+        ((Json::_Header*)_root._p8(val))->index = index;
+        _root._index_object(val, n);
+    } else {
+        val = _s.pop();
+    }
+
+    _state = _s.pop();
+    _size = _s.pop();
+    this->_on_value(val);
+}
+
+static inline const char* init_e2s_table() {
+    static char tb[256] = { 0 };
+    tb['\r'] = 'r';
+    tb['\n'] = 'n';
+    tb['\t'] = 't';
+    tb['\b'] = 'b';
+    tb['\f'] = 'f';
+    tb['\"'] = '"';
+    tb['\\'] = '\\';
+    return tb;
+}
+
+// Control chars other than \r\n\t\b\f are candidates, but not escaped.
+inline const char* find_escapse(const char* b, const char* e, char& c) {
+    static const char* tb = init_e2s_table();
+    for (;;) {
+        b = find_escape_candidate(b, e);
+        if (b == e || (c = tb[(uint8)*b])) return b;
+        ++b;
+    }
+}
+
+namespace xx {
+
+void write_string(fastream& fs, const char* s, size_t n) {
+    const char* const e = s + n;
+    char c = 0;
+    fs << '"';
+    for (const char* p; (p = find_escapse(s, e, c)) < e;) {
+        fs.append(s, p - s).append('\\').append(c);
+        s = p + 1;
+    }
+    if (s != e) fs.append(s, e - s);
+    fs << '"';
+}
+
+} // xx
+
+// The reader is always at the next char to read, or e. White spaces are 
+// skipped before a value or a structural char.
+#define skip_ws(b, e) \
+    if (b < e && is_white_space(*b)) b = find_non_white_space(b + 1, e)
+
+bool Reader::read(bool& v) {
+    skip_ws(_b, _e);
+    if (is_literal(_b, _e, "true", 4)) { v = true; _b += 4; return true; }
+    if (is_literal(_b, _e, "false", 5)) { v = false; _b += 5; return true; }
+    return false;
+}
+
+bool Reader::read(int64& v) {
+    skip_ws(_b, _e);
+    if (_b == _e) return false;
+    double d;
+    bool dbl;
+    const char* p = scan_number(_b, _e, v, d, dbl);
+    if (p == 0 || dbl) return false;
+    _b = p + 1;
+    return true;
+}
+
+// integers are also read as double
+bool Reader::read(double& v) {
+    skip_ws(_b, _e);
+    if (_b == _e) return false;
+    int64 i;
+    bool dbl;
+    const char* p = scan_number(_b, _e, i, v, dbl);
+    if (p == 0) return false;
+    if (!dbl) v = (double)i;
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::read(fastring& v) {
+    skip_ws(_b, _e);
+    if (_b == _e || *_b != '"') return false;
+    const char* s;
+    size_t n;
+    const char* p = scan_string(_b, _e, s, n);
+    if (p == 0) return false;
+    v.clear();
+    v.append(s, n);
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::read(std::string& v) {
+    skip_ws(_b, _e);
+    if (_b == _e || *_b != '"') return false;
+    const char* s;
+    size_t n;
+    const char* p = scan_string(_b, _e, s, n);
+    if (p == 0) return false;
+    v.assign(s, n);
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::null() {
+    skip_ws(_b, _e);
+    if (!is_literal(_b, _e, "null", 4)) return false;
+    _b += 4;
+    return true;
+}
+
+bool Reader::skip() {
+    skip_ws(_b, _e);
+    if (_b == _e) return false;
+    const char* p = skip_value(_b, _e);
+    if (p == 0) return false;
+    _b = p + 1;
+    return true;
+}
+
+bool Reader::_begin(char c) {
+    skip_ws(_b, _e);
+    if (_b == _e || *_b != c) return false;
+    ++_b;
+    _first = true;
+    return true;
+}
+
+int Reader::next_key(const char*& key, size_t& n) {
+    skip_ws(_b, _e);
+    if (_b == _e) return -1;
+    if (*_b == '}') {
+        ++_b;
+        _first = false;
+        return 0;
+    }
+    if (!_first) {
+        if (*_b != ',') return -1;
+        ++_b;
+        skip_ws(_b, _e);
+        if (_b == _e) return -1;
+        if (*_b == '}') { // a trailing comma is allowed, as json::parse() does
+            ++_b;
+            return 0;
+        }
+    }
+    if (*_b != '"') return -1;
+    const char* p = find_quote(_b + 1, _e);
+    if (p == _e) return -1;
+    key = _b + 1;
+    n = p - key;
+    _b = p + 1;
+    skip_ws(_b, _e);
+    if (_b == _e || *_b != ':') return -1;
+    ++_b;
+    _first = false;
+    return 1;
+}
+
+int Reader::next_element() {
+    skip_ws(_b, _e);
+    if (_b == _e) return -1;
+    if (*_b == ']') {
+        ++_b;
+        _first = false;
+        return 0;
+    }
+    if (!_first) {
+        if (*_b != ',') return -1;
+        ++_b;
+        skip_ws(_b, _e);
+        if (_b == _e) return -1;
+        if (*_b == ']') { // a trailing comma is allowed, as json::parse() does
+            ++_b;
+            return 0;
+        }
+    }
+    _first = false;
+    return 1;
+}
+
+bool Reader::end() {
+    skip_ws(_b, _e);
+    return _b == _e;
+}
+
+#undef skip_ws
+
+fastream& Json::_Json2str(fastream& fs, bool debug, uint32 index) const {
+    _Header* h = (_Header*) _p8(index);
+    if (h->type == kString) {
+        if (debug && h->size > 512) { // truncated as "xxx..."
+            xx::write_string(fs, _body(h), 32);
+            fs.back() = '.';
+            fs.append(2, '.') << '"';
+        } else {
+            xx::write_string(fs, _body(h), h->size);
+        }
+
+    } else if (h->type == kObject) {
+        fs << '{';
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; i += 2) {
+                fs << '"' << (const char*)_p8(a->p[i]) << '"' << ':'; // key
+                _Json2str(fs, debug, a->p[i + 1]) << ',';             // value
+            }
+            k = a->next;
+        }
+        if (fs.back() == ',') fs.back() = '}';
+        else fs << '}';
+
+    } else if (h->type == kArray) {
+        fs << '[';
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; ++i) {
+                _Json2str(fs, debug, a->p[i]) << ',';
+            }
+            k = a->next;
+        }
+        if (fs.back() == ',') fs.back() = ']';
+        else fs << ']';
+
+    } else {
+        if (h->type == kInt) {
+            fs << h->i;
+        } else if (h->type == kBool) {
+            fs << h->b;
+        } else if (h->type == kDouble) {
+            fs << h->d;
+        } else {
+            assert(h->type == kNull);
+            fs << "null";
+        }
+    }
+    return fs;
+}
+
+// append a MessagePack tag followed by v in n bytes, big endian
+inline void put_be(fastream& fs, uint8 tag, uint64 v, int n) {
+    char buf[9];
+    buf[0] = (char)tag;
+    for (int i = n; i > 0; --i, v >>= 8) buf[i] = (char)(v & 0xff);
+    fs.append(buf, n + 1);
+}
+
+// the smallest format of the integer
+inline void put_int(fastream& fs, int64 v) {
+    if (v >= 0) {
+        if (v <= 0x7f) fs.append((char)v);
+        else if (v <= 0xff) put_be(fs, 0xcc, v, 1);
+        else if (v <= 0xffff) put_be(fs, 0xcd, v, 2);
+        else if (v <= 0xffffffffLL) put_be(fs, 0xce, v, 4);
+        else put_be(fs, 0xcf, v, 8);
+    } else {
+        if (v >= -32) fs.append((char)v);
+        else if (v >= -128) put_be(fs, 0xd0, (uint8)v, 1);
+        else if (v >= -32768) put_be(fs, 0xd1, (uint16)v, 2);
+        else if (v >= -2147483647LL - 1) put_be(fs, 0xd2, (uint32)v, 4);
+        else put_be(fs, 0xd3, (uint64)v, 8);
+    }
+}
+
+// @fix: fixstr, fixarray or fixmap, followed by the 8(str only), 16, 32 formats
+inline void put_len(fastream& fs, uint8 fix, uint32 n) {
+    if (fix == 0xa0) {
+        if (n <= 0x1f) fs.append((char)(fix | n));
+        else if (n <= 0xff) put_be(fs, 0xd9, n, 1);
+        else if (n <= 0xffff) put_be(fs, 0xda, n, 2);
+        else put_be(fs, 0xdb, n, 4);
+    } else {
+        const uint8 x = (fix == 0x90 ? 0xdc : 0xde);
+        if (n <= 0x0f) fs.append((char)(fix | n));
+        else if (n <= 0xffff) put_be(fs, x, n, 2);
+        else put_be(fs, x + 1, n, 4);
+    }
+}
+
+fastream& Json::_Json2msgpack(fastream& fs, uint32 index) const {
+    _Header* h = (_Header*) _p8(index);
+    switch (h->type) {
+      case kString:
+        put_len(fs, 0xa0, h->size);
+        fs.append(_body(h), h->size);
+        break;
+      case kObject:
+        put_len(fs, 0x80, this->_object_size(index));
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; i += 2) {
+                const char* key = (const char*) _p8(a->p[i]);
+                const uint32 n = (uint32) strlen(key);
+                put_len(fs, 0xa0, n);
+                fs.append(key, n);
+                _Json2msgpack(fs, a->p[i + 1]);
+            }
+            k = a->next;
+        }
+        break;
+      case kArray:
+        put_len(fs, 0x90, this->_array_size(index));
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; ++i) _Json2msgpack(fs, a->p[i]);
+            k = a->next;
+        }
+        break;
+      case kInt:
+        put_int(fs, h->i);
+        break;
+      case kDouble:
+        {
+            uint64 u;
+            memcpy(&u, &h->d, 8);
+            put_be(fs, 0xcb, u, 8);
+        }
+        break;
+      case kBool:
+        fs.append((char)(h->b ? 0xc3 : 0xc2));
+        break;
+      default:
+        assert(h->type == kNull);
+        fs.append((char)0xc0);
+    }
+    return fs;
+}
+
+// @indent:  4 spaces by default
+// @n:       number of spaces to insert at the beginning for the current line
+fastream& Json::_Json2pretty(fastream& fs, int indent, int n, uint32 index) const {
+    _Header* h = (_Header*) _p8(index);
+    if (h->type == kObject) {
+        fs << '{';
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; i += 2) {
+                fs.append('\n').append(n, ' ');
+                fs << '"' << (const char*)_p8(a->p[i]) << '"' << ": ";    // key
+                _Json2pretty(fs, indent, n + indent, a->p[i + 1]) << ','; // value
+            }
+            k = a->next;
+        }
+        if (fs.back() == ',') fs.back() = '\n';
+        if (n > indent) fs.append(n - indent, ' ');
+        fs << '}';
+
+    } else if (h->type == kArray) {
+        fs << '[';
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; ++i) {
+                fs.append('\n').append(n, ' ');
+                _Json2pretty(fs, indent, n + indent, a->p[i]) << ',';
+            }
+            k = a->next;
+        }
+        if (fs.back() == ',') fs.back() = '\n';
+        if (n > indent) fs.append(n - indent, ' ');
+        fs << ']';
+
+    } else {
+        _Json2str(fs, false, index);
+    }
+    return fs;
+}
+
+void Json::_add_member(uint32 key, uint32 val, uint32 index) {
+    uint32 n = 2; // size of the queues with the new member
+    _Header* h = (_Header*)_p8(index);
+    if (h->type != kNull) {
+        assert(h->type == kObject);
+        if (h->index == 0) goto empty;
+
+        for (uint32 q = h->index;;) {
+            xx::Queue* a = (xx::Queue*) _p8(q);
+            n += a->size;
+            if (!a->next) {
+                if (!a->full()) {
+                    a->push(key, val);
                 } else {
                     uint32 k = this->_alloc_queue(16);
                     ((xx::Queue*)_p8(q))->next = k;
                     ((xx::Queue*)_p8(k))->push(key, val);
                 }
-                return;
+                goto end;
             }
             q = a->next;
         }
     } else {
         h->type = kObject;
+        h->hash = 0;
     }
     
   empty:
@@ -627,6 +2142,14 @@ void Json::_add_member(uint32 key, uint32 val, uint32 index) {
         ((_Header*)_p8(index))->index = q;
         ((xx::Queue*)_p8(q))->push(key, val);
     }
+
+  end:
+    h = (_Header*)_p8(index);
+    if (h->hash) {
+        this->_hash_member(key, val, index);
+    } else if (n >= kHashThreshold * 2) {
+        this->_build_hash_index(index);
+    }
 }
 
 void Json::_push_back(uint32 val, uint32 index) {
@@ -674,45 +2197,119 @@ Value Json::_at(uint32 i, uint32 index) const {
     }
 }
 
-Value Json::_at(Key key, uint32 index) const {
-    _Header* h = (_Header*) _p8(index);
-    if (h->type != kNull) {
-        assert(h->type == kObject);
+namespace xx {
+
+// Hash index of an object, open addressing with linear probing.
+//   - cap is a power of 2, and the load factor is no more than 1/2.
+//   - A slot is |hash|key|val|, key is 0 for an empty slot.
+struct HashIndex {
+    uint32 cap;
+    uint32 size;
+    uint32 p[];
+};
+
+// FNV-1a
+inline uint32 hash_key(const char* s) {
+    uint32 h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (uint8)*s) * 16777619u;
+    return h;
+}
+
+} // xx
+
+// The first one is kept for duplicate keys, as the linear scan does.
+void Json::_hash_insert(void* p, uint32 key, uint32 val) {
+    xx::HashIndex* t = (xx::HashIndex*) p;
+    const char* k = (const char*) _p8(key);
+    const uint32 x = xx::hash_key(k);
+    const uint32 mask = t->cap - 1;
+    for (uint32 i = x & mask;; i = (i + 1) & mask) {
+        uint32* s = t->p + i * 3;
+        if (s[1] == 0) {
+            s[0] = x; s[1] = key; s[2] = val;
+            ++t->size;
+            return;
+        }
+        if (s[0] == x && strcmp((const char*)_p8(s[1]), k) == 0) return;
+    }
+}
+
+void Json::_hash_member(uint32 key, uint32 val, uint32 index) {
+    xx::HashIndex* t = (xx::HashIndex*) _p8(((_Header*)_p8(index))->hash);
+    if ((t->size + 1) * 2 > t->cap) {
+        this->_build_hash_index(index); // the new member is already in the queue
     } else {
-        h->type = kObject;
-        h->index = 0;
+        this->_hash_insert(t, key, val);
     }
+}
 
+void Json::_build_hash_index(uint32 index) {
+    const uint32 n = this->_object_size(index);
+    uint32 cap = 32;
+    while (cap < n * 2 + 2) cap <<= 1;
+
+    const uint32 ti = _a8(8 + cap * 12);
+    xx::HashIndex* t = (xx::HashIndex*) _p8(ti);
+    memset(t, 0, 8 + cap * 12);
+    t->cap = cap;
+
+    _Header* h = (_Header*) _p8(index);
+    h->hash = ti;
     for (uint32 k = h->index; k != 0;) {
         xx::Queue* a = (xx::Queue*) _p8(k);
         for (uint32 i = 0; i < a->size; i += 2) {
-            if (strcmp((const char*)_p8(a->p[i]), key) == 0) {
-                return Value((Json*)this, a->p[i + 1]);
-            }
+            this->_hash_insert(t, a->p[i], a->p[i + 1]);
         }
         k = a->next;
     }
+}
+
+uint32 Json::_find_member(Key key, uint32 index) const {
+    const _Header* h = (const _Header*) _p8(index);
+    if (h->hash == 0) {
+        for (uint32 k = h->index; k != 0;) {
+            xx::Queue* a = (xx::Queue*) _p8(k);
+            for (uint32 i = 0; i < a->size; i += 2) {
+                if (strcmp((const char*)_p8(a->p[i]), key) == 0) return a->p[i + 1];
+            }
+            k = a->next;
+        }
+        return 0;
+    }
+
+    xx::HashIndex* t = (xx::HashIndex*) _p8(h->hash);
+    const uint32 x = xx::hash_key(key);
+    const uint32 mask = t->cap - 1;
+    for (uint32 i = x & mask;; i = (i + 1) & mask) {
+        const uint32* p = t->p + i * 3;
+        if (p[1] == 0) return 0;
+        if (p[0] == x && strcmp((const char*)_p8(p[1]), key) == 0) return p[2];
+    }
+}
+
+Value Json::_at(Key key, uint32 index) const {
+    _Header* h = (_Header*) _p8(index);
+    if (h->type != kNull) {
+        assert(h->type == kObject);
+    } else {
+        h->type = kObject;
+        h->index = 0;
+        h->hash = 0;
+    }
+
+    const uint32 v = this->_find_member(key, index);
+    if (v) return Value((Json*)this, v);
 
     const uint32 k = ((Json*)this)->_make_key(key);
-    const uint32 v = ((Json*)this)->_make_null();
-    ((Json*)this)->_add_member(k, v, index);
-    return Value((Json*)this, v);
+    const uint32 u = ((Json*)this)->_make_null();
+    ((Json*)this)->_add_member(k, u, index);
+    return Value((Json*)this, u);
 }
 
 bool Json::_has_member(Key key, uint32 index) const {
     _Header* h = (_Header*) _p8(index);
     if (h->type != kObject) return false;
-
-    for (uint32 k = h->index; k != 0;) {
-        xx::Queue* a = (xx::Queue*) _p8(k);
-        for (uint32 i = 0; i < a->size; i += 2) {
-            if (strcmp((const char*)_p8(a->p[i]), key) == 0) {
-                return true;
-            }
-        }
-        k = a->next;
-    }
-    return false;
+    return this->_find_member(key, index) != 0;
 }
 
 uint32 Json::_size(uint32 index) const {
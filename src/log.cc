@@ -5,26 +5,55 @@
 #include "co/path.h"
 #include "co/time.h"
 #include "co/__/stack_trace.h"
-#include "co/co/hook.h"
+#include "co/co.h"
 
 #include <time.h>
 #include <string>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <unordered_map>
 
 #ifndef _WIN32
 #include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
 #endif
 
 DEF_string(log_dir, "logs", "#0 log dir, will be created if not exists");
 DEF_string(log_file_name, "", "#0 name of log file, using exename if empty");
 DEF_int32(min_log_level, 0, "#0 write logs at or above this level, 0-4 (debug|info|warning|error|fatal)");
+DEF_string(log_levels, "", "#0 log levels for source files matching glob patterns, e.g. \"so/*=0,json.cc=warning\", see log::set_log_level()");
 DEF_int32(max_log_size, 4096, "#0 max size of a single log");
 DEF_int64(max_log_file_size, 256 << 20, "#0 max size of log file, default: 256MB");
 DEF_uint32(max_log_file_num, 8, "#0 max number of log files");
+DEF_uint32(max_log_file_age, 0, "#0 max age in seconds of rotated log files, 0 for no limit");
+DEF_uint32(log_rotate_sec, 0, "#0 also rotate the log file every n seconds, aligned to local time, e.g. 3600 for hourly, 86400 for daily");
+DEF_bool(log_compress, false, "#0 compress rotated log files to xx_n.log.gz in a separate thread, zlib required");
 DEF_uint32(max_log_buffer_size, 32 << 20, "#0 max size of log buffer, default: 32MB");
 DEF_uint32(log_flush_ms, 128, "#0 flush the log buffer every n ms");
+DEF_uint32(log_thread_buffer_size, 4 << 20, "#0 initial size of the log buffer of each thread, it grows up to max_log_buffer_size, default: 4MB");
+DEF_int32(log_overflow, 0, "#0 when the log buffer is full, 0: drop old logs, 1: drop new logs, 2: wait for the logging thread and drop new logs on timeout");
+DEF_uint32(log_wait_ms, 100, "#0 max time to wait when the log buffer is full, for log_overflow 2");
+DEF_int32(log_writer, 0, "#0 how to write the log file, 0: write(), 1: mmap, 2: O_DIRECT, 1 and 2 are not supported on windows");
+DEF_int32(log_fsync_ms, -1, "#0 fsync the log file, -1: never, 0: after every write, n > 0: every n ms");
+DEF_string(log_level_files, "", "#0 also write logs at or above these levels to separate files, e.g. \"warning,error\" for xx.warning.log and xx.error.log");
+DEF_string(log_syslog, "", "#0 also send logs to a syslog server by UDP, ip:port, e.g. 127.0.0.1:514");
+DEF_bool(log_bin_file, false, "#0 write binary logs (LOG_BIN) to xx.bin as they are, rather than formatting them to the log file, see log::decode_bin_logs()");
+DEF_bool(log_co_id, false, "#0 add scheduler id and coroutine id to logs written in coroutines, e.g. S0.C12");
 DEF_bool(cout, false, "#0 also logging to terminal");
 
 namespace ___ {
@@ -33,6 +62,57 @@ namespace xx {
 
 __thread fastream* xxLog = NULL;
 
+uint32 gLogExtra = 0;
+
+// log context of a coroutine or thread, see log::set_context()
+struct LogContext {
+    std::vector<std::pair<fastring, fastring>> kv;
+    fastream s; // " {k1=v1, k2=v2}"
+
+    void format() {
+        s.clear();
+        if (kv.empty()) return;
+        s << " {";
+        for (size_t i = 0; i < kv.size(); ++i) {
+            if (i > 0) s << ", ";
+            s << kv[i].first << '=' << kv[i].second;
+        }
+        s << '}';
+    }
+};
+
+static __thread LogContext* tLogContext = 0;
+
+// context of the current coroutine, or the current thread if not in a coroutine
+static LogContext* log_context(bool create) {
+    co::xx::Scheduler* s = co::xx::scheduler();
+    LogContext** p = (s && s->running()) ? &s->running()->lctx : &tLogContext;
+    if (*p == 0 && create) *p = new LogContext;
+    return *p;
+}
+
+const fastream* current_log_context() {
+    LogContext* c = log_context(false);
+    return (c && !c->s.empty()) ? &c->s : 0;
+}
+
+void append_co_id(fastream& fs) {
+    co::xx::Scheduler* s = co::xx::scheduler();
+    if (s && s->running()) fs << " S" << s->id() << ".C" << s->coroutine_id();
+}
+
+void clear_log_context(LogContext* c) {
+    c->kv.clear();
+    c->s.clear();
+}
+
+void delete_log_context(LogContext* c) {
+    delete c;
+}
+
+// rate-limited call sites with suppressed logs, never unlinked
+static LogLimiter* g_limiters = 0;
+
 // failure handler for SIGSEGV SIGABRT SIGFPE SIGBUS SIGILL.
 void on_failure();
 
@@ -70,18 +150,943 @@ class LogTime {
     uint32 _ms;
 };
 
+// format epoch time in us as "0523 17:00:00.123", the part in seconds is 
+// formatted only when it changes.
+class TimeFormatter {
+  public:
+    TimeFormatter() : _sec(0) { memset(_buf, 0, sizeof(_buf)); }
+    const char* format(int64 us);
+
+  private:
+    time_t _sec;
+    char _buf[24];
+};
+
+// head of a binary log, followed by its arguments
+struct BinLogHead {
+    uint32 tid;
+    int32 sched; // scheduler id, -1 if not in a coroutine or log_co_id is false
+    int32 co;    // coroutine id
+    uint32 id;   // id of the site in the binary log file
+    const BinLogSite* site;
+};
+
+void format_bin_log(
+    const BinLogSite& site, const BinLogHead& h, const char* time,
+    const char* p, const char* end, fastream* fs
+);
+
 struct Config {
-    Config() : max_log_buffer_size(32 << 20), max_log_size(4096) {}
+    Config() : max_log_buffer_size(32 << 20), thread_buffer_size(4 << 20), max_log_size(4096) {}
     fastring log_dir;
     fastring log_file_name;
     uint32 max_log_buffer_size;
+    uint32 thread_buffer_size;
     int32 max_log_size;
 };
 
+/**
+ * log buffer of a thread 
+ *   - It is a single-producer single-consumer ring, the owner thread appends logs 
+ *     to it without any lock, and the logging thread takes logs out of it. 
+ *   - Each log is stored as a record: a 16-byte header followed by the log, 
+ *     aligned to 16 bytes. The timestamp in the header is used to merge logs 
+ *     from all threads in time order. 
+ *   - A binary log is written in place by reserve() and commit(), no other 
+ *     record can be pushed between them. 
+ *   - _head and _tail are positions that never wrap, the offset in the buffer is 
+ *     pos & (_cap - 1). A record never wraps around the end of the buffer, a skip 
+ *     record is placed at the end instead. 
+ */
+class LogRing {
+  public:
+    struct Header {
+        uint32 n;    // size of the log, or kSkip
+        uint32 type; // kText or kBinary
+        int64 ts;    // timestamp from LogClock
+    };
+
+    // a log record collected by the logging thread
+    struct Rec {
+        int64 ts;
+        const char* s;
+        uint32 n;
+        uint32 type;
+    };
+
+    enum { kText = 0, kBinary = 1 };
+    enum { kSkip = (uint32)-1 };
+
+    explicit LogRing(uint32 cap)
+        : _buf((char*)malloc(cap)), _cap(cap), _head(0), _skip(kSkip), _wake(0), _tail(0), _end(0) {
+    }
+
+    ~LogRing() { free(_buf); }
+
+    uint32 cap() const { return _cap; }
+
+    // append a log, return false if there is no enough space.
+    bool push(const char* s, uint32 n, int64 ts) {
+        const uint32 size = record_size(n);
+        const uint64 head = _head;
+        const uint32 pos = (uint32)(head & (_cap - 1));
+        const uint32 skip = (_cap - pos < size) ? _cap - pos : 0;
+        if (head + skip + size - atomic_get(&_tail) > _cap) return false;
+
+        if (skip) ((Header*)(_buf + pos))->n = kSkip;
+        Header* h = (Header*)(_buf + (skip ? 0 : pos));
+        h->n = n;
+        h->type = kText;
+        h->ts = ts;
+        memcpy(h + 1, s, n);
+        atomic_set(&_head, head + skip + size);
+        return true;
+    }
+
+    // reserve space for a log of up to n bytes, return where to write the log, 
+    // or NULL if there is no enough space.
+    char* reserve(uint32 n) {
+        const uint32 size = record_size(n);
+        const uint64 head = _head;
+        const uint32 pos = (uint32)(head & (_cap - 1));
+        const uint32 skip = (_cap - pos < size) ? _cap - pos : 0;
+        if (head + skip + size - atomic_get(&_tail) > _cap) return 0;
+        _skip = skip;
+        return _buf + (skip ? 0 : pos) + sizeof(Header);
+    }
+
+    // append the log reserved, e is the end of it
+    void commit(const char* e, uint32 type, int64 ts) {
+        const uint64 head = _head;
+        const uint32 pos = (uint32)(head & (_cap - 1));
+        if (_skip) ((Header*)(_buf + pos))->n = kSkip;
+        Header* h = (Header*)(_buf + (_skip ? 0 : pos));
+        h->n = (uint32)(e - (const char*)(h + 1));
+        h->type = type;
+        h->ts = ts;
+        atomic_set(&_head, head + _skip + record_size(h->n));
+        _skip = kSkip;
+    }
+
+    // true if a log was reserved and not committed yet
+    bool reserved() const { return _skip != kSkip; }
+
+    // return true if the ring is more than half full, and the logging thread 
+    // has not been waken up by this ring yet.
+    bool need_wake() {
+        if (_wake || _head - atomic_get(&_tail) <= (_cap >> 1)) return false;
+        atomic_set(&_wake, 1);
+        return true;
+    }
+
+    // call f(char* log, size_t n, int64 ts, uint32 type) for records not later 
+    // than @until from the logging thread, they are consumed by the next call 
+    // of consume().
+    template<typename F>
+    void collect(int64 until, F&& f) {
+        const uint64 head = atomic_get(&_head);
+        uint64 p = _tail;
+        while (p < head) {
+            const uint32 pos = (uint32)(p & (_cap - 1));
+            Header* h = (Header*)(_buf + pos);
+            if (h->n == kSkip) { p += _cap - pos; continue; }
+            if (h->ts > until) break;
+            f((char*)(h + 1), (size_t)h->n, h->ts, h->type);
+            p += record_size(h->n);
+        }
+        _end = p;
+    }
+
+    // called by the logging thread when records collected were written
+    void consume() {
+        atomic_set(&_tail, _end);
+        atomic_set(&_wake, 0);
+    }
+
+    bool empty() const { return atomic_get(&_tail) == atomic_get(&_head); }
+
+  private:
+    static uint32 record_size(uint32 n) {
+        return (uint32)((sizeof(Header) + n + 15) & ~(size_t)15);
+    }
+
+  private:
+    char* _buf;
+    uint32 _cap;
+    uint64 _head;     // written by the producer
+    uint32 _skip;     // skip of the log reserved, kSkip if none, producer only
+    int _wake;
+    char _pad[40];    // keep _head and _tail in different cache lines
+    uint64 _tail;     // written by the consumer
+    uint64 _end;      // end of records collected, used only by the consumer
+};
+
+/**
+ * logs of a thread, in a ring that grows when it is full 
+ *   - The owner thread replaces a full ring with a new one twice as large, the 
+ *     old ring is drained by the logging thread and then freed. The ring can't 
+ *     grow again before that. 
+ *   - The object is never freed, it is reused by a new thread after the owner 
+ *     thread exits and all logs in it are written. 
+ */
+class ThreadLog {
+  public:
+    explicit ThreadLog(uint32 cap) : _cur(new LogRing(cap)), _old(0), _state(kAlive) {}
+
+    ~ThreadLog() {
+        delete _old;
+        delete _cur;
+    }
+
+    enum { kAlive = 0, kDead = 1, kFree = 2 };
+
+    // the ring to append logs to, called by the owner thread
+    LogRing* ring() const { return _cur; }
+
+    // called by the owner thread when the ring is full, return the new ring, 
+    // or NULL if it can't grow now.
+    LogRing* grow(uint32 max_cap) {
+        LogRing* const r = _cur;
+        if (r->cap() > (max_cap >> 1) || atomic_get(&_old) != 0) return 0;
+        LogRing* const x = new LogRing(r->cap() << 1);
+        atomic_set(&_old, r); // no more logs in r
+        atomic_set(&_cur, x);
+        return x;
+    }
+
+    // collect records in the old ring (if any) and the current ring from the 
+    // logging thread, f(LogRing*) is called for each of them in order.
+    template<typename F>
+    void collect(F&& f) {
+        // _cur is read first, if the ring grows after that, the old one is 
+        // the same as _cur, and the new one is collected next time.
+        LogRing* const cur = atomic_get(&_cur);
+        LogRing* const old = atomic_get(&_old);
+        if (old && old != cur) f(old);
+        f(cur);
+    }
+
+    // consume records collected, the old ring is freed once it is empty
+    void consume() {
+        LogRing* const cur = atomic_get(&_cur);
+        LogRing* const old = atomic_get(&_old);
+        if (old && old != cur) {
+            old->consume();
+            if (old->empty()) {
+                atomic_set(&_old, (LogRing*)0);
+                delete old;
+            }
+        }
+        cur->consume();
+    }
+
+    bool empty() const {
+        return atomic_get(&_old) == 0 && atomic_get(&_cur)->empty();
+    }
+
+    // state is changed from kAlive to kDead by the owner thread on exit, 
+    // from kDead to kFree by the logging thread when it is empty, and 
+    // from kFree to kAlive when it is reused by a new thread.
+    int state() const { return atomic_get(&_state); }
+    void set_state(int x) { atomic_set(&_state, x); }
+    bool acquire() { return atomic_compare_swap(&_state, kFree, kAlive) == kFree; }
+
+  private:
+    LogRing* _cur;
+    LogRing* _old;
+    int _state;
+};
+
+// timestamp of a log in the shared buffer, @end is the end position of it
+struct LogStamp {
+    int64 ts;
+    size_t end;
+};
+
+// ring of the current thread, NULL if not created yet, 
+// kNoRing if the thread is exiting, or no more ring is available.
+__thread LogRing* tRing = NULL;
+#define kNoRing ((LogRing*)1)
+
+// release logs of a thread when it exits
+struct ThreadLogHolder {
+    ThreadLogHolder() : t(0) {}
+    ~ThreadLogHolder() {
+        if (t) t->set_state(ThreadLog::kDead);
+        tRing = kNoRing;
+    }
+    ThreadLog* t;
+};
+
+inline ThreadLogHolder& thread_log_holder() {
+    static thread_local ThreadLogHolder h;
+    return h;
+}
+
+/**
+ * rotated log files are handled in a separate thread, so the logging thread 
+ * never blocks on them. 
+ *   - The logging thread renames xx.log to a pending file, and pushes it here. 
+ *   - Old files are renamed xx_n.log -> xx_n+1.log (or xx_n.log.gz), and the 
+ *     pending file becomes xx_1.log, compressed to xx_1.log.gz if log_compress 
+ *     is true. 
+ *   - The oldest files are removed by max_log_file_num and max_log_file_age. 
+ */
+class LogRotator {
+  public:
+    LogRotator() : _ev(true, false), _stop(false) {}
+    ~LogRotator() { this->stop(); }
+
+    void push(const fastring& base, fastring&& path) {
+        MutexGuard g(_mtx);
+        if (_thread == NULL) {
+            _base = base;
+            _thread.reset(new Thread(&LogRotator::thread_fun, this));
+        }
+        _q.push_back(std::move(path));
+        _ev.signal();
+    }
+
+    // finish pending files and stop the thread
+    void stop() {
+        {
+            MutexGuard g(_mtx);
+            if (_thread == NULL || _stop) return;
+            _stop = true;
+            _ev.signal();
+        }
+        _thread->join();
+    }
+
+  private:
+    void thread_fun();
+    void rotate(const fastring& path);
+    bool compress(const fastring& from, const fastring& to);
+
+    // path of xx_n.log, or xx_n.log.gz
+    fastring rotated_path(uint32 n, bool gz) const {
+        fastring p(_base.size() + 16);
+        p << _base << '_' << n << (gz ? ".log.gz" : ".log");
+        return p;
+    }
+
+    // find path of the existing xx_n.log or xx_n.log.gz, return false if not found
+    bool find_rotated(uint32 n, fastring& path) const {
+        path = this->rotated_path(n, true);
+        if (fs::exists(path)) return true;
+        path = this->rotated_path(n, false);
+        return fs::exists(path);
+    }
+
+  private:
+    Mutex _mtx;
+    SyncEvent _ev;
+    std::unique_ptr<Thread> _thread;
+    std::vector<fastring> _q;
+    fastring _base;
+    bool _stop;
+};
+
+void LogRotator::thread_fun() {
+    std::vector<fastring> q;
+    while (true) {
+        _ev.wait();
+        bool stop;
+        {
+            MutexGuard g(_mtx);
+            q.swap(_q);
+            _ev.reset();
+            stop = _stop;
+        }
+
+        for (size_t i = 0; i < q.size(); ++i) this->rotate(q[i]);
+        q.clear();
+        if (stop) break;
+    }
+}
+
+void LogRotator::rotate(const fastring& path) {
+    // xx_1 ... xx_k exist
+    std::vector<fastring> paths(1);
+    for (uint32 i = 1; i < FLG_max_log_file_num; ++i) {
+        fastring p;
+        if (!this->find_rotated(i, p)) break;
+        paths.push_back(std::move(p));
+    }
+
+    if (paths.size() == FLG_max_log_file_num) {
+        // max_log_file_num is 1, only the current log file is kept
+        if (paths.size() == 1) {
+            fs::remove(path);
+            return;
+        }
+        fs::remove(paths.back());
+        paths.pop_back();
+    }
+
+    for (size_t i = paths.size() - 1; i > 0; --i) {
+        const bool gz = paths[i].ends_with(".gz");
+        fs::rename(paths[i], this->rotated_path((uint32)i + 1, gz));
+    }
+
+    fastring first = this->rotated_path(1, FLG_log_compress);
+  #ifdef HAS_ZLIB
+    if (FLG_log_compress && this->compress(path, first)) {
+        fs::remove(path);
+    } else {
+        fs::rename(path, this->rotated_path(1, false));
+    }
+  #else
+    fs::rename(path, this->rotated_path(1, false));
+  #endif
+
+    // remove files that are too old
+    if (FLG_max_log_file_age > 0) {
+        const int64 t = epoch::ms() / 1000 - FLG_max_log_file_age;
+        bool old = false;
+        fastring p;
+        for (uint32 i = 1; i < FLG_max_log_file_num; ++i) {
+            if (!this->find_rotated(i, p)) break;
+            if (!old && fs::mtime(p) < t) old = true;
+            if (old) fs::remove(p);
+        }
+    }
+}
+
+// gzip the file in blocks, return false on any error
+bool LogRotator::compress(const fastring& from, const fastring& to) {
+  #ifdef HAS_ZLIB
+    fs::file f;
+    if (!f.open(from, 'r')) return false;
+    gzFile gz = gzopen(to.c_str(), "wb6");
+    if (gz == NULL) return false;
+
+    fastring buf(256 * 1024);
+    bool ok = true;
+    while (true) {
+        const size_t n = f.read((void*)buf.data(), buf.capacity());
+        if (n == 0) break;
+        if (gzwrite(gz, buf.data(), (unsigned)n) != (int)n) { ok = false; break; }
+    }
+    if (gzclose(gz) != Z_OK) ok = false;
+    if (!ok) fs::remove(to);
+    return ok;
+  #else
+    (void)from; (void)to;
+    return false;
+  #endif
+}
+
+/**
+ * the log file 
+ *   - kWrite: write() through the page cache, the default. 
+ *   - kMmap: logs are copied to a preallocated segment of the file mapped into 
+ *     memory, dirty pages are written back by the kernel, and the file is 
+ *     truncated to the real size on close. 
+ *   - kDirect: O_DIRECT, logs are written in aligned blocks bypassing the page 
+ *     cache, the partial block at the end is padded with zeros and written 
+ *     again by the next batch, the padding is truncated on close. 
+ *   - kMmap and kDirect are not supported on windows, kDirect falls back to 
+ *     kWrite if the file system does not support O_DIRECT. 
+ */
+class LogFile {
+  public:
+    enum { kWrite = 0, kMmap = 1, kDirect = 2 };
+
+    LogFile()
+        : _mode(kWrite), _fd(-1), _size(0), _map(0), _map_off(0), _buf(0), _off(0), _tail(0) {}
+    ~LogFile() { this->close(); }
+
+    bool open(const fastring& path, int mode);
+    void close();
+    void write(const char* s, size_t n);
+
+    // write data of the file to the disk
+    void sync();
+
+    int64 size() const { return _size; }
+    const fastring& path() const { return _path; }
+    bool exists() const { return fs::exists(_path); }
+
+  #ifdef _WIN32
+    explicit operator bool() const { return (bool)_f; }
+  #else
+    explicit operator bool() const { return _fd != -1; }
+  #endif
+
+  private:
+    enum : int64 {
+        kSegSize = 8 << 20,  // size of a mapped segment
+        kBlock = 4096,       // block size for O_DIRECT
+        kBufSize = 1 << 20,  // size of the aligned buffer for O_DIRECT
+    };
+
+  #ifndef _WIN32
+    bool map(int64 off);
+    bool open_mmap();
+    bool open_direct();
+    void write_mmap(const char* s, size_t n);
+    void write_direct(const char* s, size_t n);
+  #endif
+
+  private:
+    fastring _path;
+    int _mode;
+  #ifdef _WIN32
+    fs::file _f;
+  #endif
+    int _fd;
+    int64 _size;   // size of logs in the file
+    char* _map;    // mapped segment
+    int64 _map_off;
+    char* _buf;    // aligned buffer for O_DIRECT
+    int64 _off;    // file offset of _buf
+    size_t _tail;  // bytes in _buf
+};
+
+bool LogFile::open(const fastring& path, int mode) {
+    this->close();
+    _path = path;
+    _mode = mode;
+  #ifdef _WIN32
+    _mode = kWrite;
+    if (!_f.open(path.c_str(), 'a')) return false;
+    _size = _f.size();
+    return true;
+  #else
+    if (_mode == kMmap) return this->open_mmap();
+    if (_mode == kDirect) {
+        if (this->open_direct()) return true;
+        printf("O_DIRECT not supported for %s, use write() instead\n", path.c_str());
+        _mode = kWrite;
+    }
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd == -1) return false;
+    struct stat st;
+    _size = fstat(_fd, &st) == 0 ? st.st_size : 0;
+    return true;
+  #endif
+}
+
+void LogFile::close() {
+  #ifdef _WIN32
+    _f.close();
+  #else
+    if (_fd == -1) return;
+    if (_mode == kWrite) {
+        ::close(_fd);
+        _fd = -1;
+        return;
+    }
+
+    if (_mode == kMmap) {
+        if (_map) { munmap(_map, kSegSize); _map = 0; }
+    } else if (_tail > 0) {
+        const size_t n = (_tail + kBlock - 1) & ~(kBlock - 1);
+        memset(_buf + _tail, 0, n - _tail);
+        (void) pwrite(_fd, _buf, n, _off);
+    }
+    (void) ftruncate(_fd, _size); // remove the preallocated or padding bytes
+    ::close(_fd);
+    _fd = -1;
+  #endif
+}
+
+void LogFile::write(const char* s, size_t n) {
+  #ifdef _WIN32
+    _f.write(s, n);
+    _size += n;
+  #else
+    if (_fd == -1) return;
+    if (_mode == kMmap) {
+        this->write_mmap(s, n);
+    } else if (_mode == kDirect) {
+        this->write_direct(s, n);
+    } else {
+        while (n > 0) {
+            const ssize_t r = ::write(_fd, s, n);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            _size += r;
+            s += r;
+            n -= r;
+        }
+    }
+  #endif
+}
+
+// not supported on windows
+void LogFile::sync() {
+  #ifndef _WIN32
+    if (_fd == -1) return;
+    if (_map) msync(_map, (size_t)(_size - _map_off), MS_SYNC);
+  #ifdef __APPLE__
+    fsync(_fd);
+  #else
+    fdatasync(_fd);
+  #endif
+  #endif
+}
+
+#ifndef _WIN32
+// map the segment at @off, blocks of the segment are allocated first, so 
+// that writing to the mapped memory will not cause SIGBUS when the disk is full.
+bool LogFile::map(int64 off) {
+    if (_map) { munmap(_map, kSegSize); _map = 0; }
+  #ifdef __linux__
+    const int r = posix_fallocate(_fd, off, kSegSize);
+  #else
+    struct stat st;
+    int r = fstat(_fd, &st);
+    if (r == 0 && st.st_size < off + kSegSize) r = ftruncate(_fd, off + kSegSize);
+  #endif
+    if (r != 0) return false;
+
+    void* p = mmap(0, kSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, off);
+    if (p == MAP_FAILED) return false;
+    _map = (char*)p;
+    _map_off = off;
+    return true;
+}
+
+bool LogFile::open_mmap() {
+    _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd == -1) return false;
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0) { this->close(); return false; }
+    _size = st.st_size;
+
+    // the file may have preallocated zeros at the end if it was not closed 
+    // normally, the real size is after the last non-zero byte.
+    const int64 off = _size > 0 ? ((_size - 1) & ~(kSegSize - 1)) : 0;
+    if (!this->map(off)) { this->close(); return false; }
+    if (_size > off) {
+        int64 i = _size - off;
+        while (i > 0 && _map[i - 1] == '\0') --i;
+        _size = off + i;
+    }
+    return true;
+}
+
+void LogFile::write_mmap(const char* s, size_t n) {
+    while (n > 0) {
+        int64 pos = _size - _map_off;
+        if (pos == kSegSize) {
+            if (!this->map(_map_off + kSegSize)) {
+                printf("failed to map the log file: %s\n", _path.c_str());
+                this->close();
+                return;
+            }
+            pos = 0;
+        }
+        const size_t x = (size_t)(kSegSize - pos) < n ? (size_t)(kSegSize - pos) : n;
+        memcpy(_map + pos, s, x);
+        _size += x;
+        s += x;
+        n -= x;
+    }
+}
+
+bool LogFile::open_direct() {
+  #ifdef O_DIRECT
+    _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+    if (_fd == -1) return false;
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0) { this->close(); return false; }
+    _size = st.st_size;
+    if (_buf == 0 && posix_memalign((void**)&_buf, kBlock, kBufSize) != 0) {
+        _buf = 0;
+        this->close();
+        return false;
+    }
+
+    // read the last block, it will be written again with new logs. It may have 
+    // padding zeros at the end if the file was not closed normally, the real 
+    // size is after the last non-zero byte.
+    _off = _size > 0 ? ((_size - 1) & ~(kBlock - 1)) : 0;
+    _tail = 0;
+    if (_size > _off) {
+        const ssize_t r = pread(_fd, _buf, kBlock, _off);
+        if (r < _size - _off) {
+            this->close();
+            return false;
+        }
+        _tail = (size_t)(_size - _off);
+        while (_tail > 0 && _buf[_tail - 1] == '\0') --_tail;
+        _size = _off + _tail;
+    }
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+void LogFile::write_direct(const char* s, size_t n) {
+    while (n > 0) {
+        const size_t x = (kBufSize - _tail) < n ? (kBufSize - _tail) : n;
+        memcpy(_buf + _tail, s, x);
+        _tail += x;
+        _size += x;
+        s += x;
+        n -= x;
+
+        // write all blocks, including the last partial block padded with zeros
+        const size_t len = (_tail + kBlock - 1) & ~(kBlock - 1);
+        memset(_buf + _tail, 0, len - _tail);
+        if (pwrite(_fd, _buf, len, _off) != (ssize_t)len) {
+            printf("failed to write the log file: %s\n", _path.c_str());
+        }
+
+        // keep the partial block in the buffer
+        const size_t full = _tail & ~(kBlock - 1);
+        if (full > 0) {
+            memmove(_buf, _buf + full, _tail - full);
+            _off += full;
+            _tail -= full;
+        }
+    }
+}
+#endif
+
+// level of the log starting at @s, or -1 if @s is not the beginning of a log
+inline int level_of_log(const char* s, const char* end) {
+    if (end - s < 2 || s[1] < '0' || s[1] > '9') return -1;
+    switch (s[0]) {
+      case 'D': return debug;
+      case 'I': return info;
+      case 'W': return warning;
+      case 'E': return error;
+      case 'F': return fatal;
+      default:  return -1;
+    }
+}
+
+// call f(level, p, n) for each log in the batch, a log may have more than one 
+// line, lines not starting with a level are considered as part of the previous log.
+template<typename F>
+void for_each_log(const char* s, size_t n, F&& f) {
+    const char* const end = s + n;
+    const char* beg = s;
+    int level = info;
+    while (s < end) {
+        const char* p = (const char*) memchr(s, '\n', end - s);
+        p = p ? p + 1 : end;
+        const int x = level_of_log(s, end);
+        if (x >= 0 && s != beg) {
+            f(level, beg, (size_t)(s - beg));
+            beg = s;
+        }
+        if (x >= 0) level = x;
+        s = p;
+    }
+    if (beg < end) f(level, beg, (size_t)(end - beg));
+}
+
+// writes logs at or above a level to a file, see log::new_file_sink()
+class FileSink : public Sink {
+  public:
+    FileSink(const char* path, int level) : _path(path), _level(level), _nrotate(0) {
+        if (!_path.ends_with(".log")) _path.append(".log");
+        _base = _path;
+        _base.remove_tail(".log");
+    }
+
+    virtual ~FileSink() = default;
+
+    // consecutive logs at or above the level are written at once
+    virtual void write(const char* s, size_t n) {
+        const char* run = 0;
+        size_t len = 0;
+        for_each_log(s, n, [&](int level, const char* p, size_t m) {
+            if (level >= _level) {
+                if (run == 0) run = p;
+                len += m;
+            } else if (run) {
+                this->write_file(run, len);
+                run = 0;
+                len = 0;
+            }
+        });
+        if (run) this->write_file(run, len);
+    }
+
+    virtual void flush() {
+        _file.close();
+    }
+
+  private:
+    void write_file(const char* s, size_t n) {
+        if (!_file) {
+            const fastring dir = path::dir(_path);
+            if (!fs::exists(dir)) fs::mkdir(dir, true);
+            if (!_file.open(_path, FLG_log_writer)) return;
+        }
+        _file.write(s, n);
+
+        if (_file.size() >= FLG_max_log_file_size) {
+            _file.close();
+            fastring p(_base.size() + 32);
+            p << _base << '_' << epoch::ms() << '_' << (_nrotate++) << ".rotating";
+            if (fs::rename(_path, p)) _rotator.push(_base, std::move(p));
+        }
+    }
+
+  private:
+    fastring _path;
+    fastring _base;
+    int _level;
+    uint32 _nrotate;
+    LogFile _file;
+    LogRotator _rotator;
+};
+
+// sends logs to a syslog server by UDP, see log::new_udp_sink()
+class UdpSink : public Sink {
+  public:
+    UdpSink(const char* ip, int port, int level) : _level(level), _buf(1024) {
+        _ok = co::init_ip_addr(&_addr, ip, port);
+        _fd = _ok ? ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP) : (sock_t)-1;
+        if (_fd == (sock_t)-1) {
+            printf("failed to create the udp sink: %s:%d\n", ip, port);
+            _ok = false;
+        }
+        _app = os::exename();
+        _app.remove_tail(".exe");
+        _pid = os::pid();
+    }
+
+    virtual ~UdpSink() {
+        if (!_ok) return;
+      #ifdef _WIN32
+        ::closesocket(_fd);
+      #else
+        ::close(_fd);
+      #endif
+    }
+
+    // <PRI>1 - - APP PID - - MSG
+    virtual void write(const char* s, size_t n) {
+        if (!_ok) return;
+        static const int severity[] = { 7, 6, 4, 3, 2 };
+        for_each_log(s, n, [&](int level, const char* p, size_t m) {
+            if (level < _level) return;
+            if (p[m - 1] == '\n') --m;
+            if (m > 8192) m = 8192;
+            _buf.clear();
+            _buf << '<' << (8 + severity[level]) << ">1 - - " << _app << ' ' << _pid << " - - ";
+            _buf.append(p, m);
+            ::sendto(_fd, _buf.data(), (int)_buf.size(), 0, (const sockaddr*)&_addr, (int)sizeof(_addr));
+        });
+    }
+
+  private:
+    struct sockaddr_in _addr;
+    sock_t _fd;
+    bool _ok;
+    int _level;
+    int _pid;
+    fastring _app;
+    fastream _buf;
+};
+
+/**
+ * cheap monotonic timestamps of logs 
+ *   - On x86 with an invariant TSC, a timestamp is the TSC read by rdtsc, which 
+ *     costs a few ns. It is converted to time by the logging thread, with the 
+ *     TSC frequency calibrated against the monotonic clock on every flush. 
+ *   - Otherwise, a timestamp is now::us(). 
+ *   - The constructor only takes the first anchor, as it may run during static 
+ *     initialization. The frequency is measured by the first calibrate(). 
+ *   - Only the logging thread calls calibrate() and to_epoch_us(). 
+ */
+class LogClock {
+  public:
+    LogClock() : _tsc(false), _t0(0), _u0(0), _t1(0), _u1(0), _us_per_tick(1.0), _off(0) {
+      #if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _tsc = invariant_tsc();
+      #endif
+        if (_tsc) {
+            _t0 = _t1 = ticks(true);
+            _u0 = _u1 = now::us();
+        }
+        _off = epoch::us() - now::us();
+    }
+
+    static int64 ticks(bool tsc) {
+      #if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        if (tsc) return (int64)__rdtsc();
+      #endif
+        return now::us();
+    }
+
+    int64 ticks() const { return ticks(_tsc); }
+
+    // update the anchor and the frequency, also the offset of epoch time
+    void calibrate() {
+        _off = epoch::us() - now::us();
+        if (!_tsc) return;
+        _t1 = ticks(true);
+        _u1 = now::us();
+        // too close to the first anchor to measure the frequency
+        if (_u1 - _u0 < 1000) {
+            sleep::ms(1);
+            _t1 = ticks(true);
+            _u1 = now::us();
+        }
+        if (_t1 > _t0 && _u1 > _u0) _us_per_tick = (double)(_u1 - _u0) / (double)(_t1 - _t0);
+    }
+
+    int64 to_epoch_us(int64 t) const {
+        if (!_tsc) return t + _off;
+        return _u1 + (int64)((double)(t - _t1) * _us_per_tick) + _off;
+    }
+
+  private:
+    static bool invariant_tsc() {
+      #if defined(_M_X64) || defined(_M_IX86)
+        int r[4];
+        __cpuid(r, 0x80000000);
+        if ((unsigned)r[0] < 0x80000007u) return false;
+        __cpuid(r, 0x80000007);
+        return (r[3] & (1 << 8)) != 0;
+      #elif defined(__x86_64__) || defined(__i386__)
+        unsigned a, b, c, d;
+        if (__get_cpuid(0x80000000, &a, &b, &c, &d) == 0 || a < 0x80000007u) return false;
+        if (__get_cpuid(0x80000007, &a, &b, &c, &d) == 0) return false;
+        return (d & (1 << 8)) != 0;
+      #else
+        return false;
+      #endif
+    }
+
+  private:
+    bool _tsc;
+    int64 _t0, _u0;      // the first anchor
+    int64 _t1, _u1;      // the latest anchor
+    double _us_per_tick;
+    int64 _off;          // epoch time - monotonic time
+};
+
 class LevelLogger {
   public:
     LevelLogger();
-    ~LevelLogger() { this->stop(); }
+    ~LevelLogger() {
+        this->stop();
+        for (size_t i = 0; i < _sinks.size(); ++i) delete _sinks[i];
+    }
+
+    void add_sink(Sink* s) {
+        MutexGuard g(_sink_mutex);
+        _sinks.push_back(s);
+        MemorySink* m = dynamic_cast<MemorySink*>(s);
+        if (m && m->dump_on_fatal()) _memory_sinks.push_back(m);
+        atomic_set(&_nsinks, (uint32)_sinks.size());
+    }
 
     void push(char* s, size_t n) {
         if (unlikely(n > _config->max_log_size)) {
@@ -92,25 +1097,87 @@ class LevelLogger {
             p[2] = '.';
             p[3] = '\n';
         }
-        {
-            MutexGuard g(_log_mutex);
-            memcpy(s + 1, _t.data, _t.total_size); // log time
-
-            if (unlikely(_fs->size() + n >= _config->max_log_buffer_size)) {
-                const char* p = strchr(_fs->data() + (_fs->size() >> 1) + 7, '\n');
-                const size_t len = _fs->data() + _fs->size() - p - 1;
-                memcpy((char*)(_fs->data()), "......\n", 7);
-                memcpy((char*)(_fs->data()) + 7, p + 1, len);
-                _fs->resize(len + 7);
+
+        // append to the shared buffer if the lock is not contended
+        if (_log_mutex.try_lock()) {
+            if (_fs->size() + n < _config->max_log_buffer_size) {
+                this->append(s, n);
+                _log_mutex.unlock();
+                return;
+            }
+            _log_mutex.unlock();
+        }
+
+        // otherwise append to the ring of the thread, without any lock, unless 
+        // a binary log is in progress in the ring
+        LogRing* r = tRing;
+        if (unlikely(r <= kNoRing)) r = (r == kNoRing) ? 0 : this->new_ring();
+        if (r && !r->reserved()) {
+            const int64 ts = _clock.ticks();
+            if (r->push(s, (uint32)n, ts) || ((r = this->grow_ring()) && r->push(s, (uint32)n, ts))) {
+                if (r->need_wake()) _log_event.signal();
+                return;
+            }
+        }
+
+        // the ring is full or not available, wait for the shared buffer
+        int64 deadline = 0;
+        while (true) {
+            {
+                MutexGuard g(_log_mutex);
+                if (unlikely(_fs->size() + n >= _config->max_log_buffer_size)) {
+                    if (FLG_log_overflow == kDropOld) {
+                        this->drop_old_logs();
+                    } else if (FLG_log_overflow == kDropNew || deadline < 0 || _stop) {
+                        this->on_dropped(1, n);
+                        return;
+                    } else {
+                        goto wait; // kWait
+                    }
+                }
+
+                this->append(s, n);
+                return;
             }
 
-            _fs->append(s, n);
-            if (_fs->size() > (_fs->capacity() >> 1)) _log_event.signal();
+          wait:
+            // wake up the logging thread, and check the buffer again 1ms later, 
+            // the coroutine (if any) yields rather than blocking the thread.
+            _log_event.signal();
+            if (deadline == 0) deadline = now::ms() + FLG_log_wait_ms;
+            co::sleep(1);
+            if (now::ms() >= deadline) deadline = -1; // drop it if still full
         }
     }
 
+    // policies when the log buffer is full, see FLG_log_overflow
+    enum { kDropOld = 0, kDropNew = 1, kWait = 2 };
+
+    uint64 dropped_logs() const { return atomic_get(&_dropped_logs); }
+    uint64 dropped_bytes() const { return atomic_get(&_dropped_bytes); }
+
+    // binary logs, see BinLogSaver in log.h
+    char* begin_bin_log(const BinLogSite* site, char** e, size_t* n);
+
+    void end_bin_log(char* p) {
+        LogRing* const r = tRing;
+        r->commit(p, LogRing::kBinary, _clock.ticks());
+        if (r->need_wake()) _log_event.signal();
+    }
+
+    void push_bin_log(char* s, size_t n);
+
     void push_fatal_log(fastream* log);
 
+    WriteStats write_stats() const {
+        WriteStats x;
+        x.writes = atomic_get(&_stats.writes);
+        x.bytes = atomic_get(&_stats.bytes);
+        x.total_us = atomic_get(&_stats.total_us);
+        x.max_us = atomic_get(&_stats.max_us);
+        return x;
+    }
+
     void init();
 
     // Stop the logging thread and call write() to handle buffered logs.
@@ -121,8 +1188,9 @@ class LevelLogger {
     void on_failure() {
         this->safe_stop();
         if (this->open_log_file(fatal)) {
+            this->dump_memory_sinks();
             _file.write('F');
-            _file.write(_t.data, _t.total_size);
+            _file.write(this->log_time(), log_time_t::total_size);
             _file.write("] ");
             _stack_trace->set_file(&_file);
         }
@@ -130,33 +1198,498 @@ class LevelLogger {
 
   private:
     void init_config();
+    void init_sinks();
+    void flush_sinks();
+    void dump_memory_sinks();
     bool open_log_file(int level=0);
+    void rotate_file(const fastring& path);
+    int64 next_rotate_time(int64 now) const;
     void write(fastream* fs);
     void rotate();
     void thread_fun();
+    LogRing* new_ring();
+    LogRing* grow_ring();
+    void collect(std::unique_ptr<fastream>& fs, std::vector<LogStamp>& st, int64 until);
+    void drain(const char* time);
+    void add_bin_log(const LogRing::Rec& x, fastream* fs);
+    void write_bin();
+
+    // append a log to the shared buffer, _log_mutex MUST be locked. The log 
+    // is stamped here, so stamps in the shared buffer are in order, and time 
+    // of the log is formatted by the logging thread, as logs in rings.
+    void append(char* s, size_t n) {
+        _fs->append(s, n);
+        LogStamp x = { _clock.ticks(), _fs->size() };
+        _st->push_back(x);
+        if (_fs->size() > (_fs->capacity() >> 1)) _log_event.signal();
+    }
+
+    // drop the older half of the shared buffer, _log_mutex MUST be locked
+    void drop_old_logs() {
+        const char* p = strchr(_fs->data() + (_fs->size() >> 1) + 7, '\n');
+        size_t nlog = 0;
+        for (const char* x = _fs->data(); (x = (const char*)memchr(x, '\n', p - x)); ++x) ++nlog;
+        this->on_dropped(nlog + 1, p + 1 - _fs->data());
+
+        const size_t cut = p + 1 - _fs->data();
+        const size_t len = _fs->size() - cut;
+        memcpy((char*)(_fs->data()), "......\n", 7);
+        memcpy((char*)(_fs->data()) + 7, p + 1, len);
+        _fs->resize(len + 7);
+
+        // "......" belongs to the first log left
+        size_t i = 0;
+        while (i < _st->size() && (*_st)[i].end <= cut) ++i;
+        if (i == _st->size()) {
+            (*_st)[0] = _st->back();
+            (*_st)[0].end = 7;
+            _st->resize(1);
+            return;
+        }
+        _st->erase(_st->begin(), _st->begin() + i);
+        for (i = 0; i < _st->size(); ++i) (*_st)[i].end = (*_st)[i].end - cut + 7;
+    }
+
+    void on_dropped(uint64 nlog, uint64 nbytes) {
+        atomic_add(&_dropped_logs, nlog);
+        atomic_add(&_dropped_bytes, nbytes);
+    }
+
+    // append a record of dropped logs since the last call, if any
+    void report_dropped(fastream* fs) {
+        const uint64 n = atomic_get(&_dropped_logs);
+        if (n == _reported_logs) return;
+        const uint64 bytes = atomic_get(&_dropped_bytes);
+        fs->append('W').append(this->log_time(), log_time_t::total_size);
+        (*fs) << "] ...... " << (n - _reported_logs) << " logs (" << (bytes - _reported_bytes)
+              << " bytes) dropped as the log buffer is full\n";
+        _reported_logs = n;
+        _reported_bytes = bytes;
+    }
+    // append "suppressed N logs" for rate-limited sites, whose suppressed 
+    // logs were not reported by a later log.
+    void report_suppressed(fastream* fs);
+
+    const char* format_time(int64 us) { return _tf.format(us); }
+
+    // position of the time in a log of n bytes, or NULL if there is none. 
+    // The first log left by drop_old_logs() begins with "......\n".
+    static char* time_pos(char* s, size_t n) {
+        if (*s != '.') return s + 1;
+        return n > 7 + log_time_t::total_size ? s + 8 : 0;
+    }
+
+    // write time of the log from its timestamp
+    void set_time(char* s, size_t n, int64 ts) {
+        char* const p = time_pos(s, n);
+        if (p) memcpy(p, this->format_time(_clock.to_epoch_us(ts)), log_time_t::total_size);
+    }
+
+    // write time of logs in the shared buffer with the current log time, 
+    // only called on failures.
+    void set_log_time() {
+        size_t beg = 0;
+        for (size_t i = 0; i < _st->size(); ++i) {
+            char* const p = time_pos((char*)_fs->data() + beg, (*_st)[i].end - beg);
+            if (p) memcpy(p, this->log_time(), log_time_t::total_size);
+            beg = (*_st)[i].end;
+        }
+    }
+
+    // the log time is double buffered, the logging thread updates the one not 
+    // in use, and then switches to it, with _log_mutex locked.
+    const char* log_time() const {
+        return _t[atomic_get(&_ti)].data;
+    }
+
+    void update_log_time(const char* s) {
+        const int i = !_ti;
+        if (s) _t[i].update(s); else _t[i].update(_t[_ti].data);
+        _t[i].update_ms(_log_time.ms());
+        atomic_set(&_ti, i);
+    }
 
   private:
+    enum { kMaxRings = 1024 };
+
     Mutex _log_mutex;
     SyncEvent _log_event;
     std::unique_ptr<Thread> _log_thread;
     std::unique_ptr<fastream> _fs;
-    fs::file _file;
+    std::unique_ptr<std::vector<LogStamp>> _st; // timestamps of logs in _fs
+    fs::file _file;      // for fatal logs
+    LogFile _log_file;
     std::unique_ptr<Config> _config;
 
     LogTime _log_time;
-    log_time_t _t;
+    log_time_t _t[2];
+    int _ti;
     int _stop;
+    bool _ready; // rings are enabled after init()
+    uint32 _nrings;
+    ThreadLog* _rings[kMaxRings];
+    std::vector<LogRing::Rec> _recs;
+    std::vector<size_t> _runs; // _recs is sorted in each run
+    std::unique_ptr<fastream> _merged;
+    uint64 _dropped_logs;
+    uint64 _dropped_bytes;
+    uint64 _reported_logs;
+    uint64 _reported_bytes;
+    TimeFormatter _tf;   // for formatting time of logs in rings
+    std::unique_ptr<fastream> _bin; // binary logs to write to xx.bin
+    std::unordered_map<const BinLogSite*, uint32> _bin_ids; // sites defined in xx.bin
+    fs::file _bin_file;
     std::unique_ptr<StackTrace> _stack_trace;
+    fastring _path_base; // log_dir/log_file_name
+    int64 _rotate_at;    // rotate the log file by time at this time (sec)
+    uint32 _nrotate;
+    int64 _sync_ms;      // fsync the log file at this time (ms)
+    WriteStats _stats;
+    Mutex _sink_mutex;
+    std::vector<Sink*> _sinks;
+    std::vector<MemorySink*> _memory_sinks; // dumped on fatal errors
+    uint32 _nsinks;
+    LogRotator _rotator;
+    LogClock _clock;
 };
 
 LevelLogger::LevelLogger()
-    : _log_event(true, false), _fs(new fastream()), _stop(0) {
+    : _log_event(true, false), _fs(new fastream()), _st(new std::vector<LogStamp>()), 
+      _ti(0), _stop(0), _ready(false), _nrings(0), _merged(new fastream()), 
+      _dropped_logs(0), _dropped_bytes(0), 
+      _reported_logs(0), _reported_bytes(0), _bin(new fastream()), _rotate_at(0), _nrotate(0), _sync_ms(0), _nsinks(0) {
+    memset(&_stats, 0, sizeof(_stats));
+    memset(_rings, 0, sizeof(_rings));
     _config.reset(new Config);
     _stack_trace.reset(new_stack_trace());
     _stack_trace->set_callback(&xx::on_failure);
     install_signal_handler();
-    _t.update(_log_time.get());
-    _t.update_ms(_log_time.ms());
+    _t[0].update(_log_time.get());
+    _t[0].update_ms(_log_time.ms());
+}
+
+LogRing* LevelLogger::new_ring() {
+    if (!atomic_get(&_ready)) return 0; // try again later
+
+    ThreadLogHolder& h = thread_log_holder();
+    ThreadLog* t = 0;
+    const uint32 n = atomic_get(&_nrings);
+    for (uint32 i = 0; i < n; ++i) {
+        ThreadLog* x = atomic_get(&_rings[i]);
+        if (x && x->state() == ThreadLog::kFree && x->acquire()) { t = x; break; }
+    }
+
+    if (t == 0) {
+        const uint32 i = atomic_fetch_inc(&_nrings);
+        if (i < kMaxRings) {
+            t = new ThreadLog(_config->thread_buffer_size);
+            atomic_set(&_rings[i], t);
+        } else {
+            atomic_dec(&_nrings);
+        }
+    }
+
+    h.t = t;
+    tRing = t ? t->ring() : kNoRing;
+    return t ? t->ring() : 0;
+}
+
+// the ring of the thread is full, replace it with a larger one, up to 
+// max_log_buffer_size. Return NULL if it can't grow.
+LogRing* LevelLogger::grow_ring() {
+    ThreadLog* const t = thread_log_holder().t;
+    LogRing* const r = t ? t->grow(_config->max_log_buffer_size) : 0;
+    if (r) tRing = r;
+    return r;
+}
+
+// merge logs in fs (from the shared buffer) with logs in the per-thread rings 
+// in time order, and format time of the logs from their timestamps. st is 
+// timestamps of logs in fs. Logs in rings later than @until are left to the 
+// next call, as logs in the shared buffer after it are.
+void LevelLogger::collect(std::unique_ptr<fastream>& fs, std::vector<LogStamp>& st, int64 until) {
+    _runs.clear();
+    _runs.push_back(0);
+
+    // logs in a ring are already in order
+    const uint32 n = atomic_get(&_nrings);
+    for (uint32 i = 0; i < n; ++i) {
+        ThreadLog* t = atomic_get(&_rings[i]);
+        if (t == 0) continue; // not published yet
+        t->collect([this, until](LogRing* r) {
+            r->collect(until, [this](char* s, size_t len, int64 ts, uint32 type) {
+                LogRing::Rec x = { ts, s, (uint32)len, type };
+                _recs.push_back(x);
+            });
+            if (_recs.size() > _runs.back()) _runs.push_back(_recs.size());
+        });
+    }
+
+    _clock.calibrate();
+
+    // logs in fs are formatted in place if there are no logs in rings
+    if (_recs.empty()) {
+        size_t beg = 0;
+        for (size_t i = 0; i < st.size(); ++i) {
+            this->set_time((char*)fs->data() + beg, st[i].end - beg, st[i].ts);
+            beg = st[i].end;
+        }
+    } else {
+        size_t beg = 0;
+        for (size_t i = 0; i < st.size(); ++i) {
+            LogRing::Rec r = { st[i].ts, fs->data() + beg, (uint32)(st[i].end - beg), LogRing::kText };
+            _recs.push_back(r);
+            beg = st[i].end;
+        }
+        if (_recs.size() > _runs.back()) _runs.push_back(_recs.size());
+
+        const size_t nrun = _runs.size() - 1;
+        auto cmp = [](const LogRing::Rec& a, const LogRing::Rec& b) { return a.ts < b.ts; };
+        for (size_t w = 1; w < nrun; w <<= 1) {
+            for (size_t i = 0; i + w < nrun; i += (w << 1)) {
+                const size_t e = (i + (w << 1) < nrun) ? i + (w << 1) : nrun;
+                std::inplace_merge(
+                    _recs.begin() + _runs[i], _recs.begin() + _runs[i + w],
+                    _recs.begin() + _runs[e], cmp
+                );
+            }
+        }
+
+        fastream& m = *_merged;
+        for (size_t i = 0; i < _recs.size(); ++i) {
+            const LogRing::Rec& x = _recs[i];
+            if (x.type == LogRing::kText) {
+                const size_t pos = m.size();
+                m.append(x.s, x.n);
+                this->set_time((char*)m.data() + pos, x.n, x.ts);
+            } else {
+                this->add_bin_log(x, &m);
+            }
+        }
+        fs.swap(_merged);
+        _merged->clear();
+    }
+    _recs.clear();
+    st.clear();
+
+    for (uint32 i = 0; i < n; ++i) {
+        ThreadLog* t = atomic_get(&_rings[i]);
+        if (t == 0) continue;
+        t->consume();
+        if (t->state() == ThreadLog::kDead && t->empty()) t->set_state(ThreadLog::kFree);
+    }
+}
+
+// write logs in the rings as they are with the current log time, only called 
+// on failures, when the logging thread has stopped. Binary logs are formatted 
+// to the log file in _merged, which has been reserved.
+void LevelLogger::drain(const char* time) {
+    const uint32 n = atomic_get(&_nrings);
+    for (uint32 i = 0; i < n; ++i) {
+        ThreadLog* t = atomic_get(&_rings[i]);
+        if (t == 0) continue;
+        t->collect([this, time](LogRing* r) {
+            r->collect(MAX_INT64, [this, time](char* s, size_t len, int64, uint32 type) {
+                if (type == LogRing::kText) {
+                    memcpy(s + 1, time, log_time_t::total_size);
+                    _log_file.write(s, len);
+                } else {
+                    BinLogHead h;
+                    memcpy(&h, s, sizeof(h));
+                    _merged->clear();
+                    format_bin_log(*h.site, h, time, s + sizeof(h), s + len, _merged.get());
+                    _log_file.write(_merged->data(), _merged->size());
+                }
+            });
+        });
+    }
+}
+
+char* LevelLogger::begin_bin_log(const BinLogSite* site, char** e, size_t* n) {
+    BinLogHead h = { current_thread_id(), -1, 0, 0, site };
+    if (unlikely(gLogExtra & kCoId)) {
+        co::xx::Scheduler* s = co::xx::scheduler();
+        if (s && s->running()) {
+            h.sched = s->id();
+            h.co = s->coroutine_id();
+        }
+    }
+
+    LogRing* r = tRing;
+    if (unlikely(r <= kNoRing)) r = (r == kNoRing) ? 0 : this->new_ring();
+    if (r && !r->reserved()) {
+        const uint32 size = (uint32)_config->max_log_size;
+        char* p = r->reserve(size);
+        if (p == 0 && (r = this->grow_ring())) p = r->reserve(size);
+        if (p) {
+            memcpy(p, &h, sizeof(h));
+            *e = p + size;
+            return p + sizeof(h);
+        }
+    }
+
+    // no ring for it, encode it in xxLog
+    if (unlikely(xxLog == 0)) xxLog = new fastream(128);
+    *n = xxLog->size();
+    xxLog->append(&h, sizeof(h));
+    return 0;
+}
+
+// format a binary log encoded in xxLog now, and push it as a text log
+void LevelLogger::push_bin_log(char* s, size_t n) {
+    static __thread fastream* fs = 0;
+    if (fs == 0) fs = new fastream(256);
+    BinLogHead h;
+    memcpy(&h, s, sizeof(h));
+    format_bin_log(*h.site, h, this->log_time(), s + sizeof(h), s + n, fs);
+    this->push((char*)fs->data(), fs->size());
+    fs->clear();
+}
+
+/**
+ * format a binary log to fs, or append it to _bin as it is if log_bin_file is 
+ * true. Records in _bin: 
+ *   - 'H' + size(4) + version(4): the beginning of the file, written when the 
+ *     file is opened. Ids of sites are valid until the next 'H' record. 
+ *   - 'S' + size(4) + id(4) + level(4) + line(4) + file: a site, written before 
+ *     the first log of it. 
+ *   - 'L' + size(4) + time(8) + BinLogHead without the site + arguments: a log, 
+ *     time is epoch time in microseconds. 
+ */
+void LevelLogger::add_bin_log(const LogRing::Rec& x, fastream* fs) {
+    BinLogHead h;
+    memcpy(&h, x.s, sizeof(h));
+    const int64 us = _clock.to_epoch_us(x.ts);
+    if (!FLG_log_bin_file) {
+        format_bin_log(*h.site, h, this->format_time(us), x.s + sizeof(h), x.s + x.n, fs);
+        return;
+    }
+
+    fastream& b = *_bin;
+    uint32& id = _bin_ids[h.site];
+    if (id == 0) {
+        id = (uint32)_bin_ids.size();
+        const size_t len = strlen(h.site->file);
+        b.append('S').append((uint32)(12 + len)).append(id);
+        b.append((uint32)h.site->level).append(h.site->line).append(h.site->file, len);
+    }
+
+    h.id = id;
+    const size_t nh = offsetof(BinLogHead, site);
+    b.append('L').append((uint32)(8 + nh + x.n - sizeof(h))).append(us);
+    b.append(&h, nh).append(x.s + sizeof(h), x.n - sizeof(h));
+}
+
+// write binary logs to xx.bin, which is moved to xx_1.bin when it is larger 
+// than max_log_file_size, only one old file is kept.
+void LevelLogger::write_bin() {
+    if (!_bin_file) {
+        if (!fs::exists(_config->log_dir)) fs::mkdir(_config->log_dir, true);
+        fastring path(_path_base + ".bin");
+        if (!_bin_file.open(path, 'a')) {
+            printf("failed to open the binary log file: %s\n", path.c_str());
+            _bin->clear();
+            _bin_ids.clear();
+            return;
+        }
+        fastream h(16);
+        h.append('H').append((uint32)4).append((uint32)1);
+        _bin_file.write(h.data(), h.size());
+    }
+
+    _bin_file.write(_bin->data(), _bin->size());
+    _bin->clear();
+
+    if (_bin_file.size() >= FLG_max_log_file_size) {
+        fastring path = _bin_file.path();
+        _bin_file.close();
+        _bin_ids.clear();
+        fastring old(_path_base + "_1.bin");
+        fs::remove(old);
+        fs::rename(path, old);
+    }
+}
+
+const char* TimeFormatter::format(int64 us) {
+    const time_t sec = (time_t)(us / 1000000);
+    if (sec != _sec) {
+        struct tm t;
+      #ifdef _WIN32
+        _localtime64_s(&t, &sec);
+      #else
+        localtime_r(&sec, &t);
+      #endif
+        strftime(_buf, 16, "%m%d %H:%M:%S", &t);
+        _sec = sec;
+    }
+
+    const uint32 ms = (uint32)(us / 1000 - (int64)sec * 1000);
+    char* p = _buf + log_time_t::size;
+    p[0] = '.';
+    p[1] = (char)('0' + ms / 100);
+    p[2] = (char)('0' + ms % 100 / 10);
+    p[3] = (char)('0' + ms % 10);
+    return _buf;
+}
+
+template<typename T>
+inline bool read_arg(const char*& p, const char* end, T& v) {
+    if (end - p < (ptrdiff_t)sizeof(T)) return false;
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+// format a binary log to text, see BinLogSaver in log.h. Arguments of the log 
+// are in [p, end).
+void format_bin_log(
+    const BinLogSite& site, const BinLogHead& h, const char* time,
+    const char* p, const char* end, fastream* fs
+) {
+    fs->append("DIWEF"[site.level]).append(time, log_time_t::total_size);
+    (*fs) << ' ' << h.tid;
+    if (h.sched >= 0) (*fs) << " S" << h.sched << ".C" << h.co;
+    (*fs) << ' ' << site.file << ':' << site.line << ']' << ' ';
+
+    union { char c; int32 i; uint32 u; int64 I; uint64 U; double d; } v;
+    bool ok = true;
+    while (ok && p < end) {
+        switch (*p++) {
+          case 'b':
+            if ((ok = read_arg(p, end, v.c))) (*fs) << (v.c != 0);
+            break;
+          case 'c':
+            if ((ok = read_arg(p, end, v.c))) fs->append(v.c);
+            break;
+          case 'i':
+            if ((ok = read_arg(p, end, v.i))) (*fs) << v.i;
+            break;
+          case 'u':
+            if ((ok = read_arg(p, end, v.u))) (*fs) << v.u;
+            break;
+          case 'I':
+            if ((ok = read_arg(p, end, v.I))) (*fs) << v.I;
+            break;
+          case 'U':
+            if ((ok = read_arg(p, end, v.U))) (*fs) << v.U;
+            break;
+          case 'd':
+            if ((ok = read_arg(p, end, v.d))) (*fs) << v.d;
+            break;
+          case 'p':
+            if ((ok = read_arg(p, end, v.U))) (*fs) << (const void*)v.U;
+            break;
+          case 's':
+            if ((ok = read_arg(p, end, v.u) && (size_t)(end - p) >= v.u)) {
+                fs->append(p, v.u);
+                p += v.u;
+            }
+            break;
+          default:
+            ok = false; // broken log
+        }
+    }
+    fs->append('\n');
 }
 
 inline void LevelLogger::init_config() {
@@ -179,14 +1712,34 @@ inline void LevelLogger::init_config() {
         if (nlog < 128) nlog = 128;
         if ((uint32)nlog >= (nbuf >> 1)) nlog = (int32)((nbuf >> 1) - 1);
 
+        // power of 2, and large enough for a few logs
+        uint32 nring = FLG_log_thread_buffer_size;
+        if (nring < ((uint32)nlog << 2)) nring = (uint32)nlog << 2;
+        if (nring < (64 << 10)) nring = (64 << 10);
+        _config->thread_buffer_size = 1;
+        while (_config->thread_buffer_size < nring) _config->thread_buffer_size <<= 1;
+
         if (FLG_max_log_file_num <= 0) FLG_max_log_file_num = 8;
         if (FLG_max_log_file_size <= 0) FLG_max_log_file_size = 256 << 20;
+        _path_base = path::join(_config->log_dir, _config->log_file_name);
+
+      #ifndef HAS_ZLIB
+        if (FLG_log_compress) {
+            printf("log_compress ignored as zlib is not available, build with WITH_ZLIB=ON\n");
+            FLG_log_compress = false;
+        }
+      #endif
     }
 }
 
 void LevelLogger::init() {
     this->init_config();
+    this->init_sinks();
     _fs->reserve(1024*1024);
+    _st->reserve(16384);
+    _merged->reserve(1024*1024);
+    _recs.reserve(8192);
+    atomic_set(&_ready, true);
     _log_thread.reset(new Thread(&LevelLogger::thread_fun, this));
 }
 
@@ -195,11 +1748,19 @@ void LevelLogger::stop() {
     _log_event.signal();
     if (_log_thread != NULL) _log_thread->join();
 
-    MutexGuard g(_log_mutex);
-    if (!_fs->empty()) {
-        this->write(_fs.get());
-        _fs->clear();
+    {
+        MutexGuard g(_log_mutex);
+        this->collect(_fs, *_st, MAX_INT64);
+        if (!_fs->empty()) {
+            this->write(_fs.get());
+            _fs->clear();
+        }
+        if (!_bin->empty()) this->write_bin();
+        _log_file.close();
+        _bin_file.close();
     }
+    this->flush_sinks();
+    _rotator.stop();
 }
 
 // Try to call only async-signal-safe api in this function according to:
@@ -216,61 +1777,206 @@ void LevelLogger::safe_stop() {
       #endif
     }
 
-    if (!_fs->empty()) {
-        this->write(_fs.get());
-        _fs->clear();
+    // write the shared buffer and logs in the rings as they are, with the 
+    // current log time, without merging or formatting the time.
+    if (_log_file || this->open_log_file()) {
+        this->set_log_time();
+        _log_file.write(_fs->data(), _fs->size());
+        this->drain(this->log_time());
     }
+    _fs->clear();
+    _log_file.close();
 }
 
 void LevelLogger::thread_fun() {
     std::unique_ptr<fastream> fs(new fastream(1024*1024));
+    std::unique_ptr<std::vector<LogStamp>> st(new std::vector<LogStamp>());
+    st->reserve(16384);
+    int64 suppressed_ms = now::ms() + 1000;
 
     while (!_stop) {
         bool signaled = _log_event.wait(FLG_log_flush_ms);
         if (_stop) break;
 
         const char* s = _log_time.update();
+        int64 until;
         {
             MutexGuard g(_log_mutex);
-            if (s) _t.update(s);
-            _t.update_ms(_log_time.ms());
-            if (!_fs->empty()) _fs.swap(fs);
+            this->update_log_time(s);
+            until = _clock.ticks();
+            if (!_fs->empty()) { _fs.swap(fs); _st.swap(st); }
             if (signaled) _log_event.reset();
         }
+        this->collect(fs, *st, until);
+        this->report_dropped(fs.get());
+        if (now::ms() >= suppressed_ms) {
+            this->report_suppressed(fs.get());
+            suppressed_ms = now::ms() + 1000;
+        }
 
         if (!fs->empty()) {
             this->write(fs.get());
             fs->clear();
         }
+        if (!_bin->empty()) this->write_bin();
     }
 
     atomic_swap(&_stop, 2);
 }
 
+void LevelLogger::report_suppressed(fastream* fs) {
+    const int64 now = now::us();
+    for (LogLimiter* l = atomic_get(&g_limiters); l; l = l->next) {
+        if (atomic_get(&l->suppressed) == 0 || atomic_get(&l->t) > now) continue;
+        const uint32 n = atomic_swap(&l->suppressed, 0u);
+        if (n == 0) continue;
+        fs->append("DIWEF"[l->level]).append(this->log_time(), log_time_t::total_size);
+        // no thread id, logs of the site may come from any thread
+        (*fs) << ' ' << l->file << ':' << l->line << ']' << " suppressed " << n << " logs\n";
+    }
+}
+
 inline void LevelLogger::rotate() {
-    if (!_file) return;
-    if (!_file.exists() || _file.size() >= FLG_max_log_file_size) {
-        _file.close();
+    if (!_log_file) return;
+    if (!_log_file.exists()) { /* removed by others */
+        _log_file.close();
+        return;
+    }
+
+    if (_log_file.size() >= FLG_max_log_file_size || 
+        (_rotate_at > 0 && epoch::ms() / 1000 >= _rotate_at)) {
+        fastring path = _log_file.path();
+        _log_file.close();
+        this->rotate_file(path);
+    }
+}
+
+// rename the log file to a pending file, the rotator will do the rest
+void LevelLogger::rotate_file(const fastring& path) {
+    fastring p(_path_base.size() + 32);
+    p << _path_base << '_' << epoch::ms() << '_' << (_nrotate++) << ".rotating";
+    if (fs::rename(path, p)) {
+        _rotator.push(_path_base, std::move(p));
+    } else {
+        printf("failed to rename the log file: %s\n", path.c_str());
     }
 }
 
+// the next time to rotate the log file by log_rotate_sec, aligned to local time
+int64 LevelLogger::next_rotate_time(int64 now) const {
+    const int64 n = FLG_log_rotate_sec;
+    if (n == 0) return 0;
+
+    int64 off = 0; // offset of local time to UTC
+    const time_t t = (time_t)now;
+    struct tm tm;
+  #ifdef _WIN32
+    _localtime64_s(&tm, &t);
+    long tz = 0;
+    _get_timezone(&tz);
+    off = -tz + (tm.tm_isdst > 0 ? 3600 : 0);
+  #else
+    localtime_r(&t, &tm);
+    off = tm.tm_gmtoff;
+  #endif
+    return ((now + off) / n + 1) * n - off;
+}
+
 void LevelLogger::write(fastream* fs) {
-    fs::file& f = _file;
+    LogFile& f = _log_file;
     if (f || this->open_log_file()) {
+        const int64 us = now::us();
         f.write(fs->data(), fs->size());
+        if (FLG_log_fsync_ms >= 0) {
+            const int64 ms = us / 1000;
+            if (FLG_log_fsync_ms == 0 || ms >= _sync_ms) {
+                f.sync();
+                _sync_ms = ms + FLG_log_fsync_ms;
+            }
+        }
+
+        const uint64 t = (uint64)(now::us() - us);
+        atomic_inc(&_stats.writes);
+        atomic_add(&_stats.bytes, (uint64)fs->size());
+        atomic_add(&_stats.total_us, t);
+        if (t > _stats.max_us) atomic_set(&_stats.max_us, t);
     }
     this->rotate();
     if (FLG_cout) fwrite(fs->data(), 1, fs->size(), stderr);
+
+    if (atomic_get(&_nsinks) > 0) {
+        MutexGuard g(_sink_mutex);
+        for (size_t i = 0; i < _sinks.size(); ++i) {
+            _sinks[i]->write(fs->data(), fs->size());
+        }
+    }
+}
+
+void LevelLogger::flush_sinks() {
+    if (atomic_get(&_nsinks) == 0) return;
+    MutexGuard g(_sink_mutex);
+    for (size_t i = 0; i < _sinks.size(); ++i) _sinks[i]->flush();
+}
+
+// write logs in memory sinks to the fatal file. It is called on failures, 
+// no lock is waited for, as the failed thread may hold it, and no memory is 
+// allocated.
+void LevelLogger::dump_memory_sinks() {
+    if (atomic_get(&_nsinks) == 0) return;
+    if (!_sink_mutex.try_lock()) {
+        _file.write(">>>> logs in memory skipped, the sinks are in use\n");
+        return;
+    }
+    for (size_t i = 0; i < _memory_sinks.size(); ++i) {
+        _file.write(">>>> logs in memory:\n");
+        const bool ok = _memory_sinks[i]->dump([this](const char* s, size_t n) {
+            _file.write(s, n);
+        });
+        _file.write(ok ? "<<<<\n" : "skipped, the sink is in use\n<<<<\n");
+    }
+    _sink_mutex.unlock();
+}
+
+// sinks set by flags
+void LevelLogger::init_sinks() {
+    static const char* names[] = { "debug", "info", "warning", "error", "fatal" };
+    auto v = str::split(FLG_log_level_files, ',');
+    for (size_t i = 0; i < v.size(); ++i) {
+        fastring x = str::strip(v[i]);
+        if (x.empty()) continue;
+        int level = -1;
+        for (int k = 0; k < 5; ++k) {
+            if (x == names[k] || (x.size() == 1 && x[0] == '0' + k)) { level = k; break; }
+        }
+        if (level < 0) {
+            printf("invalid level in log_level_files: %s\n", x.c_str());
+            continue;
+        }
+        fastring path(_path_base.size() + 16);
+        path << _path_base << '.' << names[level] << ".log";
+        this->add_sink(new FileSink(path.c_str(), level));
+    }
+
+    if (!FLG_log_syslog.empty()) {
+        const size_t p = FLG_log_syslog.rfind(':');
+        const fastring ip = p != FLG_log_syslog.npos ? FLG_log_syslog.substr(0, p) : FLG_log_syslog;
+        const int port = p != FLG_log_syslog.npos ? atoi(FLG_log_syslog.c_str() + p + 1) : 514;
+        this->add_sink(new UdpSink(ip.c_str(), port, 0));
+    }
 }
 
 void LevelLogger::push_fatal_log(fastream* log) {
     log::close();
 
-    memcpy((char*)log->data() + 1, _t.data, _t.total_size);
+    // the logging thread has stopped, the time can be formatted here
+    memcpy((char*)log->data() + 1, this->format_time(epoch::us()), log_time_t::total_size);
     this->write(log);
+    _log_file.close();
+    this->flush_sinks();
     if (!FLG_cout) fwrite(log->data(), 1, log->size(), stderr);
 
     if (this->open_log_file(fatal)) {
+        this->dump_memory_sinks();
         _file.write(log->data(), log->size());
         _stack_trace->set_file(&_file);
     }
@@ -280,30 +1986,20 @@ void LevelLogger::push_fatal_log(fastream* log) {
 }
 
 bool LevelLogger::open_log_file(int level) {
-    static fastring path_base = path::join(_config->log_dir, _config->log_file_name);
+    const fastring& path_base = _path_base;
 
     fastring path(path_base.size() + 8);
     if (level < xx::fatal) {
         path.append(path_base).append(".log");
 
-        // rename log files:  xx.log -> xx_n.log
-        if (fs::fsize(path) >= FLG_max_log_file_size) {
-            std::vector<fastring> paths;
-            paths.push_back(path);
-
-            for (uint32 i = 1; i < FLG_max_log_file_num; ++i) {
-                fastring p(path.size() + 4);
-                p << path_base << '_' << i << ".log";
-                paths.push_back(std::move(p));
-                if (!fs::exists(paths.back())) break;
-            }
-
-            if (paths.size() == FLG_max_log_file_num) {
-                fs::remove(paths.back());
-            }
-
-            for (size_t i = paths.size() - 1; i > 0; --i) {
-                fs::rename(paths[i - 1], paths[i]);
+        // rotate the existing log file if it is too large, or it was written 
+        // before the current period of log_rotate_sec.
+        const int64 now = epoch::ms() / 1000;
+        _rotate_at = this->next_rotate_time(now);
+        if (fs::exists(path)) {
+            if (fs::fsize(path) >= FLG_max_log_file_size || 
+                (_rotate_at > 0 && fs::mtime(path) < _rotate_at - (int64)FLG_log_rotate_sec)) {
+                this->rotate_file(path);
             }
         }
     } else {
@@ -311,7 +2007,8 @@ bool LevelLogger::open_log_file(int level) {
     }
 
     if (!fs::exists(_config->log_dir)) fs::mkdir(_config->log_dir, true);
-    if (!_file.open(path.c_str(), 'a')) {
+    const bool ok = level < xx::fatal ? _log_file.open(path, FLG_log_writer) : _file.open(path, 'a');
+    if (!ok) {
         printf("failed to open the log file: %s\n", path.c_str());
         return false;
     }
@@ -342,6 +2039,80 @@ void push_level_log(char* s, size_t n) {
     level_logger()->push(s, n);
 }
 
+char* begin_bin_log(const BinLogSite* site, char** e, size_t* n) {
+    return level_logger()->begin_bin_log(site, e, n);
+}
+
+void end_bin_log(char* p) {
+    level_logger()->end_bin_log(p);
+}
+
+void push_bin_log(char* s, size_t n) {
+    level_logger()->push_bin_log(s, n);
+}
+
+} // namespace xx
+
+uint64 dropped_logs() {
+    return xx::level_logger()->dropped_logs();
+}
+
+uint64 dropped_bytes() {
+    return xx::level_logger()->dropped_bytes();
+}
+
+void add_sink(Sink* s) {
+    xx::level_logger()->add_sink(s);
+}
+
+Sink* new_file_sink(const char* path, int level) {
+    return new xx::FileSink(path, level);
+}
+
+Sink* new_udp_sink(const char* ip, int port, int level) {
+    return new xx::UdpSink(ip, port, level);
+}
+
+MemorySink::MemorySink(size_t cap, bool dump_on_fatal)
+    : _cap(cap < 4096 ? 4096 : cap), _pos(0), _full(false), _dump_on_fatal(dump_on_fatal) {
+    _buf = (char*) malloc(_cap);
+}
+
+MemorySink::~MemorySink() {
+    free(_buf);
+}
+
+void MemorySink::write(const char* s, size_t n) {
+    MutexGuard g(_mtx);
+    if (n >= _cap) {
+        memcpy(_buf, s + n - _cap, _cap);
+        _pos = 0;
+        _full = true;
+        return;
+    }
+
+    const size_t x = _cap - _pos;
+    if (n < x) {
+        memcpy(_buf + _pos, s, n);
+        _pos += n;
+    } else {
+        memcpy(_buf + _pos, s, x);
+        memcpy(_buf, s + x, n - x);
+        _pos = n - x;
+        _full = true;
+    }
+}
+
+fastring MemorySink::dump() const {
+    MutexGuard g(_mtx);
+    if (!_full) return fastring(_buf, _pos);
+    fastring s(_cap);
+    s.append(_buf + _pos, _cap - _pos).append(_buf, _pos);
+    return s;
+}
+
+namespace xx {
+
 LogTime::LogTime() {
     memset(_buf, 0, sizeof(_buf));
 
@@ -405,6 +2176,185 @@ const char* LogTime::update() {
     return _buf;
 }
 
+/**
+ * min log levels of source files 
+ *   - Call sites are linked once evaluated, so that their cached levels can be 
+ *     updated when the patterns or min_log_level changed. 
+ */
+class LogLevels {
+  public:
+    LogLevels() : _sites(0) {}
+
+    bool init_site(LogSite* s, int level, const char* file) {
+        MutexGuard g(_mtx);
+        if (s->level < 0) {
+            s->file = file;
+            s->next = _sites;
+            _sites = s;
+            atomic_set(&s->level, this->level_of(file));
+        }
+        return s->level <= level;
+    }
+
+    void set(const char* pattern, int level) {
+        MutexGuard g(_mtx);
+        this->set_rule(pattern, level);
+        this->refresh();
+    }
+
+    // parse patterns like "so/*=0,json.cc=warning"
+    void parse(const fastring& s);
+
+    void refresh_all() {
+        MutexGuard g(_mtx);
+        this->refresh();
+    }
+
+  private:
+    struct Rule {
+        fastring pattern;
+        int32 level;
+    };
+
+    void set_rule(const char* pattern, int level);
+    int32 level_of(const char* file) const;
+    void refresh() {
+        for (LogSite* s = _sites; s; s = s->next) {
+            atomic_set(&s->level, this->level_of(s->file));
+        }
+    }
+
+  private:
+    Mutex _mtx;
+    std::vector<Rule> _rules;
+    LogSite* _sites;
+};
+
+inline LogLevels& log_levels() {
+    static LogLevels* levels = new LogLevels;
+    return *levels;
+}
+
+// glob match, '*' matches any characters, '?' matches a single character.
+static bool glob_match(const char* p, const char* s) {
+    const char* star = 0;
+    const char* ss = s;
+    while (*s) {
+        if (*p == '?' || *p == *s) {
+            ++p; ++s;
+        } else if (*p == '*') {
+            star = p++;
+            ss = s;
+        } else if (star) {
+            p = star + 1;
+            s = ++ss;
+        } else {
+            return false;
+        }
+    }
+    while (*p == '*') ++p;
+    return *p == '\0';
+}
+
+void LogLevels::set_rule(const char* pattern, int level) {
+    for (size_t i = 0; i < _rules.size(); ++i) {
+        if (_rules[i].pattern == pattern) {
+            _rules.erase(_rules.begin() + i);
+            break;
+        }
+    }
+    if (level >= 0) {
+        Rule r = { pattern, level > fatal ? (int32)fatal : (int32)level };
+        _rules.push_back(std::move(r));
+    }
+}
+
+int32 LogLevels::level_of(const char* file) const {
+    for (size_t i = _rules.size(); i > 0; --i) {
+        const char* p = _rules[i - 1].pattern.c_str();
+        if (glob_match(p, file)) return _rules[i - 1].level;
+        for (const char* s = file; *s; ++s) {
+            if ((*s == '/' || *s == '\\') && glob_match(p, s + 1)) {
+                return _rules[i - 1].level;
+            }
+        }
+    }
+    const int32 x = FLG_min_log_level;
+    return x < 0 ? 0 : x;
+}
+
+void LogLevels::parse(const fastring& s) {
+    static const char* names[] = { "debug", "info", "warning", "error", "fatal" };
+    auto v = str::split(s, ',');
+
+    MutexGuard g(_mtx);
+    for (size_t i = 0; i < v.size(); ++i) {
+        fastring x = str::strip(v[i]);
+        if (x.empty()) continue;
+
+        const size_t p = x.rfind('=');
+        int level = -1;
+        if (p != x.npos) {
+            fastring name = str::strip(x.substr(p + 1));
+            if (name.size() == 1 && '0' <= name[0] && name[0] <= '4') {
+                level = name[0] - '0';
+            } else {
+                for (int k = 0; k < 5; ++k) {
+                    if (name == names[k]) { level = k; break; }
+                }
+            }
+        }
+
+        if (level < 0) {
+            printf("invalid log level: %s\n", x.c_str());
+            continue;
+        }
+        this->set_rule(str::strip(x.substr(0, p)).c_str(), level);
+    }
+    this->refresh();
+}
+
+bool init_log_site(LogSite* s, int level, const char* file) {
+    return log_levels().init_site(s, level, file);
+}
+
+inline uint32 on_log_suppressed(LogLimiter* l) {
+    atomic_inc(&l->suppressed);
+    if (l->linked == 0 && atomic_compare_swap(&l->linked, 0u, 1u) == 0u) {
+        LogLimiter* head;
+        do {
+            head = atomic_get(&g_limiters);
+            l->next = head;
+        } while (atomic_compare_swap(&g_limiters, head, l) != head);
+    }
+    return 0;
+}
+
+uint32 log_every_ms(LogLimiter* l, int64 ms) {
+    const int64 now = now::us();
+    const int64 t = atomic_get(&l->t);
+    if (now >= t && atomic_compare_swap(&l->t, t, now + ms * 1000) == t) {
+        return atomic_swap(&l->suppressed, 0u) + 1;
+    }
+    return on_log_suppressed(l);
+}
+
+// GCRA, l->t is the theoretical arrival time of the next log
+uint32 log_rate(LogLimiter* l, uint32 n) {
+    if (n == 0) return on_log_suppressed(l);
+    const int64 dt = 1000000 / n;
+    const int64 now = now::us();
+    while (true) {
+        const int64 t = atomic_get(&l->t);
+        const int64 x = t > now ? t : now;
+        if (x - now > dt * (n - 1)) break; // no token left
+        if (atomic_compare_swap(&l->t, t, x + dt) == t) {
+            return atomic_swap(&l->suppressed, 0u) + 1;
+        }
+    }
+    return on_log_suppressed(l);
+}
+
 void LogTime::reset(time_t sec) {
     if (sec != 0) {
         _start = sec;
@@ -428,9 +2378,100 @@ void init() {
     static bool initialized = false;
     if (atomic_compare_swap(&initialized, false, true) == false) {
         xx::level_logger()->init();
+        xx::log_levels().parse(FLG_log_levels);
+        if (FLG_log_co_id) atomic_or(&xx::gLogExtra, (uint32)xx::kCoId);
+    }
+}
+
+WriteStats write_stats() {
+    return xx::level_logger()->write_stats();
+}
+
+// see LevelLogger::add_bin_log() for records in a binary log file
+bool decode_bin_logs(const char* s, size_t n, fastream& out) {
+    struct Site {
+        fastring file;
+        xx::BinLogSite site;
+    };
+    std::vector<std::unique_ptr<Site>> sites;
+    xx::TimeFormatter tf;
+    const size_t nh = offsetof(xx::BinLogHead, site);
+    const char* p = s;
+    const char* const end = s + n;
+
+    while (p < end) {
+        const char c = *p++;
+        uint32 len;
+        if (!xx::read_arg(p, end, len) || (size_t)(end - p) < len) return false;
+        const char* const e = p + len;
+        if (p == s + 5 && c != 'H') return false;
+
+        if (c == 'H') {
+            sites.clear();
+        } else if (c == 'S') {
+            uint32 id, line;
+            int32 level;
+            if (!xx::read_arg(p, e, id) || !xx::read_arg(p, e, level) || !xx::read_arg(p, e, line)) return false;
+            if (id == 0 || level < xx::debug || level > xx::fatal) return false;
+            if (sites.size() < id) sites.resize(id);
+            sites[id - 1].reset(new Site);
+            Site& x = *sites[id - 1];
+            x.file.append(p, e - p);
+            x.site.file = x.file.c_str();
+            x.site.line = line;
+            x.site.level = level;
+        } else if (c == 'L') {
+            int64 us;
+            xx::BinLogHead h;
+            if (!xx::read_arg(p, e, us) || e - p < (ptrdiff_t)nh) return false;
+            memcpy(&h, p, nh);
+            if (h.id == 0 || h.id > sites.size() || !sites[h.id - 1]) return false;
+            xx::format_bin_log(sites[h.id - 1]->site, h, tf.format(us), p + nh, e, &out);
+        }
+        p = e; // other records are skipped
+    }
+    return true;
+}
+
+void set_context(const char* key, const char* value, size_t n) {
+    xx::LogContext* c = xx::log_context(true);
+    size_t i = 0;
+    for (; i < c->kv.size(); ++i) {
+        if (c->kv[i].first == key) break;
+    }
+    if (i == c->kv.size()) c->kv.push_back(std::make_pair(fastring(key), fastring()));
+    c->kv[i].second.clear();
+    c->kv[i].second.append(value, n);
+    c->format();
+    if (!(xx::gLogExtra & xx::kContext)) atomic_or(&xx::gLogExtra, (uint32)xx::kContext);
+}
+
+void del_context(const char* key) {
+    xx::LogContext* c = xx::log_context(false);
+    if (c == 0) return;
+    for (size_t i = 0; i < c->kv.size(); ++i) {
+        if (c->kv[i].first == key) {
+            c->kv.erase(c->kv.begin() + i);
+            c->format();
+            return;
+        }
     }
 }
 
+void clear_context() {
+    xx::LogContext* c = xx::log_context(false);
+    if (c) xx::clear_log_context(c);
+}
+
+void set_log_level(const char* pattern, int level) {
+    xx::log_levels().set(pattern, level);
+}
+
+void set_min_log_level(int level) {
+    FLG_min_log_level = level;
+    xx::log_levels().refresh_all();
+}
+
 void close() {
     xx::level_logger()->stop();
 }
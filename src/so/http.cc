@@ -793,10 +793,10 @@ void ServerImpl::on_connection(tcp::Connection* conn) {
     ELOG << "http recv error: header too long";
     goto err_end;
   recv_err:
-    ELOG << "http recv error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "http recv error: " << conn->strerror();
     goto err_end;
   send_err:
-    ELOG << "http send error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "http send error: " << conn->strerror();
     goto err_end;
   chunk_err:
     ELOG << "http invalid chunked data..";
@@ -17,20 +17,40 @@ DEF_int32(rpc_conn_timeout, 3000, "#2 connect timeout in ms");
 DEF_int32(rpc_conn_idle_sec, 180, "#2 connection may be closed if no data was recieved for n seconds");
 DEF_int32(rpc_max_idle_conn, 128, "#2 max idle connections");
 DEF_bool(rpc_log, true, "#2 enable rpc log if true");
+DEF_bool(rpc_msgpack, false, "#2 rpc client uses msgpack instead of json if the server supports it");
 
 #define RPCLOG LOG_IF(FLG_rpc_log)
 
 namespace rpc {
 
 struct Header {
-    uint16 info;  // reserved
+    uint16 info;  // flags below
     uint16 magic; // 0x7777
     uint32 len;   // body len
 }; // 8 bytes
 
 static const uint16 kMagic = 0x7777;
 
-inline void set_header(void* header, int msg_len) {
+// Flags in Header::info, which select the encoding of the body per connection.
+//   - A client with -rpc_msgpack sends kAcceptMsgpack with json requests. 
+//     The server replies in msgpack with kMsgpack set, and then the client 
+//     sends msgpack requests on this connection. 
+//   - Old servers ignore the flags and reply in json, so the connection stays 
+//     on json. Old versions left info uninitialized, a value with any other 
+//     bits set is taken as 0.
+static const uint16 kMsgpack = 0x0001;       // the body is msgpack
+static const uint16 kAcceptMsgpack = 0x0002; // the client can take msgpack
+
+inline uint16 get_info(const Header& header) {
+    const uint16 x = ntoh16(header.info);
+    return (x & ~(kMsgpack | kAcceptMsgpack)) ? 0 : x;
+}
+
+// bodies larger than this are parsed by json::StreamParser as they arrive
+static const int kStreamThreshold = 64 * 1024;
+
+inline void set_header(void* header, int msg_len, uint16 info=0) {
+    ((Header*) header)->info = hton16(info);
     ((Header*) header)->magic = kMagic;
     ((Header*) header)->len = hton32(msg_len);
 }
@@ -168,8 +188,10 @@ void ServerImpl::on_connection(tcp::Connection* conn) {
     atomic_inc(&_conn_num);
 
     int r = 0, len = 0;
+    uint16 info = 0;
     Header header;
     fastring* buf = 0;
+    std::unique_ptr<json::StreamParser> sp;
     Json req, res;
 
     while (true) {
@@ -196,14 +218,52 @@ void ServerImpl::on_connection(tcp::Connection* conn) {
             len = ntoh32(header.len);
             if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
 
+            info = get_info(header);
             if (buf == NULL) buf = (fastring*) _buffer.pop();
-            buf->resize(len);
-            r = conn->recvn((char*)buf->data(), len, FLG_rpc_recv_timeout);
-            if (unlikely(r == 0)) goto recv_zero_err;
-            if (unlikely(r < 0)) goto recv_err;
-
-            req = json::parse(buf->data(), buf->size());
-            if (req.is_null()) goto json_parse_err;
+            if (info & kMsgpack) {
+                buf->resize(len);
+                r = conn->recvn((char*)buf->data(), len, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+
+                if (!req.parse_msgpack(buf->data(), buf->size())) goto msgpack_parse_err;
+
+            } else if (len <= kStreamThreshold) {
+                buf->resize(len);
+                r = conn->recvn((char*)buf->data(), len, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+
+                // parse in place, strings of req point to buf until the next req
+                if (!req.parse_from(*buf, json::kInSitu) || req.is_null()) goto json_parse_err;
+
+            } else {
+                // large body, parse it while receiving, no contiguous buffer needed
+                if (!sp) sp.reset(new json::StreamParser);
+                buf->resize(kStreamThreshold);
+                // the timeout is for the whole body, as recvn() above
+                const int64 deadline = now::ms() + FLG_rpc_recv_timeout;
+                int x = 0;
+                for (int remain = len; remain > 0; remain -= r) {
+                    int ms = -1;
+                    if (FLG_rpc_recv_timeout >= 0) {
+                        ms = (int)(deadline - now::ms());
+                        if (unlikely(ms <= 0)) goto recv_timeout_err;
+                    }
+                    r = conn->recv((char*)buf->data(), remain < kStreamThreshold ? remain : kStreamThreshold, ms);
+                    if (unlikely(r == 0)) goto recv_zero_err;
+                    if (unlikely(r < 0)) goto recv_err;
+                    // keep feeding after the document is complete, anything but 
+                    // white spaces after it is an error
+                    if (x >= 0) x = sp->feed(buf->data(), r);
+                }
+                if (x < 0 || !sp->finish()) {
+                    sp->reset();
+                    goto stream_parse_err;
+                }
+                req = std::move(sp->result());
+                sp->reset();
+            }
 
             RPCLOG << "rpc recv req: " << req;
         } while (0);
@@ -213,9 +273,15 @@ void ServerImpl::on_connection(tcp::Connection* conn) {
             res.clear();
             this->process(req, res);
 
+            // reply in msgpack if the client sent or accepts it
             buf->resize(sizeof(Header));
-            res.str(*(fastream*)buf);
-            set_header((void*)buf->data(), (int) buf->size() - sizeof(Header));
+            if (info & (kMsgpack | kAcceptMsgpack)) {
+                res.msgpack(*(fastream*)buf);
+                set_header((void*)buf->data(), (int) buf->size() - sizeof(Header), kMsgpack);
+            } else {
+                res.str(*(fastream*)buf);
+                set_header((void*)buf->data(), (int) buf->size() - sizeof(Header));
+            }
             
             r = conn->send(buf->data(), (int) buf->size(), FLG_rpc_send_timeout);
             if (unlikely(r <= 0)) goto send_err;
@@ -239,13 +305,22 @@ void ServerImpl::on_connection(tcp::Connection* conn) {
     ELOG << "rpc recv error: body too long: " << len;
     goto err_end;
   recv_err:
-    ELOG << "rpc recv error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "rpc recv error: " << conn->strerror();
+    goto err_end;
+  recv_timeout_err:
+    ELOG_RATE_LIMIT(8) << "rpc recv error: body not received in " << FLG_rpc_recv_timeout << " ms, len: " << len;
     goto err_end;
   send_err:
-    ELOG << "rpc send error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "rpc send error: " << conn->strerror();
     goto err_end;
   json_parse_err:
-    ELOG << "rpc json parse error: " << *buf;
+    ELOG << "rpc json parse error, body len: " << len; // buf was changed by the parser
+    goto err_end;
+  stream_parse_err:
+    ELOG << "rpc json parse error, body len: " << len;
+    goto err_end;
+  msgpack_parse_err:
+    ELOG << "rpc msgpack parse error, body len: " << len;
     goto err_end;
   err_end:
     conn->reset(1000);
@@ -399,10 +474,10 @@ bool ServerImpl::auth(tcp::Connection* conn) {
     LOG << "client close the connection, fd: " << conn->socket();
     return false;
   recv_err:
-    ELOG << "recv error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "recv error: " << conn->strerror();
     return false;
   send_err:
-    ELOG << "send error: " << conn->strerror();
+    ELOG_RATE_LIMIT(8) << "send error: " << conn->strerror();
     return false;
   json_parse_err:
     ELOG << "json parse error: " << fs;
@@ -412,11 +487,11 @@ bool ServerImpl::auth(tcp::Connection* conn) {
 class ClientImpl {
   public:
     ClientImpl(const char* ip, int port, bool use_ssl)
-        : _tcp_cli(ip, port, use_ssl) {
+        : _tcp_cli(ip, port, use_ssl), _msgpack(false) {
     }
 
     ClientImpl(const ClientImpl& c)
-        : _tcp_cli(c._tcp_cli), _user(c._user), _pass(c._pass) {
+        : _tcp_cli(c._tcp_cli), _user(c._user), _pass(c._pass), _msgpack(false) {
     }
 
     ~ClientImpl() = default;
@@ -439,6 +514,7 @@ class ClientImpl {
     fastring _user;
     fastring _pass;
     fastream _fs;
+    bool _msgpack; // the server replied in msgpack on this connection
 
     bool auth();
     bool connect();
@@ -475,6 +551,7 @@ void Client::ping() {
 }
 
 bool ClientImpl::connect() {
+    _msgpack = false;
     if (!_tcp_cli.connect(FLG_rpc_conn_timeout)) return false;
     if (!_pass.empty() && !this->auth()) {
         _tcp_cli.disconnect();
@@ -492,8 +569,13 @@ void ClientImpl::call(const Json& req, Json& res) {
     // send request
     do {
         _fs.resize(sizeof(Header));
-        req.str(_fs);
-        set_header((void*)_fs.data(), (int)_fs.size() - sizeof(Header));
+        if (_msgpack) {
+            req.msgpack(_fs);
+            set_header((void*)_fs.data(), (int)_fs.size() - sizeof(Header), kMsgpack);
+        } else {
+            req.str(_fs);
+            set_header((void*)_fs.data(), (int)_fs.size() - sizeof(Header), FLG_rpc_msgpack ? kAcceptMsgpack : 0);
+        }
 
         r = _tcp_cli.send(_fs.data(), (int)_fs.size(), FLG_rpc_send_timeout);
         if (unlikely(r <= 0)) goto send_err;
@@ -516,8 +598,13 @@ void ClientImpl::call(const Json& req, Json& res) {
         if (unlikely(r == 0)) goto recv_zero_err;
         if (unlikely(r < 0)) goto recv_err;
 
-        res = json::parse(_fs.c_str(), _fs.size());
-        if (res.is_null()) goto json_parse_err;
+        if (get_info(header) & kMsgpack) {
+            if (!res.parse_msgpack(_fs.data(), _fs.size())) goto msgpack_parse_err;
+            _msgpack = true;
+        } else {
+            res = json::parse(_fs.c_str(), _fs.size());
+            if (res.is_null()) goto json_parse_err;
+        }
         RPCLOG << "rpc recv res: " << res;
         return;
     } while (0);
@@ -532,14 +619,17 @@ void ClientImpl::call(const Json& req, Json& res) {
     ELOG << "rpc server close the connection..";
     goto err_end;
   recv_err:
-    ELOG << "rpc recv error: " << _tcp_cli.strerror();
+    ELOG_RATE_LIMIT(8) << "rpc recv error: " << _tcp_cli.strerror();
     goto err_end;
   send_err:
-    ELOG << "rpc send error: " << _tcp_cli.strerror();
+    ELOG_RATE_LIMIT(8) << "rpc send error: " << _tcp_cli.strerror();
     goto err_end;
   json_parse_err:
     ELOG << "rpc json parse error: " << _fs;
     goto err_end;
+  msgpack_parse_err:
+    ELOG << "rpc msgpack parse error, body len: " << len;
+    goto err_end;
   err_end:
     _tcp_cli.disconnect();
 }
@@ -644,10 +734,10 @@ bool ClientImpl::auth() {
     ELOG << "server close the connection..";
     return false;
   recv_err:
-    ELOG << "recv error: " << _tcp_cli.strerror();
+    ELOG_RATE_LIMIT(8) << "recv error: " << _tcp_cli.strerror();
     return false;
   send_err:
-    ELOG << "send error: " << _tcp_cli.strerror();
+    ELOG_RATE_LIMIT(8) << "send error: " << _tcp_cli.strerror();
     return false;
   json_parse_err:
     ELOG << "json parse error: " << fs;
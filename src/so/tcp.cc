@@ -3,11 +3,40 @@
 #include "co/so/ssl.h"
 #include "co/log.h"
 #include "co/str.h"
+#include "co/hash.h"
 
 DEF_int32(ssl_handshake_timeout, 3000, "#2 ssl handshake timeout in ms");
+DEF_bool(tcp_reuse_port, false, "#2 accept connections in every scheduler with SO_REUSEPORT (linux only)");
+DEF_uint32(tcp_max_conn, 0, "#2 max live connections of a tcp server, 0 for no limit");
+DEF_int32(tcp_accept_batch, 64, "#2 max connections accepted per wakeup of the server loop");
 
 namespace tcp {
 
+// number of live connections in a scheduler, 64 bytes to avoid false sharing.
+struct ConnCounter {
+    ConnCounter() : n(0) {}
+    int n;
+    char pad[60];
+};
+
+inline std::vector<ConnCounter>& conn_counters() {
+    static std::vector<ConnCounter> v(co::all_schedulers().size());
+    return v;
+}
+
+inline void dec_conn_num(int& sid) {
+    if (sid >= 0) {
+        atomic_dec(&conn_counters()[sid].n);
+        sid = -1;
+    }
+}
+
+int conn_num(int sched_id) {
+    auto& v = conn_counters();
+    if (sched_id < 0 || (size_t)sched_id >= v.size()) return 0;
+    return atomic_get(&v[sched_id].n);
+}
+
 int Connection::recv(void* buf, int n, int ms) {
     return co::recv(_fd, buf, n, ms);
 }
@@ -22,6 +51,7 @@ int Connection::send(const void* buf, int n, int ms) {
 
 int Connection::close(int ms) {
     if (_fd != -1) {
+        this->untrack();
         int r = co::close(_fd, ms);
         _fd = -1;
         return r;
@@ -31,6 +61,7 @@ int Connection::close(int ms) {
 
 int Connection::reset(int ms) {
     if (_fd != -1) {
+        this->untrack();
         int r = co::reset_tcp_socket(_fd, ms);
         _fd = -1;
         return r;
@@ -89,7 +120,9 @@ struct SSLConnection : public tcp::Connection {
 struct ServerParam {
     ServerParam(const char* ip, int port, std::function<void(Connection*)>&& on_connection)
         : ip((ip && *ip) ? ip : "0.0.0.0"), port(str::from(port)), 
-          on_connection(std::move(on_connection)), ssl_ctx(0) {
+          on_connection(std::move(on_connection)), ssl_ctx(0), reuse_port(false),
+          sched_policy(-1), max_conn(0), paused(0) {
+        memset(&stats, 0, sizeof(stats));
     }
 
     ~ServerParam() {
@@ -100,32 +133,130 @@ struct ServerParam {
 
     fastring ip;
     fastring port;
-    sock_t fd;
-    sock_t connfd;
     std::function<void(Connection*)> on_connection;
     std::function<void(sock_t)> on_conn_fd;
     void* ssl_ctx; // SSL_CTX
+    bool reuse_port;
+    int sched_policy;
+    Server::sched_cb sched_cb;
+    uint32 max_conn;
+    ServerStats stats; // shared by all server loops
+    int paused;        // 1 if a server loop is waiting for a connection to be closed
+    co::Event resume;
+
+    // the connection has been counted in the current scheduler and in stats.inflight 
+    // by the server loop, it will be uncounted when the connection is closed.
+    Connection* track(Connection* c) {
+        c->_sid = (int) co::scheduler()->id();
+        c->_sp = this;
+        return c;
+    }
 
-    // use union here to support both ipv4 and ipv6
-    union {
-        struct sockaddr_in  v4;
-        struct sockaddr_in6 v6;
-    } addr;
-    int addrlen;
+    void on_conn_closed() {
+        const uint64 n = atomic_dec(&stats.inflight);
+        if (n < max_conn && atomic_get(&paused) && atomic_swap(&paused, 0)) resume.signal();
+    }
+
+    // pause the server loop while live connections reach max_conn, new connections 
+    // stay in the listen backlog in the meantime.
+    void wait_for_conn_slot(sock_t fd) {
+        if (max_conn == 0 || atomic_get(&stats.inflight) < max_conn) return;
+        WLOG << "server " << fd << " paused, live connections reach " << max_conn;
+        do {
+            atomic_swap(&paused, 1);
+            resume.wait(100); // in case the signal was missed
+        } while (atomic_get(&stats.inflight) >= max_conn);
+        WLOG << "server " << fd << " resumed";
+    }
 };
 
+void Connection::untrack() {
+    dec_conn_num(_sid);
+    if (_sp) {
+        _sp->on_conn_closed();
+        _sp = 0;
+    }
+}
+
+ServerStats Server::stats() const {
+    ServerStats x;
+    if (_p) {
+        x.accepted = atomic_get(&_p->stats.accepted);
+        x.rejected = atomic_get(&_p->stats.rejected);
+        x.inflight = atomic_get(&_p->stats.inflight);
+    } else {
+        memset(&x, 0, sizeof(x));
+    }
+    return x;
+}
+
 /**
  * the server loop 
  *   - It listens on a port and waits for connections. 
  *   - When a connection is accepted, it will start a new coroutine and call 
  *     the connection callback to handle the connection. 
+ *   - If p->reuse_port is true, there is a server loop in every scheduler. 
+ *   - The scheduler to handle the connection is chosen by p->sched_policy. 
  */
 static void server_loop(void* p);
 
+// start server loop(s) for the server, p is shared by all the server loops.
+static void start_server_loop(ServerParam* p) {
+  #ifndef __linux__
+    WLOG_IF(p->reuse_port) << "SO_REUSEPORT not supported, use a single listener..";
+    p->reuse_port = false;
+  #endif
+    if (p->sched_policy < 0) {
+        p->sched_policy = p->reuse_port ? Server::kAcceptLocal : Server::kRoundRobin;
+    }
+
+    if (p->reuse_port) {
+        auto& s = co::all_schedulers();
+        for (size_t i = 0; i < s.size(); ++i) {
+            s[i]->add_new_task(new_closure(server_loop, (void*)p));
+        }
+    } else {
+        go(server_loop, (void*)p);
+    }
+}
+
+inline uint32 hash_peer_ip(const void* addr, int addrlen) {
+    if (addrlen == sizeof(sockaddr_in)) {
+        return hash32(&((const struct sockaddr_in*)addr)->sin_addr, 4);
+    }
+    return hash32(&((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+}
+
+// choose a scheduler to handle the connection from addr
+static co::xx::Scheduler* choose_scheduler(ServerParam* p, const void* addr, int addrlen) {
+    auto& s = co::all_schedulers();
+    if (p->sched_cb) return s[(uint32)p->sched_cb(addr, addrlen) % s.size()];
+
+    switch (p->sched_policy) {
+      case Server::kLeastConn:
+        {
+            auto& v = conn_counters();
+            size_t k = 0;
+            int m = atomic_get(&v[0].n);
+            for (size_t i = 1; i < v.size(); ++i) {
+                const int n = atomic_get(&v[i].n);
+                if (n < m) { m = n; k = i; }
+            }
+            return s[k];
+        }
+      case Server::kPeerHash:
+        return s[hash_peer_ip(addr, addrlen) % s.size()];
+      case Server::kAcceptLocal:
+        return co::scheduler();
+      default:
+        return co::next_scheduler();
+    }
+}
+
 static void on_tcp_connection(ServerParam* p, sock_t fd) {
     co::set_tcp_keepalive(fd);
     co::set_tcp_nodelay(fd);
-    p->on_connection(new tcp::Connection((int)fd));
+    p->on_connection(p->track(new tcp::Connection((int)fd)));
 }
 
 #ifdef CO_SSL
@@ -138,7 +269,7 @@ static void on_ssl_connection(ServerParam* p, sock_t fd) {
     if (ssl::set_fd(s, (int)fd) != 1) goto set_fd_err;
     if (ssl::accept(s, FLG_ssl_handshake_timeout) <= 0) goto accept_err;
 
-    p->on_connection(new SSLConnection(s));
+    p->on_connection(p->track(new SSLConnection(s)));
     return;
 
   new_ssl_err:
@@ -153,6 +284,8 @@ static void on_ssl_connection(ServerParam* p, sock_t fd) {
   err_end:
     if (s) ssl::free_ssl(s);
     co::close(fd, 1000);
+    atomic_dec(&conn_counters()[co::scheduler()->id()].n);
+    p->on_conn_closed();
     return;
 }
 #endif
@@ -160,6 +293,11 @@ static void on_ssl_connection(ServerParam* p, sock_t fd) {
 void Server::start(const char* ip, int port, const char* key, const char* ca) {
     CHECK(_on_connection != NULL) << "connection callback not set..";
     ServerParam* p = new ServerParam(ip, port, std::move(*_on_connection));
+    p->reuse_port = _reuse_port || FLG_tcp_reuse_port;
+    p->sched_policy = _sched_policy;
+    if (_sched_cb) p->sched_cb = *_sched_cb;
+    p->max_conn = _max_conn > 0 ? _max_conn : FLG_tcp_max_conn;
+    _p = p;
 
     if (key && *key && ca && *ca) {
       #ifdef CO_SSL
@@ -178,18 +316,68 @@ void Server::start(const char* ip, int port, const char* key, const char* ca) {
         CHECK_EQ(r, 1) << "ssl check private key error: " << ssl::strerror();
 
         p->on_conn_fd = std::bind(on_ssl_connection, p, std::placeholders::_1);
-        go(server_loop, (void*)p);
+        start_server_loop(p);
       #else
         CHECK(false) << "openssl must be installed..";
       #endif
     } else {
         p->on_conn_fd = std::bind(on_tcp_connection, p, std::placeholders::_1);
-        go(server_loop, (void*)p);
+        start_server_loop(p);
     }
 }
 
+// an accepted connection
+struct AcceptedConn {
+    sock_t fd;
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+    } addr;
+    int addrlen;
+};
+
+#ifndef _WIN32
+/**
+ * accept at most n connections 
+ *   - It blocks until a connection is present, then drains the pending connections 
+ *     without waiting again. 
+ *   - ev is owned by the server loop, the listening socket stays in epoll (kqueue) 
+ *     between calls, rather than being added and removed for each accept. 
+ * 
+ * @return  number of accepted connections, or -1 on error.
+ */
+static int accept_conns(sock_t fd, co::IoEvent& ev, AcceptedConn* c, int n) {
+    int k = 0;
+    while (k < n) {
+        c[k].addrlen = sizeof(c[k].addr);
+      #ifdef SOCK_NONBLOCK
+        sock_t connfd = raw_api(accept4)(fd, (sockaddr*)&c[k].addr, (socklen_t*)&c[k].addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      #else
+        sock_t connfd = raw_api(accept)(fd, (sockaddr*)&c[k].addr, (socklen_t*)&c[k].addrlen);
+        if (connfd != -1) {
+            co::set_nonblock(connfd);
+            co::set_cloexec(connfd);
+        }
+      #endif
+        if (connfd != -1) {
+            c[k++].fd = connfd;
+            continue;
+        }
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (k > 0) break;
+            ev.wait();
+        } else if (errno != EINTR) {
+            return k > 0 ? k : -1; // the error will be reported on the next call
+        }
+    }
+    return k;
+}
+#endif
+
 void server_loop(void* arg) {
-    std::unique_ptr<ServerParam> p((ServerParam*)arg);
+    ServerParam* p = (ServerParam*)arg;
+    sock_t fd;
 
     do {
         struct addrinfo* info = 0;
@@ -197,37 +385,70 @@ void server_loop(void* arg) {
         CHECK_EQ(r, 0) << "invalid ip address: " << p->ip << ':' << p->port;
         CHECK(info != NULL);
 
-        p->fd = co::tcp_socket(info->ai_family);
-        CHECK_NE(p->fd, (sock_t)-1) << "create socket error: " << co::strerror();
-        co::set_reuseaddr(p->fd);
+        fd = co::tcp_socket(info->ai_family);
+        CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+        co::set_reuseaddr(fd);
+        if (p->reuse_port) {
+            CHECK(co::set_reuseport(fd)) << "set SO_REUSEPORT error: " << co::strerror();
+        }
 
         // turn off IPV6_V6ONLY
         if (info->ai_family == AF_INET6) {
             int on = 0;
-            co::setsockopt(p->fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+            co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
         }
 
-        r = co::bind(p->fd, info->ai_addr, (int)info->ai_addrlen);
+        r = co::bind(fd, info->ai_addr, (int)info->ai_addrlen);
         CHECK_EQ(r, 0) << "bind (" << p->ip << ':' << p->port << ") failed: " << co::strerror();
 
-        r = co::listen(p->fd, 1024);
+        r = co::listen(fd, 1024);
         CHECK_EQ(r, 0) << "listen error: " << co::strerror();
 
         freeaddrinfo(info);
     } while (0);
 
-    LOG << "server " << p->fd << " start: " << p->ip << ':' << p->port;
+    const int batch = FLG_tcp_accept_batch > 0 ? FLG_tcp_accept_batch : 1;
+    std::unique_ptr<AcceptedConn[]> c(new AcceptedConn[batch]);
+  #ifndef _WIN32
+    co::IoEvent ev(fd, co::EV_read);
+  #endif
+
+    LOG << "server " << fd << " start: " << p->ip << ':' << p->port;
     while (true) {
-        p->addrlen = sizeof(p->addr);
-        p->connfd = co::accept(p->fd, &p->addr, &p->addrlen);
-        if (unlikely(p->connfd == (sock_t)-1)) {
-            WLOG << "server " << p->fd << " accept error: " << co::strerror();
+        p->wait_for_conn_slot(fd);
+        int n = batch;
+        if (p->max_conn > 0) {
+            // inflight may exceed max_conn a little, as it is shared by server loops
+            const int64 m = (int64)p->max_conn - (int64)atomic_get(&p->stats.inflight);
+            if (m < n) n = m > 0 ? (int)m : 1;
+        }
+
+      #ifndef _WIN32
+        n = accept_conns(fd, ev, c.get(), n);
+      #else
+        c[0].addrlen = sizeof(c[0].addr);
+        c[0].fd = co::accept(fd, &c[0].addr, &c[0].addrlen);
+        n = c[0].fd != (sock_t)-1 ? 1 : -1;
+      #endif
+
+        if (unlikely(n < 0)) {
+            const int e = co::error();
+            atomic_inc(&p->stats.rejected);
+            WLOG << "server " << fd << " accept error: " << co::strerror(e);
+            // out of fds or memory, back off rather than spinning on accept
+            if (e == EMFILE || e == ENFILE || e == ENOBUFS || e == ENOMEM) co::sleep(100);
             continue;
         }
 
-        DLOG << "server " << p->fd << " accept new connection: "
-             << co::to_string(&p->addr, p->addrlen) << ", connfd: " << p->connfd;
-        go(&p->on_conn_fd, p->connfd);
+        atomic_add(&p->stats.accepted, (uint64)n);
+        atomic_add(&p->stats.inflight, (uint64)n);
+        for (int i = 0; i < n; ++i) {
+            DLOG << "server " << fd << " accept new connection: "
+                 << co::to_string(&c[i].addr, c[i].addrlen) << ", connfd: " << c[i].fd;
+            co::xx::Scheduler* s = choose_scheduler(p, &c[i].addr, c[i].addrlen);
+            atomic_inc(&conn_counters()[s->id()].n);
+            s->add_new_task(new_closure(&p->on_conn_fd, c[i].fd));
+        }
     }
 }
 
@@ -118,6 +118,49 @@ int main(int argc, char** argv) {
         COUT << "fast::dtoa 10w times, done in " << us << " us, avg: " << avg << " ns";
         COUT << "-> speedup: " << (svg/avg);
         COUT << buf << "  r: " << r;
+
+        t.restart();
+        for (int i = 0; i < 100000; i++) {
+            r = milo::dtoa(f + i * 1e-9, buf);
+        }
+        us = t.us();
+        svg = static_cast<double>(us*1000) / 100000;
+        COUT << "milo::dtoa 10w times, done in " << us << " us, avg: " << svg << " ns";
+
+        t.restart();
+        for (int i = 0; i < 100000; i++) {
+            r = fast::dtoa(f + i * 1e-9, buf);
+        }
+        us = t.us();
+        avg = static_cast<double>(us*1000) / 100000;
+        COUT << "fast::dtoa 10w times, done in " << us << " us, avg: " << avg << " ns";
+        COUT << "-> speedup: " << (svg/avg);
+    } while (0);
+
+    do {
+        COUT << "\n======= atod vs strtod =======";
+        const char* s = "-65.613616999999977";
+        const size_t n = strlen(s);
+        double f = 0;
+
+        t.restart();
+        for (int i = 0; i < 100000; i++) {
+            f += strtod(s, 0);
+        }
+        us = t.us();
+        svg = static_cast<double>(us*1000) / 100000;
+        COUT << "strtod 10w times, done in " << us << " us, avg: " << svg << " ns";
+
+        t.restart();
+        for (int i = 0; i < 100000; i++) {
+            double x;
+            fast::atod(s, n, x);
+            f += x;
+        }
+        us = t.us();
+        avg = static_cast<double>(us*1000) / 100000;
+        COUT << "fast::atod 10w times, done in " << us << " us, avg: " << avg << " ns";
+        COUT << "-> speedup: " << (svg/avg) << "  sum: " << f;
     } while (0);
 
     return 0;
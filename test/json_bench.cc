@@ -0,0 +1,249 @@
+#include "co/json.h"
+#include "co/fs.h"
+#include "co/time.h"
+#include "co/log.h"
+#include "co/path.h"
+#include "co/str.h"
+#include "co/random.h"
+
+// Benchmark json::parse() and Json::str() over the canonical corpora of
+// nativejson-benchmark: twitter.json, citm_catalog.json and canada.json.
+// The SAX parser is measured with a handler counting the values, which is 
+// what a filtering or counting job does without building a Json. The in-situ
+// parse (json::kInSitu) includes copying the corpus to a scratch buffer, as 
+// the buffer is changed by the parser.
+//   - Files are read from -dir, or given by -files (separated by ',').
+//   - For a corpus not found, a stand-in of the same shape and similar size
+//     is generated:
+//       twitter:  strings with unicode and escapes, small nested objects
+//       citm:     indented, many integers and short keys
+//       canada:   long arrays of doubles
+
+DEF_string(dir, "test/data", "directory of the corpora");
+DEF_string(files, "", "json files to test, separated by ','");
+DEF_int32(n, 50, "iterations for each corpus");
+
+static Random g_rand(7);
+
+static uint32 rand_in(uint32 n) {
+    return g_rand.next() % n;
+}
+
+static void gen_text(fastream& s, int n) {
+    static const char* words[] = {
+        "RT", "@ayumi1", "\\u307e\\u3058", "\\u6771\\u4eac", "http:\\/\\/t.co\\/abc", "\\n",
+        "the", "json", "co", "\\\"quoted\\\"", "#hashtag", "\\u2764", "benchmark", "\\u3042",
+    };
+    for (int i = 0; i < n; ++i) {
+        if (i) s << ' ';
+        s << words[rand_in(sizeof(words) / sizeof(words[0]))];
+    }
+}
+
+static fastring gen_twitter() {
+    fastream s(640 * 1024);
+    s << "{\"statuses\":[";
+    for (int i = 0; i < 400; ++i) {
+        if (i) s << ',';
+        const uint64 id = 505874924095815681ULL + i * 7;
+        s << "{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"ja\"},"
+          << "\"created_at\":\"Sun Aug 31 00:29:15 +0000 2014\",\"id\":" << id
+          << ",\"id_str\":\"" << id << "\",\"text\":\"";
+        gen_text(s, 8 + rand_in(16));
+        s << "\",\"source\":\"<a href=\\\"http:\\/\\/twitter.com\\/download\\/iphone\\\" rel=\\\"nofollow\\\">Twitter for iPhone<\\/a>\","
+          << "\"truncated\":false,\"in_reply_to_status_id\":null,\"in_reply_to_user_id\":" << (1186275104 + i)
+          << ",\"user\":{\"id\":" << (1186275104 + i) << ",\"name\":\"";
+        gen_text(s, 2);
+        s << "\",\"screen_name\":\"user_" << i << "\",\"location\":\"\\u57fc\\u7389\",\"description\":\"";
+        gen_text(s, 20 + rand_in(20));
+        s << "\",\"url\":null,\"entities\":{\"description\":{\"urls\":[]}},\"protected\":false,"
+          << "\"followers_count\":" << rand_in(10000) << ",\"friends_count\":" << rand_in(10000)
+          << ",\"listed_count\":" << rand_in(100) << ",\"created_at\":\"Sat Feb 16 13:40:25 +0000 2013\","
+          << "\"favourites_count\":" << rand_in(1000) << ",\"utc_offset\":null,\"time_zone\":null,"
+          << "\"geo_enabled\":false,\"verified\":false,\"statuses_count\":" << rand_in(100000)
+          << ",\"lang\":\"ja\",\"profile_background_color\":\"C0DEED\","
+          << "\"profile_image_url\":\"http:\\/\\/pbs.twimg.com\\/profile_images\\/" << id << "\\/abc_normal.jpeg\","
+          << "\"default_profile\":true,\"following\":false,\"notifications\":false},"
+          << "\"geo\":null,\"coordinates\":null,\"place\":null,\"retweet_count\":" << rand_in(100)
+          << ",\"favorite_count\":0,\"entities\":{\"hashtags\":[],\"symbols\":[],\"urls\":[],"
+          << "\"user_mentions\":[{\"screen_name\":\"aym0566x\",\"name\":\"\\u524d\\u7530\",\"id\":866260188,"
+          << "\"id_str\":\"866260188\",\"indices\":[0,9]}]},\"favorited\":false,\"retweeted\":false,\"lang\":\"ja\"}";
+    }
+    s << "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,"
+      << "\"query\":\"%E4%B8%80\",\"count\":400,\"since_id\":0}}";
+    return fastring(s.data(), s.size());
+}
+
+static fastring gen_citm() {
+    fastream s(1800 * 1024);
+    s << "{\n    \"areaNames\": {\n";
+    for (int i = 0; i < 20; ++i) {
+        s << "        \"" << (205705993 + i) << "\": \"Arri\\u00e8re-sc\\u00e8ne " << i << "\"" << (i < 19 ? ",\n" : "\n");
+    }
+    s << "    },\n    \"events\": {\n";
+    for (int i = 0; i < 180; ++i) {
+        const uint32 id = 138586341 + i * 4;
+        s << "        \"" << id << "\": {\n"
+          << "            \"description\": null,\n"
+          << "            \"id\": " << id << ",\n"
+          << "            \"logo\": \"\\/images\\/UE0AAAAACEKo6QAAAAZDSVRN\",\n"
+          << "            \"name\": \"Event " << i << "\",\n"
+          << "            \"subTopicIds\": [\n                337184269,\n                337184283\n            ],\n"
+          << "            \"subjectCode\": null,\n"
+          << "            \"subtitle\": null,\n"
+          << "            \"topicIds\": [\n                324846099,\n                107888604\n            ]\n"
+          << "        }" << (i < 179 ? ",\n" : "\n");
+    }
+    s << "    },\n    \"performances\": [\n";
+    for (int i = 0; i < 360; ++i) {
+        s << "        {\n            \"eventId\": " << (138586341 + rand_in(180) * 4) << ",\n"
+          << "            \"id\": " << (339887544 + i) << ",\n"
+          << "            \"logo\": null,\n            \"name\": null,\n            \"prices\": [\n";
+        const int np = 2 + rand_in(4);
+        for (int k = 0; k < np; ++k) {
+            s << "                {\n"
+              << "                    \"amount\": " << (10000 + rand_in(90000)) << ",\n"
+              << "                    \"audienceSubCategoryId\": 337100890,\n"
+              << "                    \"seatCategoryId\": " << (338937295 + k) << "\n"
+              << "                }" << (k < np - 1 ? ",\n" : "\n");
+        }
+        s << "            ],\n            \"seatCategories\": [\n";
+        for (int k = 0; k < np; ++k) {
+            s << "                {\n                    \"areas\": [\n";
+            for (int a = 0; a < 6; ++a) {
+                s << "                        {\n"
+                  << "                            \"areaId\": " << (205705993 + a) << ",\n"
+                  << "                            \"blockIds\": []\n"
+                  << "                        }" << (a < 5 ? ",\n" : "\n");
+            }
+            s << "                    ],\n                    \"seatCategoryId\": " << (338937295 + k) << "\n"
+              << "                }" << (k < np - 1 ? ",\n" : "\n");
+        }
+        s << "            ],\n            \"seatMapImage\": null,\n"
+          << "            \"start\": " << (1372701600000ULL + i * 86400000ULL) << ",\n"
+          << "            \"venueCode\": \"PLEYEL_PLEYEL\"\n"
+          << "        }" << (i < 359 ? ",\n" : "\n");
+    }
+    s << "    ],\n    \"venueNames\": {\n        \"PLEYEL_PLEYEL\": \"Salle Pleyel\"\n    }\n}";
+    return fastring(s.data(), s.size());
+}
+
+static fastring gen_canada() {
+    fastream s(2300 * 1024);
+    s << "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+      << "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+    double x = -65.613616999999977, y = 43.420273000000009;
+    for (int r = 0; r < 480; ++r) {
+        if (r) s << ',';
+        s << '[';
+        for (int i = 0; i < 116; ++i) {
+            if (i) s << ',';
+            x += (rand_in(2001) - 1000.0) / 1e5 + 1e-13 * rand_in(1000);
+            y += (rand_in(2001) - 1000.0) / 1e5 + 1e-13 * rand_in(1000);
+            s << '[' << x << ',' << y << ']';
+        }
+        s << ']';
+    }
+    s << "]}}]}";
+    return fastring(s.data(), s.size());
+}
+
+struct Corpus {
+    fastring name;
+    fastring data;
+};
+
+class Counter : public json::Handler {
+  public:
+    Counter() : n(0) {}
+    virtual int null_value()           { ++n; return kGoOn; }
+    virtual int bool_value(bool)       { ++n; return kGoOn; }
+    virtual int int_value(int64)       { ++n; return kGoOn; }
+    virtual int double_value(double)   { ++n; return kGoOn; }
+    virtual int string_value(const char*, size_t) { ++n; return kGoOn; }
+    int64 n;
+};
+
+static bool read_file(const fastring& path, fastring& data) {
+    fs::file f;
+    if (!f.open(path, 'r')) return false;
+    data = f.read((size_t)f.size());
+    return !data.empty();
+}
+
+static void bench(const Corpus& c) {
+    const double mb = c.data.size() / 1024.0 / 1024.0;
+    Json v;
+    if (!v.parse_from(c.data)) {
+        COUT << c.name << ": parse error";
+        return;
+    }
+
+    int64 t = now::us();
+    for (int i = 0; i < FLG_n; ++i) v.parse_from(c.data);
+    t = now::us() - t;
+    const double parse_ms = t / 1000.0 / FLG_n;
+
+    fastring buf(c.data.size());
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) {
+        buf.clear();
+        buf.append(c.data);
+        v.parse_from(buf, json::kInSitu);
+    }
+    t = now::us() - t;
+    const double insitu_ms = t / 1000.0 / FLG_n;
+
+    fastring s;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) s = v.str(c.data.size() + 64);
+    t = now::us() - t;
+    const double str_ms = t / 1000.0 / FLG_n;
+
+    Counter h;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) json::parse(c.data, h);
+    t = now::us() - t;
+    const double sax_ms = t / 1000.0 / FLG_n;
+
+    COUT << c.name << " (" << c.data.size() << " bytes): parse " << (int64)(parse_ms * 1000) << " us, "
+         << (int)(mb * 1000 / parse_ms) << " MB/s; insitu " << (int64)(insitu_ms * 1000) << " us, "
+         << (int)(mb * 1000 / insitu_ms) << " MB/s; str " << (int64)(str_ms * 1000) << " us, "
+         << (int)(mb * 1000 / str_ms) << " MB/s; sax " << (int64)(sax_ms * 1000) << " us, "
+         << (int)(mb * 1000 / sax_ms) << " MB/s, " << (h.n / FLG_n) << " values";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    std::vector<Corpus> v;
+    if (!FLG_files.empty()) {
+        auto files = str::split(FLG_files, ',');
+        for (size_t i = 0; i < files.size(); ++i) {
+            Corpus c;
+            c.name = files[i];
+            if (read_file(files[i], c.data)) {
+                v.push_back(std::move(c));
+            } else {
+                COUT << "failed to read " << files[i];
+            }
+        }
+    } else {
+        typedef fastring (*gen_t)();
+        const char* names[] = { "twitter.json", "citm_catalog.json", "canada.json" };
+        gen_t gens[] = { gen_twitter, gen_citm, gen_canada };
+        for (int i = 0; i < 3; ++i) {
+            Corpus c;
+            c.name = names[i];
+            if (!read_file(path::join(FLG_dir, names[i]), c.data)) {
+                c.name << " (generated)";
+                c.data = gens[i]();
+            }
+            v.push_back(std::move(c));
+        }
+    }
+
+    for (size_t i = 0; i < v.size(); ++i) bench(v[i]);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "co/json.h"
+#include "co/time.h"
+#include "co/log.h"
+
+// Benchmark structs bound by CO_JSON_FIELDS against the Json tree, for both
+// serializing to json and parsing json into the structs.
+
+DEF_int32(n, 200000, "iterations");
+
+struct Line {
+    fastring sku;
+    int count;
+    double price;
+};
+CO_JSON_FIELDS(Line, sku, count, price)
+
+struct Order {
+    int64 id;
+    fastring user;
+    bool paid;
+    double total;
+    std::vector<fastring> tags;
+    std::vector<Line> lines;
+};
+CO_JSON_FIELDS(Order, id, user, paid, total, tags, lines)
+
+// the same as CO_JSON_FIELDS does, by the Json tree
+void to_json(const Order& o, fastream& fs) {
+    Json v;
+    v.add_member("id", o.id);
+    v.add_member("user", o.user);
+    v.add_member("paid", o.paid);
+    v.add_member("total", o.total);
+    auto tags = v.add_array("tags");
+    for (size_t i = 0; i < o.tags.size(); ++i) tags.push_back(o.tags[i]);
+    auto lines = v.add_array("lines");
+    for (size_t i = 0; i < o.lines.size(); ++i) {
+        auto x = lines.push_object();
+        x.add_member("sku", o.lines[i].sku);
+        x.add_member("count", o.lines[i].count);
+        x.add_member("price", o.lines[i].price);
+    }
+    v.str(fs);
+}
+
+bool from_json(const fastring& s, Order& o) {
+    Json v = json::parse(s);
+    if (!v.is_object()) return false;
+    o.id = v["id"].get_int64();
+    o.user = v["user"].get_string();
+    o.paid = v["paid"].get_bool();
+    o.total = v["total"].get_double();
+    auto tags = v["tags"];
+    o.tags.resize(tags.array_size());
+    for (uint32 i = 0; i < tags.array_size(); ++i) o.tags[i] = tags[i].get_string();
+    auto lines = v["lines"];
+    o.lines.resize(lines.array_size());
+    for (uint32 i = 0; i < lines.array_size(); ++i) {
+        auto x = lines[i];
+        o.lines[i].sku = x["sku"].get_string();
+        o.lines[i].count = x["count"].get_int();
+        o.lines[i].price = x["price"].get_double();
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    Order o;
+    o.id = 88730012345;
+    o.user = "alice \"the buyer\"";
+    o.paid = true;
+    o.total = 325.5;
+    o.tags.push_back("express");
+    o.tags.push_back("gift");
+    for (int i = 0; i < 4; ++i) {
+        Line l;
+        l.sku = fastring("SKU-") << (1000 + i);
+        l.count = i + 1;
+        l.price = 19.9 + i;
+        o.lines.push_back(l);
+    }
+
+    fastream fs(1024);
+    int64 t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { fs.clear(); to_json(o, fs); }
+    int64 tree_w = now::us() - t;
+
+    fastream fs2(1024);
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { fs2.clear(); json::to_str(fs2, o); }
+    int64 fields_w = now::us() - t;
+
+    const fastring s(fs2.data(), fs2.size());
+    Order x;
+    int64 sum = 0;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { from_json(s, x); sum += x.lines.size(); }
+    int64 tree_r = now::us() - t;
+
+    Order y;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { json::from_str(s, y); sum += y.lines.size(); }
+    int64 fields_r = now::us() - t;
+
+    COUT << "json: " << s << " (" << s.size() << " bytes)";
+    COUT << "write, Json tree: " << (tree_w * 1000 / FLG_n) << " ns, CO_JSON_FIELDS: " << (fields_w * 1000 / FLG_n) << " ns";
+    COUT << "read,  Json tree: " << (tree_r * 1000 / FLG_n) << " ns, CO_JSON_FIELDS: " << (fields_r * 1000 / FLG_n) << " ns";
+    COUT << "same json: " << (fastring(fs.data(), fs.size()) == s) << ", sum: " << sum;
+    return 0;
+}
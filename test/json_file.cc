@@ -0,0 +1,57 @@
+#include "co/json.h"
+#include "co/fs.h"
+#include "co/time.h"
+#include "co/log.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Benchmark loading a large json file by fs::file::read() and json::parse(),
+// and by json::parse_file() which maps the file and parses it in place.
+// Run it once with -mmap=false and once with -mmap=true to compare the peak
+// memory of the process, which is printed on linux and mac.
+
+DEF_string(file, "json_file.json", "the json file, generated if not exists");
+DEF_int32(items, 100000, "number of items in the generated file");
+DEF_bool(mmap, true, "load the file by json::parse_file if true");
+
+static void gen_file() {
+    fs::fstream f(FLG_file.c_str(), 'w', 1024 * 1024);
+    f << "{\"items\":[";
+    for (int i = 0; i < FLG_items; ++i) {
+        if (i) f << ',';
+        f << "{\"id\":" << (100000 + i) << ",\"name\":\"item " << i << " of the dataset\","
+          << "\"desc\":\"a long description of the item, with some words to make it longer\","
+          << "\"path\":\"/data/set/" << i << "/file.bin\",\"tags\":[\"alpha\",\"beta\"],\"score\":" << (i * 0.5) << "}";
+    }
+    f << "]}";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    if (!fs::exists(FLG_file)) gen_file();
+
+    int64 t = now::us();
+    Json v;
+    if (FLG_mmap) {
+        v = json::parse_file(FLG_file);
+    } else {
+        fs::file f(FLG_file.c_str(), 'r');
+        fastring s = f.read((size_t)f.size());
+        v = json::parse(s);
+    }
+    t = now::us() - t;
+
+    auto items = v["items"];
+    COUT << (FLG_mmap ? "json::parse_file: " : "read and json::parse: ") << t / 1000.0 << " ms, "
+         << items.array_size() << " items, last name: " << items[items.array_size() - 1]["name"].get_string();
+
+  #ifndef _WIN32
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    COUT << "peak memory: " << fs::fsize(FLG_file) / 1024 << " KB file, " << ru.ru_maxrss << " KB max rss";
+  #endif
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "co/json.h"
+#include "co/time.h"
+#include "co/log.h"
+
+// Benchmark reading 5 fields from a json payload of about 1MB, by json::parse()
+// which builds the whole Json, and by json::Lazy which only indexes brackets
+// of the document and decodes the 5 fields read.
+
+DEF_int32(n, 200, "iterations");
+DEF_int32(items, 5200, "number of items in the payload");
+
+static fastring gen_payload() {
+    fastream s(1024 * 1024);
+    s << "{\"id\":20230917,\"user\":{\"name\":\"alice\",\"tags\":[\"a\",\"b\"],\"score\":97.5},\"items\":[";
+    for (int i = 0; i < FLG_items; ++i) {
+        if (i) s << ',';
+        s << "{\"id\":" << (100000 + i) << ",\"title\":\"item \\\"" << i << "\\\" of the list\","
+          << "\"price\":" << (i * 0.25 + 0.99) << ",\"tags\":[\"x\",\"y\",\"z\"],"
+          << "\"desc\":\"a long description of the item, \\u4e2d\\u6587 and some more words\","
+          << "\"stock\":{\"warehouse\":" << (i % 7) << ",\"count\":" << (i * 3) << ",\"ok\":true}}";
+    }
+    s << "],\"meta\":{\"count\":" << FLG_items << ",\"next\":null},\"trailer\":\"end\"}";
+    return fastring(s.data(), s.size());
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    const fastring s = gen_payload();
+    const int k = FLG_items / 2;
+    int64 sum = 0;
+
+    int64 t = now::us();
+    for (int i = 0; i < FLG_n; ++i) {
+        Json v = json::parse(s);
+        sum += v["id"].get_int64();
+        sum += strlen(v["user"]["name"].get_string());
+        sum += v["items"][k]["stock"]["count"].get_int();
+        sum += v["meta"]["count"].get_int();
+        sum += strlen(v["trailer"].get_string());
+    }
+    t = now::us() - t;
+    const double tree_us = (double)t / FLG_n;
+
+    json::Lazy doc;
+    int64 sum2 = 0;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) {
+        doc.parse_from(s);
+        sum2 += doc["id"].get_int64();
+        sum2 += doc["user"]["name"].get_string().size();
+        sum2 += doc["items"][k]["stock"]["count"].get_int();
+        sum2 += doc["meta"]["count"].get_int();
+        sum2 += doc["trailer"].get_string().size();
+    }
+    t = now::us() - t;
+    const double lazy_us = (double)t / FLG_n;
+
+    COUT << "payload: " << s.size() << " bytes, read 5 fields";
+    COUT << "json::parse: " << (int64)tree_us << " us, sum: " << sum;
+    COUT << "json::Lazy:  " << (int64)lazy_us << " us, sum: " << sum2 << ", " << (tree_us / lazy_us) << "x";
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include "co/json.h"
+#include "co/time.h"
+#include "co/log.h"
+
+// Benchmark looking up members of objects of different sizes by key.
+// Objects with json::Json::kHashThreshold (16) or more members are looked up
+// by a hash index, smaller ones by a linear scan.
+
+DEF_int32(n, 1000000, "lookups for each object size");
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    const int sizes[] = { 4, 8, 15, 16, 32, 64, 200, 1024 };
+    for (size_t x = 0; x < sizeof(sizes) / sizeof(sizes[0]); ++x) {
+        const int size = sizes[x];
+        std::vector<fastring> keys;
+        fastream fs;
+        fs << '{';
+        for (int i = 0; i < size; ++i) {
+            keys.push_back(fastring("field_name_") << i);
+            fs << '"' << keys.back() << "\":" << i << ',';
+        }
+        fs.back() = '}';
+
+        Json v = json::parse(fs.data(), fs.size());
+        int64 sum = 0;
+        int64 t = now::us();
+        for (int i = 0; i < FLG_n; ++i) {
+            sum += v[keys[i % size].c_str()].get_int();
+        }
+        t = now::us() - t;
+
+        COUT << "object size: " << size << ", " << (t * 1000.0 / FLG_n) << " ns/lookup, sum: " << sum;
+    }
+
+    return 0;
+}
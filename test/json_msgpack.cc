@@ -0,0 +1,75 @@
+#include "co/json.h"
+#include "co/time.h"
+#include "co/log.h"
+
+// Benchmark MessagePack against the json text, for encoding, decoding and the
+// size on the wire, with a typical rpc response and an array of numbers.
+
+DEF_int32(n, 20000, "iterations");
+
+static Json gen_rpc() {
+    Json v;
+    v.add_member("method", "list_orders");
+    v.add_member("err", 200);
+    v.add_member("errmsg", "ok");
+    auto orders = v.add_array("orders");
+    for (int i = 0; i < 20; ++i) {
+        auto x = orders.push_object();
+        x.add_member("id", (int64)(88730012345LL + i));
+        x.add_member("user", "alice \"the buyer\"");
+        x.add_member("paid", i % 3 != 0);
+        x.add_member("total", 325.5 + i);
+        x.add_member("count", i * 7);
+        auto tags = x.add_array("tags");
+        tags.push_back("express");
+        tags.push_back("gift");
+    }
+    return v;
+}
+
+static Json gen_numbers() {
+    Json v;
+    auto a = v.add_array("points");
+    for (int i = 0; i < 1000; ++i) {
+        a.push_back(-65.613616999999977 + i * 0.001);
+        a.push_back(i * 37);
+    }
+    return v;
+}
+
+static void bench(const char* name, const Json& v) {
+    fastream fs(64 * 1024);
+    int64 t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { fs.clear(); v.str(fs); }
+    const int64 str_ns = (now::us() - t) * 1000 / FLG_n;
+    const fastring s(fs.data(), fs.size());
+
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) { fs.clear(); v.msgpack(fs); }
+    const int64 mp_ns = (now::us() - t) * 1000 / FLG_n;
+    const fastring m(fs.data(), fs.size());
+
+    Json x;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) x.parse_from(s);
+    const int64 parse_ns = (now::us() - t) * 1000 / FLG_n;
+
+    Json y;
+    t = now::us();
+    for (int i = 0; i < FLG_n; ++i) y.parse_msgpack(m);
+    const int64 unpack_ns = (now::us() - t) * 1000 / FLG_n;
+
+    COUT << name << ": json " << s.size() << " bytes, msgpack " << m.size() << " bytes ("
+         << (m.size() * 100 / s.size()) << "%), same: " << (x.str() == y.str());
+    COUT << "  encode, str: " << str_ns << " ns, msgpack: " << mp_ns << " ns";
+    COUT << "  decode, parse: " << parse_ns << " ns, parse_msgpack: " << unpack_ns << " ns";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    bench("rpc response", gen_rpc());
+    bench("numbers", gen_numbers());
+    return 0;
+}
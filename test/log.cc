@@ -1,7 +1,13 @@
 #include "co/log.h"
 #include "co/time.h"
+#include "co/thread.h"
+#include "co/co.h"
+#include <memory>
+#include <vector>
 
 DEF_bool(perf, false, "performance testing");
+DEF_int32(t, 1, "number of threads for performance testing");
+DEF_bool(bin, false, "use binary logs (LOG_BIN) for performance testing");
 
 bool static_log() {
     DLOG << "hello static";
@@ -19,22 +25,54 @@ int nested_log() {
 int main(int argc, char** argv) {
     flag::init(argc, argv);
     log::init();
+    if (FLG_t < 1) FLG_t = 1;
 
     if (FLG_perf) {
-        // test performance by writting 100W logs
-        COUT << "print 100W logs, every log is about 50 bytes";
+        // test performance by writting 100W logs in total with FLG_t threads
+        const int n = 1000000 / FLG_t;
+        COUT << "print 100W logs with " << FLG_t << " threads, every log is about 50 bytes";
 
-        Timer t;
-        for (int k = 0; k < 1000000; k++) {
-            LOG << "hello world " << 3;
+        std::vector<std::unique_ptr<Thread>> v;
+        SyncEvent ev(true, false);
+        uint32 ready = 0;
+        int64 us = 0;
+        for (int i = 0; i < FLG_t; ++i) {
+            v.emplace_back(new Thread([&]() {
+                atomic_inc(&ready);
+                ev.wait();
+                Timer t;
+                if (FLG_bin) {
+                    for (int k = 0; k < n; k++) {
+                        LOG_BIN << "hello world " << 3;
+                    }
+                } else {
+                    for (int k = 0; k < n; k++) {
+                        LOG << "hello world " << 3;
+                    }
+                }
+                atomic_add(&us, t.us());
+            }));
         }
+
+        while (atomic_get(&ready) < (uint32)FLG_t) sleep::ms(1);
+        Timer t;
+        ev.signal();
+        for (int i = 0; i < FLG_t; ++i) v[i]->join();
         int64 write_to_cache = t.us();
 
         log::close();
         int64 write_to_file = t.us();
 
-        COUT << "All logs written to cache in " << write_to_cache << " us";
+        COUT << "All logs written to cache in " << write_to_cache << " us, "
+             << (int64)(1000000.0 * FLG_t * n / write_to_cache) << " logs/s, "
+             << (us / ((int64)FLG_t * n / 1000)) << " ns per log in a thread";
         COUT << "All logs written to file in " << write_to_file << " us";
+        COUT << "dropped logs: " << log::dropped_logs() << ", bytes: " << log::dropped_bytes();
+
+        log::WriteStats ws = log::write_stats();
+        COUT << "writes to file: " << ws.writes << ", bytes: " << ws.bytes
+             << ", avg latency: " << (ws.writes ? ws.total_us / ws.writes : 0) << " us"
+             << ", max latency: " << ws.max_us << " us";
 
     } else {
         // usage of other logs
@@ -42,8 +80,36 @@ int main(int argc, char** argv) {
         LOG  << "This is LOG  (info).. " << 23;
         WLOG << "This is WLOG (warning).. " << 23;
         ELOG << "This is ELOG (error).. " << 23;
+        LOG_BIN << "This is LOG_BIN (binary).. " << 23 << ' ' << 3.14 << ' ' << fastring("xx") << ' ' << true;
         //FLOG << "This is FLOG (fatal).. " << 23;
         LOG << "hello " << nested_log() << "  " << nested_log();
+
+        // log level of this file can be changed at runtime, 1 for info
+        log::set_log_level("test/log*", 1);
+        DLOG << "This DLOG is not written";
+        log::set_log_level("test/log*", -1);
+        DLOG << "This DLOG is written again";
+
+        // log context of a coroutine, run with -log_co_id to see the coroutine id
+        SyncEvent ev;
+        go([&]() {
+            log::set_context("req", 7);
+            log::set_context("peer", "127.0.0.1:80");
+            LOG << "This is LOG with a log context..";
+            LOG_BIN << "This is LOG_BIN with a log context..";
+            ev.signal();
+        });
+        ev.wait();
+
+        // rate-limited logs, 3 logs are written, and 7 are reported as suppressed
+        for (int i = 0; i < 10; ++i) {
+            WLOG_RATE_LIMIT(2) << "This is WLOG_RATE_LIMIT(2).. " << i;
+            if (i == 4) sleep::ms(600);
+        }
+        for (int i = 0; i < 3; ++i) {
+            LOG_EVERY_MS(100) << "This is LOG_EVERY_MS(100).. " << i;
+        }
+        sleep::ms(1500);
     }
 
     return 0;
@@ -0,0 +1,29 @@
+#include "co/log.h"
+#include "co/fs.h"
+
+// Decode binary logs written to xx.bin (run a program with -log_bin_file) to 
+// text, e.g. ./log_decode logs/xx.bin > xx.txt
+
+int main(int argc, char** argv) {
+    auto v = flag::init(argc, argv);
+    if (v.empty()) {
+        COUT << "usage: " << argv[0] << " xx.bin";
+        return 0;
+    }
+
+    fs::file f(v[0], 'r');
+    if (!f) {
+        COUT << "failed to open " << v[0];
+        return -1;
+    }
+
+    fastring s = f.read((size_t)fs::fsize(v[0]));
+    fastream out(s.size() * 2 + 64);
+    const bool ok = log::decode_bin_logs(s.data(), s.size(), out);
+    fwrite(out.data(), 1, out.size(), stdout);
+    if (!ok) {
+        fprintf(stderr, "%s is not a binary log file, or it is broken\n", v[0].c_str());
+        return -1;
+    }
+    return 0;
+}
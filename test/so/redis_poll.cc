@@ -0,0 +1,117 @@
+#include "co/all.h"
+
+// A benchmark for the hooked poll() and select(), which are used by libraries
+// like hiredis and libpq to wait on their sockets. A stand-in server speaking
+// the Redis protocol replies +PONG to PING, and clients wait on their socket
+// plus an idle pipe, as these libraries usually do, with poll() or select().
+
+DEF_string(ip, "127.0.0.1", "ip");
+DEF_int32(port, 6379, "port");
+DEF_int32(c, 16, "number of clients");
+DEF_int32(sec, 5, "seconds to run the test");
+DEF_int32(nfds, 2, "fds a client waits on, 1 for the socket only");
+DEF_bool(select, false, "use select() instead of poll()");
+
+static const char kPing[] = "*1\r\n$4\r\nPING\r\n";
+static const char kPong[] = "+PONG\r\n";
+static const int kPingLen = sizeof(kPing) - 1;
+static const int kPongLen = sizeof(kPong) - 1;
+
+uint64 g_reqs = 0;
+
+void on_connection(tcp::Connection* conn) {
+    std::unique_ptr<tcp::Connection> c(conn);
+    char buf[4096];
+    fastream out(1024);
+    int pending = 0;
+
+    while (true) {
+        int r = conn->recv(buf, sizeof(buf));
+        if (r <= 0) break;
+
+        // all requests are PING, pipelined requests are answered in one send
+        pending += r;
+        for (int n = pending / kPingLen; n > 0; --n) out.append(kPong, kPongLen);
+        pending %= kPingLen;
+        if (!out.empty()) {
+            if (conn->send(out.data(), (int)out.size()) <= 0) break;
+            out.clear();
+        }
+    }
+    conn->close();
+}
+
+// wait until fd is readable with the hooked poll() or select()
+bool wait_readable(int fd, int pfd) {
+    if (!FLG_select) {
+        struct pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = pfd;
+        fds[1].events = POLLIN;
+        int r = ::poll(fds, FLG_nfds > 1 ? 2 : 1, 3000);
+        return r > 0 && (fds[0].revents & POLLIN);
+    } else {
+        fd_set rs;
+        FD_ZERO(&rs);
+        FD_SET(fd, &rs);
+        if (FLG_nfds > 1) FD_SET(pfd, &rs);
+        struct timeval tv = { 3, 0 };
+        int r = ::select((fd > pfd ? fd : pfd) + 1, &rs, NULL, NULL, &tv);
+        return r > 0 && FD_ISSET(fd, &rs);
+    }
+}
+
+void client_fun() {
+    sock_t fd = co::tcp_socket();
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+    if (co::connect(fd, &addr, sizeof(addr), 3000) != 0) {
+        COUT << "connect error: " << co::strerror();
+        co::close(fd);
+        return;
+    }
+    co::set_tcp_nodelay(fd);
+
+    int pipefd[2];
+    CHECK_EQ(::pipe(pipefd), 0);
+
+    char buf[64];
+    while (true) {
+        if (::send(fd, kPing, kPingLen, 0) != kPingLen) break;
+        if (!wait_readable(fd, pipefd[0])) {
+            COUT << "wait error or timeout";
+            break;
+        }
+        int r = (int) ::recv(fd, buf, sizeof(buf), 0);
+        if (r <= 0) break;
+        atomic_inc(&g_reqs);
+    }
+
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+    co::close(fd);
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    tcp::Server s;
+    s.on_connection(on_connection);
+    s.start(FLG_ip.c_str(), FLG_port);
+    sleep::ms(32);
+
+    for (int i = 0; i < FLG_c; ++i) go(client_fun);
+
+    uint64 last = 0;
+    for (int i = 0; i < FLG_sec; ++i) {
+        sleep::sec(1);
+        uint64 n = atomic_get(&g_reqs);
+        COUT << (FLG_select ? "select" : "poll") << ", nfds: " << FLG_nfds
+             << ", clients: " << FLG_c << ", qps: " << (n - last);
+        last = n;
+    }
+
+    return 0;
+}
@@ -3,10 +3,13 @@
 DEF_string(ip, "127.0.0.1", "ip");
 DEF_int32(port, 9988, "port");
 DEF_int32(client_num, 1, "client num");
+DEF_int32(sched_policy, -1, "0: round robin, 1: least connections, 2: peer hash, 3: accept local");
 
 void on_connection(tcp::Connection* conn) {
     std::unique_ptr<tcp::Connection> c(conn);
     char buf[8] = { 0 };
+    LOG << "server handle connection " << conn->socket() << " in scheduler " << co::scheduler_id()
+        << ", live connections: " << tcp::conn_num(co::scheduler_id());
 
     while (true) {
         int r = conn->recv(buf, 8);
@@ -110,6 +113,7 @@ int main(int argc, char** argv) {
 
     tcp::Server s;
     s.on_connection(on_connection);
+    if (FLG_sched_policy >= 0) s.set_sched_policy(FLG_sched_policy);
     s.start(FLG_ip.c_str(), FLG_port);
 
     sleep::ms(32);
@@ -122,7 +126,12 @@ int main(int argc, char** argv) {
         go(client_fun);
     }
 
-    while (true) sleep::sec(1024);
+    while (true) {
+        sleep::sec(8);
+        tcp::ServerStats x = s.stats();
+        LOG << "server accepted: " << x.accepted << ", rejected: " << x.rejected
+            << ", inflight: " << x.inflight;
+    }
 
     return 0;
 }
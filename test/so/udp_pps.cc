@@ -0,0 +1,128 @@
+#include "co/all.h"
+
+DEF_string(ip, "127.0.0.1", "ip");
+DEF_int32(port, 6699, "port");
+DEF_int32(batch, 32, "datagrams per syscall, 1 for co::recvfrom/co::sendto");
+DEF_int32(size, 64, "bytes of a datagram");
+DEF_int32(sec, 5, "seconds to run the test");
+DEF_bool(gso, false, "use UDP_SEGMENT/UDP_GRO if supported");
+
+uint64 g_recv_pkts = 0;
+uint64 g_send_pkts = 0;
+
+void udp_server_fun() {
+    sock_t fd = co::udp_socket();
+    co::set_recv_buffer_size(fd, 8 << 20);
+
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+    CHECK_EQ(co::bind(fd, &addr, sizeof(addr)), 0) << "bind error: " << co::strerror();
+
+    const int n = FLG_batch;
+    const int size = FLG_gso ? 65536 : FLG_size;
+    if (FLG_gso && !co::set_udp_gro(fd)) COUT << "UDP_GRO not supported";
+
+    fastring buf(n * size);
+    std::vector<struct mmsghdr> msgs(n);
+    std::vector<struct iovec> iovs(n);
+    for (int i = 0; i < n; ++i) {
+        iovs[i].iov_base = (char*)buf.data() + i * size;
+        iovs[i].iov_len = size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (true) {
+        if (n == 1) {
+            int r = co::recvfrom(fd, (void*)buf.data(), size, NULL, NULL);
+            if (r < 0) { COUT << "server recvfrom error: " << co::strerror(); break; }
+            atomic_add(&g_recv_pkts, (r + FLG_size - 1) / FLG_size);
+        } else {
+            int r = co::recvmmsg(fd, msgs.data(), n);
+            if (r < 0) { COUT << "server recvmmsg error: " << co::strerror(); break; }
+            uint64 pkts = 0;
+            for (int i = 0; i < r; ++i) {
+                pkts += (msgs[i].msg_len + FLG_size - 1) / FLG_size;
+            }
+            atomic_add(&g_recv_pkts, pkts);
+        }
+    }
+
+    co::close(fd);
+}
+
+void udp_client_fun() {
+    sock_t fd = co::udp_socket();
+    co::set_send_buffer_size(fd, 8 << 20);
+
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+
+    // with GSO, a single send carries the whole batch, up to 64 segments, 
+    // and no more than a udp datagram (65507 bytes)
+    const bool gso = FLG_gso && FLG_batch > 1 && co::set_udp_segment(fd, FLG_size);
+    if (FLG_gso && !gso) COUT << "UDP_SEGMENT not supported";
+    int n = FLG_batch;
+    if (gso) {
+        const int max_n = 65507 / FLG_size;
+        if (n > 64) n = 64;
+        if (n > max_n) n = max_n;
+        if (n < 1) n = 1;
+    }
+
+    fastring buf(n * FLG_size, 'x');
+    std::vector<struct mmsghdr> msgs(n);
+    std::vector<struct iovec> iovs(n);
+    for (int i = 0; i < n; ++i) {
+        iovs[i].iov_base = (char*)buf.data() + i * FLG_size;
+        iovs[i].iov_len = FLG_size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (true) {
+        int r;
+        if (gso) {
+            r = co::sendto(fd, buf.data(), n * FLG_size, &addr, sizeof(addr));
+        } else if (n == 1) {
+            r = co::sendto(fd, buf.data(), FLG_size, &addr, sizeof(addr));
+        } else {
+            r = co::sendmmsg(fd, msgs.data(), n);
+        }
+        if (r < 0) { COUT << "client send error: " << co::strerror(); break; }
+        atomic_add(&g_send_pkts, n);
+
+        // sending on an UDP socket rarely blocks, yield here to avoid starving 
+        // the server when they are in the same scheduler.
+        co::sleep(0);
+    }
+
+    co::close(fd);
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+    if (FLG_batch < 1) FLG_batch = 1;
+
+    go(udp_server_fun);
+    sleep::ms(32);
+    go(udp_client_fun);
+
+    uint64 recv = 0, send = 0;
+    for (int i = 0; i < FLG_sec; ++i) {
+        sleep::sec(1);
+        uint64 r = atomic_get(&g_recv_pkts);
+        uint64 s = atomic_get(&g_send_pkts);
+        COUT << "batch: " << FLG_batch << ", size: " << FLG_size << ", gso: " << FLG_gso
+             << ", send pps: " << (s - send) << ", recv pps: " << (r - recv);
+        recv = r;
+        send = s;
+    }
+
+    return 0;
+}
@@ -103,6 +103,50 @@ DEF_test(fast) {
         EXPECT_EQ(fastring(buf, fast::dtoa(3.33e-23, buf)), "3.33e-23");
         EXPECT_EQ(fastring(buf, fast::dtoa(3e23, buf)), "3e23");
         EXPECT_EQ(fastring(buf, fast::dtoa(3.33e23, buf)), "3.33e23");
+        EXPECT_EQ(fastring(buf, fast::dtoa(1e21, buf)), "1e21");
+        EXPECT_EQ(fastring(buf, fast::dtoa(123.0, buf)), "123.0");
+        EXPECT_EQ(fastring(buf, fast::dtoa(0.3, buf)), "0.3");
+        EXPECT_EQ(fastring(buf, fast::dtoa(5e-324, buf)), "5e-324");
+        EXPECT_EQ(fastring(buf, fast::dtoa(1.7976931348623157e308, buf)), "1.7976931348623157e308");
+        EXPECT_EQ(fastring(buf, fast::dtoa(0.1 + 0.2, buf)), "0.30000000000000004");
+        EXPECT_EQ(fastring(buf, fast::dtoa(HUGE_VAL, buf)), "inf");
+        EXPECT_EQ(fastring(buf, fast::dtoa(-HUGE_VAL, buf)), "-inf");
+    }
+
+    DEF_case(atod) {
+        double v = 0;
+        EXPECT(fast::atod("0", 1, v));
+        EXPECT_EQ(v, 0.0);
+        EXPECT(fast::atod("-1.5", 4, v));
+        EXPECT_EQ(v, -1.5);
+        EXPECT(fast::atod("0.1", 3, v));
+        EXPECT_EQ(v, 0.1);
+        EXPECT(fast::atod("3.33e-23", 8, v));
+        EXPECT_EQ(v, 3.33e-23);
+        EXPECT(fast::atod("1E+23", 5, v));
+        EXPECT_EQ(v, 1e23);
+        EXPECT(fast::atod("-65.613616999999977", 19, v));
+        EXPECT_EQ(v, -65.613616999999977);
+        EXPECT(fast::atod("2.2250738585072011e-308", 23, v));
+        EXPECT_EQ(v, 2.2250738585072011e-308);
+        EXPECT(fast::atod("4.9406564584124654e-324", 23, v));
+        EXPECT_EQ(v, 5e-324);
+        EXPECT(fast::atod("1e-400", 6, v));
+        EXPECT_EQ(v, 0.0);
+        EXPECT(fast::atod("1.7976931348623157e308", 22, v));
+        EXPECT_EQ(v, 1.7976931348623157e308);
+        EXPECT(fast::atod("123456789012345678901234567890", 30, v));
+        EXPECT_EQ(v, 123456789012345678901234567890.0);
+        EXPECT(fast::atod("3.14xx", 4, v)); // only 4 bytes
+        EXPECT_EQ(v, 3.14);
+
+        EXPECT(!fast::atod("1e309", 5, v));
+        EXPECT(!fast::atod("", 0, v));
+        EXPECT(!fast::atod("-", 1, v));
+        EXPECT(!fast::atod("1.", 2, v));
+        EXPECT(!fast::atod("1e", 2, v));
+        EXPECT(!fast::atod("1.5x", 4, v));
+        EXPECT(!fast::atod(".5", 2, v));
     }
 }
 
@@ -1,9 +1,67 @@
 ﻿#include "co/unitest.h"
 #include "co/json.h"
 #include "co/str.h"
+#include "co/fs.h"
 
 namespace test {
 
+// record events of the SAX parser, keys in @skip are skipped, and parsing 
+// stops at the key @stop
+class SaxRecorder : public json::Handler {
+  public:
+    SaxRecorder(const char* skip = "", const char* stop = "") : _skip(skip), _stop(stop) {}
+
+    virtual int start_object() { _s << '{'; return kGoOn; }
+    virtual int end_object()   { _s << '}'; return kGoOn; }
+    virtual int start_array()  { _s << '['; return kGoOn; }
+    virtual int end_array()    { _s << ']'; return kGoOn; }
+    virtual int key(const char* s, size_t n) {
+        fastring k(s, n);
+        if (k == _stop) return kStop;
+        _s << k << ':';
+        return k == _skip ? kSkip : kGoOn;
+    }
+
+    virtual int null_value()           { _s << "null,"; return kGoOn; }
+    virtual int bool_value(bool v)     { _s << v << ','; return kGoOn; }
+    virtual int int_value(int64 v)     { _s << v << ','; return kGoOn; }
+    virtual int double_value(double v) { _s << v << ','; return kGoOn; }
+    virtual int string_value(const char* s, size_t n) { _s << '\'' << fastring(s, n) << "',"; return kGoOn; }
+
+    fastring str() const { return fastring(_s.data(), _s.size()); }
+
+  private:
+    fastring _skip;
+    fastring _stop;
+    fastream _s;
+};
+
+struct Pos {
+    int x;
+    int y;
+};
+CO_JSON_FIELDS(Pos, x, y)
+
+struct Item {
+    int64 id;
+    bool ok;
+    double price;
+    fastring name;
+    std::string desc;
+    uint64 big;
+    Pos pos;
+    std::vector<int> tags;
+    std::vector<Pos> path;
+};
+CO_JSON_FIELDS(Item, id, ok, price, name, desc, big, pos, tags, path)
+
+struct Flags {
+    uint8 level;
+    char c;
+    std::vector<bool> bits;
+};
+CO_JSON_FIELDS(Flags, level, c, bits)
+
 DEF_test(json) {
     DEF_case(null) {
         Json n;
@@ -192,6 +250,56 @@ DEF_test(json) {
         EXPECT_EQ(z[2].string_size(), 4);
     }
 
+    DEF_case(hash_member) {
+        fastream fs;
+        fs << '{';
+        for (int i = 0; i < 100; ++i) fs << "\"k" << i << "\":" << i << ',';
+        fs << "\"k7\":777}";
+        Json r = json::parse(fs.data(), fs.size());
+        EXPECT_EQ(r.object_size(), 101);
+        EXPECT_EQ(r["k0"].get_int(), 0);
+        EXPECT_EQ(r["k7"].get_int(), 7);
+        EXPECT_EQ(r["k99"].get_int(), 99);
+        EXPECT(!r.has_member("k100"));
+        EXPECT(!r.has_member("k"));
+
+        for (int i = 100; i < 300; ++i) r.add_member((fastring("k") << i).c_str(), i);
+        bool ok = true;
+        for (int i = 0; i < 300; ++i) ok = ok && r[(fastring("k") << i).c_str()].get_int() == i;
+        EXPECT(ok);
+        EXPECT_EQ(r.object_size(), 301);
+
+        r["x"] = 3;
+        EXPECT_EQ(r.object_size(), 302);
+        EXPECT_EQ(r["x"].get_int(), 3);
+
+        Json u(r);
+        EXPECT_EQ(u["k299"].get_int(), 299);
+        EXPECT(!u.has_member("y"));
+
+        // lookups never write the JBlock, strings got before stay valid
+        r.add_member("s", "hello");
+        const Json& c = r;
+        const char* hs = c["s"].get_string();
+        bool found = true;
+        for (int i = 0; i < 300; ++i) found = found && c.has_member((fastring("k") << i).c_str());
+        EXPECT(found);
+        EXPECT(hs == c["s"].get_string());
+
+        Json m = json::parse_msgpack(r.msgpack());
+        EXPECT_EQ(m["k299"].get_int(), 299);
+        EXPECT_EQ(m["s"].get_string(), fastring("hello"));
+
+        json::Value o = r.add_object("o");
+        for (int i = 0; i < 20; ++i) o.add_member((fastring("o") << i).c_str(), i);
+        EXPECT_EQ(o["o19"].get_int(), 19);
+        o.set_null();
+        EXPECT(!o.has_member("o19"));
+        o.add_member("o19", 1);
+        EXPECT_EQ(o["o19"].get_int(), 1);
+        EXPECT_EQ(o.object_size(), 1);
+    }
+
     DEF_case(has_member) {
         Json v;
         v.add_member("apple", "666");
@@ -316,6 +424,20 @@ DEF_test(json) {
         v = json::parse(fastring().append('"').append(300, 'x').append('"'));
         EXPECT(v.is_string());
         EXPECT_EQ(v.str(), fastring().append('"').append(300, 'x').append('"'));
+
+        // escapes at any position of a block (16, 32 or 64 bytes)
+        bool ok = true;
+        for (int n = 0; n < 130; ++n) {
+            fastring x(n, 'x');
+            x.append('"').append(n & 7, 'y').append('\\').append(n, 'z');
+            fastring q = fastring(x).replace("\\", "\\\\").replace("\"", "\\\"");
+            fastring s = json::parse(fastring().append("[\"").append(q).append("\"]")).str();
+            ok = ok && fastring(json::parse(s)[0].get_string()) == x;
+        }
+        EXPECT(ok);
+
+        EXPECT(json::parse(fastring().append('"').append(100, 'x')).is_null());
+        EXPECT(json::parse(fastring().append('"').append(100, 'x').append('\\')).is_null());
     }
 
     DEF_case(parse_array) {
@@ -385,6 +507,407 @@ DEF_test(json) {
 
         v = json::parse("{ \"key\": \"\u4e2d\u56fd\u4eba\" }");
         EXPECT_EQ(fastring(v["key"].get_string()), "中国人");
+
+        fastring s(fastring(40, ' ').append("{\"a\"").append(70, '\n').append(':').append(33, '\t'));
+        s.append("[1,").append(17, '\r').append("2]").append(64, ' ').append('}').append(100, ' ');
+        EXPECT_EQ(json::parse(s).str(), "{\"a\":[1,2]}");
+
+        v = json::parse("\"\\u0001\"");
+        EXPECT_EQ(v.str(), fastring("\"\x01\""));
+        v.clear();
+        v["s"] = fastring(50, 'x').append("\x01\r").append(50, 'y');
+        EXPECT_EQ(v["s"].str(), fastring("\"").append(50, 'x').append("\x01\\r").append(50, 'y').append('"'));
+    }
+
+    DEF_case(sax) {
+        const char* x = "{\"a\":1, \"b\":[true, null, -2.5, \"x\\ny\"], \"c\":{\"d\":[[]], \"e\":\"]}\\\"\"}, \"f\":false}";
+        SaxRecorder r;
+        EXPECT(json::parse(x, strlen(x), r));
+        EXPECT_EQ(r.str(), "{a:1,b:[true,null,-2.5,'x\ny',]c:{d:[[]]e:']}\"',}f:false,}");
+
+        SaxRecorder r1("c");
+        EXPECT(json::parse(x, strlen(x), r1));
+        EXPECT_EQ(r1.str(), "{a:1,b:[true,null,-2.5,'x\ny',]c:f:false,}");
+
+        SaxRecorder r2("b", "c");
+        EXPECT(json::parse(x, strlen(x), r2));
+        EXPECT_EQ(r2.str(), "{a:1,b:");
+
+        SaxRecorder r3;
+        EXPECT(json::parse(fastring("  [1, {}, \"s\"]  "), r3));
+        EXPECT_EQ(r3.str(), "[1,{}'s',]");
+
+        SaxRecorder r4;
+        EXPECT(json::parse(fastring("18446744073709551615"), r4));
+        EXPECT_EQ(r4.str(), "-1,");
+
+        // a trailing comma is allowed, as json::parse() does
+        SaxRecorder r7;
+        EXPECT(json::parse(fastring("[1, [2,], {\"a\":{}, }, ]"), r7));
+        EXPECT_EQ(r7.str(), "[1,[2,]{a:{}}]");
+
+        // rejected by json::parse() too
+        const char* errs[] = {
+            "", "{", "[,]", "[1,,]", "{,}", "{\"a\" 1}", "{\"a\":1,,}", "[1 2]", "tru", "{} x", "[--1]", "{1:2}", "]",
+            "{\"c\":[1,}", "{\"c\":\"x}", "{\"c\":xyz}",
+        };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); ++i) {
+            SaxRecorder r5("c");
+            ok = ok && !json::parse(errs[i], strlen(errs[i]), r5) && !Json().parse_from(errs[i]);
+        }
+        EXPECT(ok);
+
+        // the same document as json::parse() accepts
+        const char* docs[] = {
+            "{\"a\":23, \"b\" : [1, -2.5e3, true, false, null], \"c\": {\"d\":\"x\\\"y\\\\z\\u4e2d\"}}",
+            "[ \"hello\", [[]], {\"k\":[{}]}, 0.1 ]  ",
+            "{\"a\":[1,], \"b\":{\"c\":2,},}",
+        };
+        for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+            SaxRecorder r6;
+            json::Handler h;
+            ok = ok && json::parse(docs[i], strlen(docs[i]), r6) && json::parse(docs[i], strlen(docs[i]), h);
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(lazy) {
+        fastring x("{\"a\":1, \"b\":[true, null, -2.5, \"x\\ny\", 18446744073709551615], \"c\":{\"d\":[[], {}], \"e\":\"]}\"}, \"f\":false}");
+        json::Lazy doc;
+        EXPECT(doc.parse_from(x));
+        EXPECT_EQ(doc.size(), 4);
+        EXPECT(doc.root().is_object());
+        EXPECT_EQ(doc["a"].get_int(), 1);
+        EXPECT(doc["a"].is_int());
+        EXPECT_EQ(doc["a"].get_double(), 0.0);
+        EXPECT(doc["b"].is_array());
+        EXPECT_EQ(doc["b"].size(), 5);
+        EXPECT(doc["b"][0].get_bool());
+        EXPECT(doc["b"][1].is_null());
+        EXPECT(doc["b"][2].is_double());
+        EXPECT_EQ(doc["b"][2].get_double(), -2.5);
+        EXPECT_EQ(doc["b"][3].get_string(), "x\ny");
+        EXPECT_EQ(doc["b"][3].size(), 3);
+        EXPECT_EQ(doc["b"][4].get_uint64(), MAX_UINT64);
+        EXPECT(doc["b"][5].is_null());
+        EXPECT_EQ(doc["c"]["d"].str(), "[[], {}]");
+        EXPECT_EQ(doc["c"]["d"][1].str(), "{}");
+        EXPECT_EQ(doc["c"]["e"].get_string(), "]}");
+        EXPECT_EQ(doc["c"].size(), 2);
+        EXPECT(!doc["f"].get_bool());
+        EXPECT(doc["f"].is_bool());
+        EXPECT(doc.has_member("f"));
+        EXPECT(!doc.has_member("g"));
+        EXPECT(doc["g"].is_null());
+        EXPECT(doc["g"]["h"][3].is_null());
+        EXPECT_EQ(doc["g"].get_string(), "");
+        EXPECT_EQ(doc["a"].get_string(), "");
+        EXPECT_EQ(doc["b"].get_int(), 0);
+
+        x = " 12 ";
+        EXPECT(doc.parse_from(x));
+        EXPECT_EQ(doc.root().get_int(), 12);
+        EXPECT_EQ(doc.root().str(), "12");
+
+        // only quotes and brackets are checked by parse_from()
+        const char* errs[] = {
+            "", "{", "]", "tru", "{} x", "[1] [2]", "{\"a\":[}", "[{]", "\"abc", "[\"a]", "[\"a\\\"]",
+        };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); ++i) {
+            ok = ok && !doc.parse_from(errs[i], strlen(errs[i]));
+        }
+        EXPECT(ok);
+        EXPECT(doc.root().is_null());
+
+        // malformed values are read as null
+        x = "[1.x, tru, -, \"a\"]";
+        EXPECT(doc.parse_from(x));
+        EXPECT(doc[0].is_null());
+        EXPECT(doc[1].is_null());
+        EXPECT(doc[2].is_null());
+        EXPECT_EQ(doc[3].get_string(), "a");
+
+        // a malformed scalar never skips brackets, the array is malformed
+        x = "[1x[{},2],{}]";
+        EXPECT(doc.parse_from(x));
+        EXPECT_EQ(doc.size(), 0);
+        EXPECT(doc[0].is_null());
+        EXPECT(doc[1].is_null());
+        EXPECT(doc[2].is_null());
+        x = "{\"a\":1x{\"b\":[]},\"c\":2}";
+        EXPECT(doc.parse_from(x));
+        EXPECT_EQ(doc.size(), 0);
+        EXPECT(doc["c"].is_null());
+
+        // backslashes, quotes and brackets in strings, at any position of a 64-byte block
+        const char cs[] = { '\\', '"', '[', ']', '{', '}', 'a' };
+        ok = true;
+        for (int i = 0; i < 2000; ++i) {
+            fastring v;
+            const int n = i % 150;
+            for (int j = 0; j < n; ++j) v.append(cs[(i * 7 + j * j * 13 + j / 3) % 7]);
+            Json o;
+            o.add_member("s", v);
+            fastring t = o.str();
+            t.back() = ',';
+            t.append("\"t\":[1,{\"u\":[2]}]}");
+            ok = ok && doc.parse_from(t) && doc["s"].get_string() == v && doc["t"][1]["u"][0].get_int() == 2;
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(fields) {
+        Item a;
+        a.id = -3;
+        a.ok = true;
+        a.price = 0.1;
+        a.name = "x\"y\n";
+        a.desc = "\xe4\xb8\xad";
+        a.big = MAX_UINT64;
+        a.pos.x = 1;
+        a.pos.y = 2;
+        a.tags.push_back(7);
+        a.tags.push_back(8);
+        a.path.push_back(a.pos);
+
+        fastring s = json::to_str(a);
+        EXPECT_EQ(s, "{\"id\":-3,\"ok\":true,\"price\":0.1,\"name\":\"x\\\"y\\n\",\"desc\":\"\xe4\xb8\xad\","
+                     "\"big\":18446744073709551615,\"pos\":{\"x\":1,\"y\":2},\"tags\":[7,8],\"path\":[{\"x\":1,\"y\":2}]}");
+        EXPECT_EQ(fastring(json::parse(s)["name"].get_string()), a.name);
+
+        Item b;
+        b.big = 0;
+        EXPECT(json::from_str(s, b));
+        EXPECT_EQ(b.id, -3);
+        EXPECT(b.ok);
+        EXPECT_EQ(b.price, 0.1);
+        EXPECT_EQ(b.name, "x\"y\n");
+        EXPECT_EQ(b.desc, std::string("\xe4\xb8\xad"));
+        EXPECT_EQ(b.big, MAX_UINT64);
+        EXPECT_EQ(b.pos.y, 2);
+        EXPECT_EQ(b.tags.size(), 2);
+        EXPECT_EQ(b.tags[1], 8);
+        EXPECT_EQ(b.path.size(), 1);
+        EXPECT_EQ(b.path[0].x, 1);
+        EXPECT_EQ(json::to_str(b), s);
+
+        // unknown members are skipped, null and missing fields are left unchanged
+        Pos p;
+        p.x = 3;
+        p.y = 4;
+        EXPECT(json::from_str(fastring(" { \"z\" : [1, {\"x\":9}], \"x\" : null , \"w\":\"}\" } "), p));
+        EXPECT_EQ(p.x, 3);
+        EXPECT_EQ(p.y, 4);
+
+        std::vector<Pos> v;
+        EXPECT(json::from_str(fastring("[{\"x\":1}, {\"y\":2.0e0}]"), v) == false); // 2.0 is not an int
+        EXPECT(json::from_str(fastring("[{\"x\":1}, {\"y\":2}] "), v));
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(json::to_str(std::vector<Pos>()), "[]");
+
+        // a trailing comma is allowed, as json::parse() does
+        EXPECT(json::from_str(fastring("[{\"x\":5,}, {\"y\":6}, ]"), v));
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0].x, 5);
+        EXPECT_EQ(v[1].y, 6);
+        EXPECT(json::from_str(fastring("{\"tags\":[1,2,],}"), b));
+        EXPECT_EQ(b.tags.size(), 2);
+
+        // small integers are numbers, std::vector<bool> is an array of bools
+        Flags f;
+        f.level = 200;
+        f.c = 'A';
+        f.bits.push_back(true);
+        f.bits.push_back(false);
+        s = json::to_str(f);
+        EXPECT_EQ(s, "{\"level\":200,\"c\":65,\"bits\":[true,false]}");
+        Flags g;
+        g.bits.resize(3, true);
+        EXPECT(json::from_str(s, g));
+        EXPECT_EQ(g.level, 200);
+        EXPECT_EQ(g.c, 'A');
+        EXPECT_EQ(g.bits.size(), 2);
+        EXPECT(g.bits[0] && !g.bits[1]);
+
+        const char* errs[] = { "", "{", "[]", "{\"x\":1,,}", "{,}", "{\"x\" 1}", "{\"x\":\"1\"}", "{\"x\":1} x", "{,\"x\":1}" };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); ++i) {
+            ok = ok && !json::from_str(errs[i], strlen(errs[i]), p);
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(stream_parse) {
+        const char* docs[] = {
+            "{\"a\":23, \"b\" : [1, -2.5e3, true, false, null], \"c\": {\"d\":\"x\\\"y\\\\z\\u4e2d\"}, \"e\":{}, \"f\":[]}",
+            "[ \"hello\", [[]], {\"k\":[{}]}, 18446744073709551615, 0.1 ]  ",
+            "\"str\\n\"",
+            "true",
+            "[1, [2,], {\"a\":{}, }, ]",
+        };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+            const size_t n = strlen(docs[i]);
+            const fastring x = json::parse(docs[i]).str();
+            for (size_t k = 1; k <= n; ++k) {
+                json::StreamParser p;
+                int r = 0;
+                for (size_t j = 0; j < n && r >= 0; j += k) r = p.feed(docs[i] + j, n - j < k ? n - j : k);
+                ok = ok && r >= 0 && p.finish() && p.result().str() == x;
+            }
+        }
+        EXPECT(ok);
+
+        json::StreamParser p;
+        EXPECT_EQ(p.feed("12", 2), 0);
+        EXPECT_EQ(p.feed("3", 1), 0);
+        EXPECT(p.finish());
+        EXPECT_EQ(p.result().get_int(), 123);
+
+        p.reset();
+        EXPECT_EQ(p.feed("{\"a\"", 4), 0);
+        EXPECT_EQ(p.feed(":1}", 3), 1);
+        EXPECT_EQ(p.feed("  \n", 3), 1);
+        Json v = std::move(p.result());
+        EXPECT_EQ(v["a"].get_int(), 1);
+
+        p.reset();
+        EXPECT_EQ(p.feed("[1,", 3), 0);
+        EXPECT_EQ(p.feed("]", 1), 1);
+        EXPECT_EQ(p.feed(" x", 2), -1);
+        EXPECT(!p.finish());
+
+        p.reset();
+        EXPECT_EQ(p.feed("[1,2", 4), 0);
+        EXPECT(!p.finish());
+
+        // rejected by json::parse() too
+        const char* errs[] = {
+            "{", "[,]", "[1,,]", "{,}", "{\"a\" 1}", "{\"a\":1,,}", "[1 2]", "tru", "trux", "{} x", "[--1]", "{1:2}", "]"
+        };
+        ok = true;
+        for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); ++i) {
+            p.reset();
+            const int r = p.feed(errs[i], strlen(errs[i]));
+            ok = ok && (r < 0 || !p.finish()) && !Json().parse_from(errs[i]);
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(insitu) {
+        fastring s("{\"a\":\"hello\",\"b\":[\"x\\\"y\\u0000z\",\"\",1.5],\"c\":{\"d\":\"\\n\"}}");
+        const fastring x = json::parse(s).str();
+        Json v;
+        EXPECT(v.parse_from(s, json::kInSitu));
+        EXPECT_EQ(v.str(), x);
+
+        // strings point to the input
+        const char* a = v["a"].get_string();
+        EXPECT(a > s.data() && a < s.data() + s.size());
+        EXPECT_EQ(fastring(a), "hello");
+        EXPECT(v["a"].get_string_view() == "hello");
+        EXPECT_EQ(v["b"][0].get_string_view().size(), 5); // "x\"y\0z"
+        EXPECT(v["b"][0].get_string_view() == json::StrView("x\"y\0z", 5));
+        EXPECT(v["b"][1].get_string_view().empty());
+        EXPECT(v["b"][2].get_string_view().empty());
+        EXPECT(v["c"]["d"].get_string_view() == "\n");
+
+        // copies own their strings
+        Json u(v);
+        Json w;
+        w = v;
+        memset((char*)s.data(), 'x', s.size());
+        EXPECT_EQ(u.str(), x);
+        EXPECT_EQ(w.str(), x);
+        EXPECT(u["b"][0].get_string_view() == json::StrView("x\"y\0z", 5));
+
+        fastring e("{\"a\":\"b\" x}");
+        EXPECT(json::parse((char*)e.data(), e.size(), json::kInSitu).is_null());
+        fastring n("[\"a\"]");
+        EXPECT_EQ(json::parse((char*)n.data(), n.size(), 0).str(), "[\"a\"]");
+        EXPECT_EQ(n, "[\"a\"]"); // not changed without kInSitu
+    }
+
+    DEF_case(parse_file) {
+        const char* path = "json_parse_file.json";
+        const fastring s("{\"a\":\"hello\",\"b\":[\"x\\\"y\\u4e2d\",\"\",1.5,true],\"c\":{\"d\":\"\\n\"},\"e\":null}");
+        {
+            fs::file f(path, 'w');
+            f.write(s);
+        }
+
+        Json x;
+        {
+            Json v = json::parse_file(path);
+            EXPECT_EQ(v.str(), json::parse(s).str());
+            EXPECT_EQ(fastring(v["a"].get_string()), "hello");
+            EXPECT_EQ(v["a"].string_size(), 5);
+            EXPECT_EQ(fastring(v["b"][0].get_string()), "x\"y\xe4\xb8\xad");
+            EXPECT_EQ(fastring(v["c"]["d"].get_string()), "\n");
+            x = v; // the mapping is shared by copies
+        }
+        EXPECT_EQ(fastring(x["b"][0].get_string()), "x\"y\xe4\xb8\xad");
+        x.add_member("f", "new");
+        EXPECT_EQ(x.object_size(), 5);
+
+        fs::file f(path, 'r');
+        EXPECT_EQ(f.read(s.size() + 8), s); // the file is not modified
+        f.close();
+
+        EXPECT(x.parse_file(path));
+        EXPECT(!x.parse_file("json_parse_file.none"));
+        EXPECT(json::parse_file("json_parse_file.none").is_null());
+        fs::remove(path);
+    }
+
+    DEF_case(msgpack) {
+        Json v = json::parse("{\"a\":1,\"b\":[true,false,null],\"c\":\"xx\",\"d\":{},\"e\":[],\"f\":-1.5}");
+        fastring s = v.msgpack();
+        EXPECT_EQ(s, fastring(
+            "\x86\xa1" "a\x01\xa1" "b\x93\xc3\xc2\xc0\xa1" "c\xa2" "xx\xa1" "d\x80\xa1" "e\x90\xa1" "f"
+            "\xcb\xbf\xf8\x00\x00\x00\x00\x00\x00", 32));
+        EXPECT_EQ(json::parse_msgpack(s).str(), v.str());
+
+        // integers take the smallest format
+        const int64 ints[] = { 0, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL,
+                               -1, -32, -33, -128, -129, -32768, -32769, MIN_INT32, MIN_INT32 - 1LL, MIN_INT64 };
+        const size_t lens[] = { 1, 1, 2, 2, 3, 3, 5, 5, 9, 1, 1, 2, 2, 3, 3, 5, 5, 9, 9 };
+        bool ok = true;
+        for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i) {
+            Json x;
+            x.push_back(ints[i]);
+            s = x[0].msgpack();
+            Json y = json::parse_msgpack(s);
+            ok = ok && s.size() == lens[i] && y.is_int() && y.get_int64() == ints[i];
+        }
+        EXPECT(ok);
+
+        // strings and containers longer than the fix formats
+        Json o;
+        auto a = o.add_array("a");
+        for (int i = 0; i < 20; ++i) a.push_back(i);
+        o.add_member("s8", fastring(40, 'y'));
+        o.add_member("s16", fastring(300, 'y'));
+        o.add_member("s32", fastring(70000, 'z'));
+        for (int i = 0; i < 100; ++i) o.add_member(str::from(i).c_str(), i * 1000);
+        s = o.msgpack();
+        EXPECT_EQ(json::parse_msgpack(s).str(), o.str());
+
+        // float 32, bin 8, map 16, and errors
+        EXPECT_EQ(json::parse_msgpack(fastring("\xca\x3f\xc0\x00\x00", 5)).get_double(), 1.5);
+        EXPECT_EQ(fastring(json::parse_msgpack(fastring("\xc4\x02zz", 4)).get_string()), "zz");
+        EXPECT_EQ(json::parse_msgpack(fastring("\xde\x00\x01\xa1k\x07", 6))["k"].get_int(), 7);
+
+        const char* errs[] = { "", "\x92\x01", "\x81\x01\x01", "\xa3xx", "\xcd\x01", "\xc1", "\x01\x02", "\xdd\xff\xff\xff\xff" };
+        const size_t elens[] = { 0, 2, 3, 3, 2, 1, 2, 5 };
+        ok = true;
+        for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); ++i) {
+            Json x;
+            ok = ok && !x.parse_msgpack(errs[i], elens[i]);
+        }
+        EXPECT(ok);
     }
 
     DEF_case(parse_error) {
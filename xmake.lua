@@ -50,6 +50,13 @@ option("with_libcurl")
     add_defines("HAS_LIBCURL")
 option_end()
 
+option("with_zlib")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with zlib, required by compression of log files")
+    add_defines("HAS_ZLIB")
+option_end()
+
 option("disable_hook")
     set_default(false)
     set_showmenu(true)
@@ -75,6 +82,11 @@ elseif has_config("with_openssl") then
     add_packages("openssl")
 end
 
+if has_config("with_zlib") then
+    add_requires("zlib")
+    add_packages("zlib")
+end
+
 
 -- include dir
 add_includedirs("include")